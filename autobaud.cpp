@@ -0,0 +1,154 @@
+/*********************
+ * Baud rate detection
+ *********************
+ *
+ */
+#include <errno.h>
+#include <linux/serial.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "autobaud.h"
+#include "tty.h"
+
+// The usual ones first, they lock sooner
+const int Autobaud::RATES[] = { 115200, 9600, 57600, 38400, 19200, 230400, 460800, 4800, 2400, 1200 };
+const int Autobaud::NRATES = sizeof(RATES) / sizeof(RATES[0]);
+
+static uint64_t now_ms()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+// Line errors counted by the driver, 0 if it doesn't count them
+static uint64_t line_errors(const int fd)
+{
+    serial_icounter_struct ic;
+    if (ioctl(fd, TIOCGICOUNT, &ic) < 0)
+        return 0;
+    return (uint64_t)ic.frame + ic.parity + ic.brk + ic.overrun;
+}
+
+Autobaud::Autobaud()
+    : best_score(-1)
+{
+    memset(stats, 0, sizeof(stats));
+}
+
+void Autobaud::count(Stat& s, const unsigned char *p, const int n)
+{
+    for (int i=0; i<n; i++)
+    {
+        unsigned char c = p[i];
+        if ((c >= 0x20  &&  c < 0x7f)  ||  c == '\r'  ||  c == '\n'  ||  c == '\t'  ||  c == 0x1b)
+            s.text++;
+        if (c == '\n'  &&  s.last >= 0  &&  (s.last == '\r'  ||  (s.last >= 0x20  &&  s.last < 0x7f)))
+            s.lines++;
+        s.last = c;
+    }
+    s.bytes += n;
+}
+
+// Percent of text less 4 per error, up to 5 more for lines. -1 - too
+// little data to judge
+int Autobaud::rate_score(const Stat& s) const
+{
+    if (s.bytes < MINBYTES)
+        return -1;
+    int64_t good = (int64_t)s.text - 4 * (int64_t)s.errors;
+    int     score = good > 0 ? (int)(good * 100 / s.bytes) : 0;
+    return score + (s.lines < 5 ? (int)s.lines : 5);
+}
+
+// Read into "s" until "deadline_ms" or ENOUGH bytes, -1 on failure
+int Autobaud::listen(const int fd, Stat& s, const uint64_t deadline_ms)
+{
+    unsigned char buf[256];
+    uint64_t      got = 0;
+
+    s.last = -1;
+    for (uint64_t now = now_ms(); now < deadline_ms  &&  got < ENOUGH; now = now_ms())
+    {
+        pollfd p;
+        p.fd = fd;
+        p.events = POLLIN;
+        int ready = poll(&p, 1, deadline_ms - now);
+        if (ready < 0  &&  errno != EINTR)
+            return -1;
+        if (ready <= 0)
+            continue;
+        int n = read(fd, buf, sizeof(buf));
+        if (n < 0  &&  errno != EINTR  &&  errno != EAGAIN)
+            return -1;
+        if (n == 0)
+        {
+            errno = EIO;
+            return -1;
+        }
+        if (n > 0)
+        {
+            count(s, buf, n);
+            got += n;
+        }
+    }
+    return 0;
+}
+
+int Autobaud::detect(Tty& tty, const int fd, const int ms, const bool verbose)
+{
+    termios  orig;
+    uint64_t end = now_ms() + ms;
+    int      best = -1;
+
+    if (tcgetattr(fd, &orig) < 0)
+        return -1;
+    memset(stats, 0, sizeof(stats));
+    best_score = -1;
+    while (now_ms() < end  &&  (best < 0  ||  best_score < LOCK))
+        for (int i=0; i<NRATES; i++)
+        {
+            uint64_t now = now_ms();
+            if (now >= end)
+                break;
+            if (!tty.set_speed(fd, RATES[i]))
+            {
+                if (errno == EINVAL)
+                    continue;       // not supported here
+                return -1;
+            }
+
+            uint64_t errors = line_errors(fd);
+            if (listen(fd, stats[i], now + DWELL_MS < end ? now + DWELL_MS : end) < 0)
+                return -1;
+            stats[i].errors += line_errors(fd) - errors;
+
+            int score = rate_score(stats[i]);
+            if (verbose  &&  score >= 0)
+                fprintf(stderr, "autobaud: %d - %d%% of %llu bytes\r\n", RATES[i], score,
+                        (unsigned long long)stats[i].bytes);
+            if (score > best_score)
+            {
+                best_score = score;
+                best = i;
+            }
+            if (best_score >= LOCK)
+                break;
+        }
+
+    if (best < 0)
+    {
+        // Nothing heard, the speed is left alone
+        tcsetattr(fd, TCSANOW, &orig);
+        return 0;
+    }
+    if (!tty.set_speed(fd, RATES[best]))
+        return -1;
+    return RATES[best];
+}
@@ -0,0 +1,71 @@
+/*********************
+ * Baud rate detection
+ *********************
+ *
+ */
+#ifndef AUTOBAUD_H
+#define AUTOBAUD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+class Tty;
+
+/*!
+  \class Autobaud
+  \brief Find the speed of a talking device
+
+  The candidate rates are set one after another on the open tty, each
+  listened to for DWELL_MS or until ENOUGH bytes come. The data received
+  is scored: the share of text (printable, CR, LF, TAB and ESC) less the
+  framing, parity and break errors the driver counted, plus a little for
+  lines ending the usual way. Data at a wrong rate is mostly high bytes,
+  zeros and errors. A rate scoring LOCK or more is taken at once,
+  otherwise the rounds go on until the time is over and the best rate
+  heard is taken. Scores of a rate add up over the rounds.
+
+  The data read meanwhile is not relayed, the device should be talking:
+  booting or printing a prompt on Enter typed before.
+*/
+class Autobaud
+{
+public:
+    static const int    DWELL_MS = 250;
+    static const size_t ENOUGH = 512;    // bytes to judge a rate
+    static const size_t MINBYTES = 16;   // less tells nothing
+    static const int    LOCK = 90;       // score, percent
+
+    Autobaud();
+
+    /*! Detect the speed of tty "fd" in "ms" milliseconds
+      \param verbose tell the rates tried on stderr
+      \return the rate set, 0 - the device said nothing, the speed is
+      left as it was, -1 - failure, errno is set
+     */
+    int detect(Tty& tty, const int fd, const int ms, const bool verbose);
+
+    //! Score of the rate detected, percent
+    int score() const { return best_score; }
+
+private:
+    struct Stat
+    {
+        uint64_t bytes;
+        uint64_t text;
+        uint64_t lines;     // LF after text or CR
+        uint64_t errors;    // framing, parity, break
+        int      last;      // previous byte, -1 - none
+    };
+
+    static const int RATES[];
+    static const int NRATES;
+
+    Stat stats[16];
+    int  best_score;
+
+    void count(Stat& s, const unsigned char *p, const int n);
+    int  rate_score(const Stat& s) const;
+    int  listen(const int fd, Stat& s, const uint64_t deadline_ms);
+};
+
+#endif
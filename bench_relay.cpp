@@ -0,0 +1,184 @@
+/*********************
+ * con relay benchmark
+ *********************
+ *
+ * End to end throughput of "con -p" relaying generated console traffic
+ * from a UNIX socket to stdout, for every backend and the common relay
+ * modes: plain, log, log without colors, timestamps, hexa, triggered
+ * capture (the patterns never match). MB/s is of
+ * the bytes sent to con.
+ *
+ *     bench_relay [CON_BINARY [MB]]
+ */
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "str_utils.h"
+
+static const char *SOCK_PATH = "/tmp/bench_relay.sock";
+static const char *LOG_PATH  = "/tmp/bench_relay.log";     // of the "log" modes
+
+static double now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static std::string console_data(const size_t size)
+{
+    static const char *msgs[] =
+    {
+        "usb 1-1: new high-speed USB device number 2 using ehci-platform",
+        "EXT4-fs (mmcblk0p2): mounted filesystem with ordered data mode",
+        "Starting \033[0;1;39mNetwork Time Synchronization\033[0m...",
+        "[  \033[0;32mOK\033[0m  ] Reached target \033[0;1;39mMulti-User System\033[0m.",
+        "-rw-r--r--    1 root     root        12288 Jan  1 00:00 messages",
+        "\033[1;31mERROR\033[0m: i2c i2c-1: timeout waiting for bus ready",
+    };
+    std::string d;
+    unsigned    seed = 1;
+
+    while (d.size() < size)
+    {
+        seed = seed * 1103515245 + 12345;
+        unsigned r = seed >> 16;
+        str::sappend(d, "[%5u.%06u] %s\r\n", r % 1000, r * 7 % 1000000,
+                     msgs[r % (sizeof(msgs) / sizeof(msgs[0]))]);
+    }
+    return d;
+}
+
+static bool writeall(const int fd, const char *p, size_t n)
+{
+    while (n)
+    {
+        ssize_t k = write(fd, p, n);
+        if (k < 0  &&  errno == EINTR)
+            continue;
+        if (k <= 0)
+            return false;
+        p += k;
+        n -= k;
+    }
+    return true;
+}
+
+// Relay "d" through "con -p -q -i BACKEND FLAGS -c SOCK_PATH", return MB/s
+// or a negative value on failure
+static double run(const char *con, const char *backend, const char *flags, const std::string& d)
+{
+    int ls = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un a;
+
+    memset(&a, 0, sizeof(a));
+    a.sun_family = AF_UNIX;
+    strncpy(a.sun_path, SOCK_PATH, sizeof(a.sun_path) - 1);
+    unlink(SOCK_PATH);
+    if (ls < 0  ||  bind(ls, (sockaddr *)&a, sizeof(a)) < 0  ||  listen(ls, 1) < 0)
+    {
+        perror(SOCK_PATH);
+        return -1;
+    }
+
+    // stdin stays open and silent, stdout is read here, the EOF message
+    // of con is not wanted
+    int in[2], out[2];
+    if (pipe(in) < 0  ||  pipe(out) < 0)
+        return -1;
+    std::string cmd = str::sprintf("exec %s -p -q -i %s %s -c %s 2>/dev/null", con, backend, flags, SOCK_PATH);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(in[0], 0);
+        dup2(out[1], 1);
+        close(in[1]);
+        close(out[0]);
+        execl("/bin/sh", "sh", "-c", cmd.c_str(), (char *)0);
+        _exit(127);
+    }
+    close(in[0]);
+    close(out[1]);
+
+    int s = accept(ls, 0, 0);
+    close(ls);
+    if (s < 0)
+        return -1;
+
+    // Sender is a child, so the output is read while the data goes in
+    double start = now();
+    pid_t  tx = fork();
+    if (tx == 0)
+        _exit(writeall(s, d.data(), d.size()) ? 0 : 1);
+    close(s);
+
+    // con exits at the socket EOF, after the data is out
+    char   buf[64 * 1024];
+    size_t got = 0;
+    for (ssize_t n; (n = read(out[0], buf, sizeof(buf))) != 0; )
+        if (n > 0)
+            got += n;
+        else if (errno != EINTR)
+            break;
+    double t = now() - start;
+
+    int st1, st2;
+    close(out[0]);
+    close(in[1]);
+    waitpid(tx, &st1, 0);
+    waitpid(pid, &st2, 0);
+    unlink(SOCK_PATH);
+    if (!got  ||  !WIFEXITED(st1)  ||  WEXITSTATUS(st1))
+        return -1;
+    return d.size() / t / 1e6;
+}
+
+int main(int ac, char *av[])
+{
+    static const struct { const char *name, *flags; } modes[] =
+    {
+        { "plain",   ""                           },
+        { "log",     "-l /tmp/bench_relay.log"    },
+        { "log -n",  "-l /tmp/bench_relay.log -n" },
+        { "-T mono", "-T mono"                    },
+        { "-X",      "-X"                         },
+        { "-Y",      "-Y"                         },
+        { "trigger", "-trigger 'Kernel panic' -trigger 'WATCHDOG' -trigger 'assert'" },
+    };
+    static const char *backends[] = { "select", "uring", "threads" };
+    const char        *con = ac > 1 ? av[1] : "./con";
+    const size_t      mb = ac > 2 ? atoi(av[2]) : 64;
+    std::string       d = console_data(mb << 20);
+
+    signal(SIGPIPE, SIG_IGN);
+    printf("%-10s", "");
+    for (unsigned b=0; b<sizeof(backends)/sizeof(backends[0]); b++)
+        printf("%12s", backends[b]);
+    printf("   MB/s, %zu MB through %s\n", mb, con);
+    for (unsigned m=0; m<sizeof(modes)/sizeof(modes[0]); m++)
+    {
+        printf("%-10s", modes[m].name);
+        for (unsigned b=0; b<sizeof(backends)/sizeof(backends[0]); b++)
+        {
+            double r = run(con, backends[b], modes[m].flags, d);
+            if (r < 0)
+                printf("%12s", "failed");
+            else
+                printf("%12.1f", r);
+            fflush(stdout);
+        }
+        printf("\n");
+    }
+    unlink(LOG_PATH);
+    return 0;
+}
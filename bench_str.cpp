@@ -0,0 +1,162 @@
+/*********************
+ * str_utils benchmark
+ *********************
+ *
+ * Throughput of str_utils routines on generated console traffic: boot
+ * log lines with colors, a shell session with telnet negotiation and
+ * some binary noise. MB/s is of the input bytes.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+#include "str_utils.h"
+
+static const size_t DATA_SIZE = 4 << 20;
+static const double MIN_TIME = 0.5;      // s per routine
+
+static double now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static std::string console_data()
+{
+    static const char *msgs[] =
+    {
+        "usb 1-1: new high-speed USB device number 2 using ehci-platform",
+        "EXT4-fs (mmcblk0p2): mounted filesystem with ordered data mode",
+        "eth0: link up, 100Mbps, full-duplex, lpa 0x45E1",
+        "Starting \033[0;1;39mNetwork Time Synchronization\033[0m...",
+        "[  \033[0;32mOK\033[0m  ] Reached target \033[0;1;39mMulti-User System\033[0m.",
+        "root@target:~# ls -l /var/log",
+        "-rw-r--r--    1 root     root        12288 Jan  1 00:00 messages",
+        "\033[1;31mERROR\033[0m: i2c i2c-1: timeout waiting for bus ready",
+    };
+    std::string d;
+    unsigned    seed = 1;
+
+    while (d.size() < DATA_SIZE)
+    {
+        seed = seed * 1103515245 + 12345;
+        unsigned r = seed >> 16;
+        if (r % 64 == 0)
+            d += "\xff\xfb\x01\xff\xfb\x03\xff\xfa\x18\x01\xff\xf0";     // telnet WILL ECHO, SGA, TTYPE
+        else if (r % 97 == 0)
+            for (int i=0; i<16; i++)
+                d += (char)(0x80 | ((seed >> (i % 8)) ^ i));     // no NUL, it ends C strings
+        str::sappend(d, "[%5u.%06u] %s\r\n", r % 1000, r * 7 % 1000000,
+                     msgs[r % (sizeof(msgs) / sizeof(msgs[0]))]);
+    }
+    return d;
+}
+
+static std::vector<std::string> lines(const std::string& d)
+{
+    std::vector<std::string> v;
+    size_t                   from = 0, nl;
+
+    while ((nl = d.find('\n', from)) != std::string::npos)
+    {
+        v.push_back("  " + d.substr(from, nl + 1 - from));
+        from = nl + 1;
+    }
+    return v;
+}
+
+// Run "f" over the data until MIN_TIME passes, print MB/s
+template<class F> static void bench(const char *name, const size_t bytes, F f)
+{
+    size_t sink = 0;
+    double start = now(), t;
+    int    n = 0;
+
+    do
+    {
+        sink += f();
+        n++;
+    }
+    while ((t = now() - start) < MIN_TIME);
+    // The sink is printed, the work is not optimized out
+    printf("%-16s %10.1f MB/s  (%zu)\n", name, bytes * n / t / 1e6, sink % 10);
+}
+
+struct Escape        { const std::string& d;  size_t operator()() const { return str::escape(d).size();   } };
+struct Unescape      { const std::string& d;  size_t operator()() const { return str::unescape(d).size(); } };
+struct FilterTelnet
+{
+    const std::string& d;
+    size_t operator()() const
+    {
+        size_t n = 0;
+        for (size_t i=0; i<d.size(); i++)
+            n += str::filter_telnet(d[i]) != 0;
+        return n;
+    }
+};
+struct FilterColors
+{
+    const std::string& d;
+    size_t operator()() const
+    {
+        size_t n = 0;
+        for (size_t i=0; i<d.size(); i++)
+            n += str::filter_colors(d[i]) != 0;
+        return n;
+    }
+};
+struct Trim
+{
+    const std::vector<std::string>& v;
+    size_t operator()() const
+    {
+        size_t n = 0;
+        for (size_t i=0; i<v.size(); i++)
+            n += str::trim(v[i]).size();
+        return n;
+    }
+};
+struct Split
+{
+    const std::vector<std::string>& v;
+    str::regexp&                    re;
+    size_t operator()() const
+    {
+        size_t n = 0;
+        for (size_t i=0; i<v.size(); i++)
+            n += re.split_v(v[i]).size();
+        return n;
+    }
+};
+
+int main()
+{
+    std::string              d = console_data();
+    std::string              e = str::escape(d);
+    std::vector<std::string> v = lines(d);
+    str::regexp              blanks(" +");
+    size_t                   lbytes = 0;
+
+    for (size_t i=0; i<v.size(); i++)
+        lbytes += v[i].size();
+    printf("%zu bytes of console data, %zu lines\n", d.size(), v.size());
+
+    Escape       es  = { d };
+    Unescape     un  = { e };
+    FilterTelnet ft  = { d };
+    FilterColors fc  = { d };
+    Trim         tr  = { v };
+    Split        sp  = { v, blanks };
+    bench("escape",        d.size(), es);
+    bench("unescape",      e.size(), un);
+    bench("filter_telnet", d.size(), ft);
+    bench("filter_colors", d.size(), fc);
+    bench("trim",          lbytes,   tr);
+    bench("split_v",       lbytes,   sp);
+    return 0;
+}
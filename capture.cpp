@@ -0,0 +1,152 @@
+/*********************
+ * Merged capture of both directions
+ *********************
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "capture.h"
+
+static const int BYTES_PER_LINE = 16;
+static const int FLUSH_MS = 200;     // the file may be followed with "tail -f"
+
+static long long us_between(const timespec& from, const timespec& to)
+{
+    return (to.tv_sec - from.tv_sec) * 1000000LL + (to.tv_nsec - from.tv_nsec) / 1000;
+}
+
+// Write "sec.usec" right aligned in "width"
+static char *put_time(char *p, long long us, const int width, const char sign)
+{
+    char tmp[32];
+    int  n = 0;
+
+    if (us < 0)
+        us = 0;
+    for (int i=0; i<6; i++, us /= 10)
+        tmp[n++] = '0' + us % 10;
+    tmp[n++] = '.';
+    do
+    {
+        tmp[n++] = '0' + us % 10;
+        us /= 10;
+    }
+    while (us);
+    if (sign)
+        tmp[n++] = sign;
+    for (int i=n; i<width; i++)
+        *p++ = ' ';
+    while (n)
+        *p++ = tmp[--n];
+    return p;
+}
+
+Capture::Capture()
+    : f(0)
+{
+    memset(&base, 0, sizeof(base));
+    prev = flushed = base;
+}
+
+Capture::~Capture()
+{
+    close();
+}
+
+bool Capture::open(const char *path)
+{
+    close();
+    if (!(f = fopen(path, "w")))
+        return false;
+    setvbuf(f, 0, _IOFBF, 1024 * 1024);
+    return true;
+}
+
+void Capture::start(const char *from_name, const char *to_name, const timespec& ts)
+{
+    if (!f)
+        return;
+
+    timeval   tv;
+    struct tm tm;
+    char      when[64] = "";
+    gettimeofday(&tv, 0);
+    if (localtime_r(&tv.tv_sec, &tm))
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+
+    fprintf(f, "# con capture, session started %s.%06ld\n"
+               "# > from \"%s\" to \"%s\"\n"
+               "# < from \"%s\" to \"%s\"\n"
+               "#        time        gap d   len\n",
+            when, (long)tv.tv_usec, from_name, to_name, to_name, from_name);
+    base = prev = flushed = ts;
+}
+
+void Capture::record(const int dir, const timespec& ts, const unsigned char *p, const int cnt)
+{
+    static const char hex[] = "0123456789abcdef";
+    char              line[128];
+
+    if (!f  ||  cnt <= 0)
+        return;
+    for (int off=0; off<cnt; off+=BYTES_PER_LINE)
+    {
+        char *o = line;
+        int  n = cnt - off < BYTES_PER_LINE ? cnt - off : BYTES_PER_LINE;
+
+        if (!off)
+        {
+            o = put_time(o, us_between(base, ts), 13, 0);
+            *o++ = ' ';
+            o = put_time(o, us_between(prev, ts), 10, '+');
+            *o++ = ' ';
+            *o++ = dir ? '<' : '>';
+            o += sprintf(o, " %5d  ", cnt);
+        }
+        else
+        {
+            memset(o, ' ', 34);
+            o += 34;
+        }
+        for (int i=0; i<BYTES_PER_LINE; i++)
+        {
+            if (i < n)
+            {
+                *o++ = hex[p[off + i] >> 4];
+                *o++ = hex[p[off + i] & 0xf];
+            }
+            else
+            {
+                *o++ = ' ';
+                *o++ = ' ';
+            }
+            *o++ = ' ';
+        }
+        *o++ = ' ';
+        for (int i=0; i<n; i++)
+            *o++ = p[off + i] >= 0x20 && p[off + i] < 0x7f ? p[off + i] : '.';
+        *o++ = '\n';
+        fwrite(line, 1, o - line, f);
+    }
+    prev = ts;
+    if (us_between(flushed, ts) >= FLUSH_MS * 1000)
+    {
+        fflush(f);
+        flushed = ts;
+    }
+}
+
+void Capture::flush()
+{
+    if (f)
+        fflush(f);
+}
+
+void Capture::close()
+{
+    if (f)
+        fclose(f);
+    f = 0;
+}
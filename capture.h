@@ -0,0 +1,69 @@
+/*********************
+ * Merged capture of both directions
+ *********************
+ *
+ */
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdio.h>
+#include <time.h>
+
+/*!
+  \class Capture
+  \brief Record of the relayed data for protocol analysis
+
+  Every chunk read from either side is one record: time since the start
+  of the session, gap since the previous record, direction, length and
+  the bytes as hexa and ascii, 16 per line. The records of both
+  directions go to one file in the order they were received, so
+  request/response timing can be read off directly:
+
+      #        time        gap d   len
+           0.298711  +0.298711 <     8  01 03 00 00 00 0a c5 cd                          ........
+           0.303001  +0.004289 >     5  01 83 02 c0 f1                                   .....
+
+  ">" is data from the target, "<" is data to it.
+*/
+class Capture
+{
+public:
+    Capture();
+
+    /*! Destructor
+      The file is closed
+     */
+    ~Capture();
+
+    /*! Open capture file, it's overwritten
+      \return false on failure, errno is set
+     */
+    bool open(const char *path);
+    bool enabled() const { return f != 0; }
+
+    /*! Start new session
+      \param from_name target, source of ">" records
+      \param to_name the other side, source of "<" records
+      \param ts start time in the clock of record() stamps
+     */
+    void start(const char *from_name, const char *to_name, const timespec& ts);
+
+    /*! Add a record
+      \param dir 0 - from the target (">"), 1 - to the target ("<")
+      \param ts receive time
+     */
+    void record(const int dir, const timespec& ts, const unsigned char *p, const int cnt);
+
+    //! Write out everything buffered
+    void flush();
+
+    void close();
+
+private:
+    FILE     *f;
+    timespec base;
+    timespec prev;
+    timespec flushed;
+};
+
+#endif
@@ -11,35 +11,93 @@
 #include <memory.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/un.h>
+#include <termios.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "autobaud.h"
+#include "capture.h"
+#include "dgram.h"
+#include "display.h"
+#include "endpoint.h"
+#include "logger.h"
+#include "metrics.h"
+#include "pace.h"
+#include "rt.h"
+#include "scrollback.h"
+#include "share.h"
+#include "spsc.h"
+#include "str_utils.h"
+#include "trigger.h"
+#include "tstamp.h"
 #include "tty.h"
+#include "uring.h"
+#include "xfer.h"
 
 #define PERR(args...) do { fprintf(stderr, args); finish(1); } while(0)
 #define RERR(args...) do { fprintf(stderr, args); return;    } while(0)
+#define TERR(args...) do { fprintf(stderr, args); return true; } while(0)
 
 Tty             *tty = 0;
-int             tty1 = -1;
-char            *tty1_name = 0;
+Endpoint        target;
+Endpoint        peer;             // the other side in bridge mode
 const char      *tty2_name = "/dev/tty";
 unsigned char   exitChr = '\001';
+int             cmdChr = '\024';
 bool            echo_flag = false;
 bool            hexa_flag = false;
 bool            hexa_ascii_flag = false;
 int             hexa_inline = 16;
 int             hexa_ascii_inline = 8;
-FILE            *log_file = NULL;
+Logger          logger;
+Tstamp          tstamp;
+Capture         capture;
+Metrics         metrics;
+bool            quiet_flag = false;
+enum Backend { BE_SELECT, BE_URING, BE_THREADS };
+Backend         backend = BE_SELECT;
+size_t          ring_size = 4 * 1024 * 1024;
+int             rt_prio = 0;
+std::vector<int> rt_cpus;
+Scrollback      scrollback;
+pace::Config    pace_cfg;
+bool            bracketed_paste = false;
+bool            pipe_flag = false;
+bool            bridge_flag = false;
+int             linger_ms = 1000;
+Endpoint::SockOpts sock_opts;
+bool            quickack_set = false;  // otherwise TCP_QUICKACK is used in interactive sessions
+unsigned        coalesce_us = 0;
+size_t          coalesce_max = 1024;
+unsigned        out_coalesce_us = 0;
+size_t          out_coalesce_max = 4096;
+int             autobaud_ms = 0;
+Share           share;
+Trigger         trigger;
+const char      *trigger_prefix = "con-trigger";
+size_t          trigger_pre = 4 * 1024 * 1024;
+size_t          trigger_post = 1024 * 1024;
+Display         display;
+Display::Mode   display_mode = Display::NONE;
+rt::Probe       *probe = 0;
 
 void usage(const char *s)
 {
@@ -76,236 +134,2586 @@ void usage(const char *s)
         "   Example:\n"
         "       %s -s /tmp/my_named_socket\n"
         "\n"
+        "6. Headless bridge of two endpoints (no terminal):\n"
+        "       %s -B ENDPOINT ENDPOINT\n"
+        "   ENDPOINT is \"tty:DEVICE[,BAUD]\", \"tcp:HOST:PORT\", \"tcp-listen:PORT\",\n"
+        "   \"unix:PATH\", \"unix-listen:PATH\", \"pty[:LINK]\", \"udp:HOST:PORT[,OPTS]\"\n"
+        "   or \"udp-listen:[ADDR:]PORT[,OPTS]\", see 9. The target may be given\n"
+        "   in this form in other modes too. Example:\n"
+        "       %s -B tcp-listen:2000 tty:/dev/ttyUSB0,115200\n"
+        "\n"
+        "7. Remote device as a local tty: a pseudo-terminal, LINK is a symbolic\n"
+        "   link to it. Speed, stop bits and RTS/CTS set on the pty go to the tty\n"
+        "   on the other side:\n"
+        "       %s -B pty:LINK ENDPOINT\n"
+        "   Example:\n"
+        "       %s -B pty:/tmp/ttyV0 tcp:192.168.2.100:2000\n"
+        "\n"
+        "8. Serial sniffer between two ttys with a merged capture:\n"
+        "       %s -i threads -capture FILE -B tty:DEVICE,BAUD tty:DEVICE,BAUD\n"
+        "\n"
+        "9. UDP console or telemetry. A listener takes the first sender as the\n"
+        "   peer, on a multicast group ADDR it joins the group. OPTS are \"line\"\n"
+        "   (a datagram per line sent) and \"size=N\" (max datagram size). An\n"
+        "   empty datagram is the end of data:\n"
+        "       %s udp:HOST:PORT,line\n"
+        "       %s -p -sock rcvbuf=8M udp-listen:239.1.2.3:5000 > FILE\n"
+        "\n"
         "SWITCHES may be:\n"
         "\t-h[elp]             - Print help message.\n"
         "\t-e[cho]             - Echo keyboard input locally.\n"
         "\t-l[og] FILENAME     - Log everything to specified file, file be overwritten\n"
         "\t-a[ppend] FILENAME  - Appends all logs to specified file\n"
         "\t-n[ocolor]          - Filter out colors and CRNL sequences in a log file\n"
+        "\t-T[imestamp] MODE   - Prefix every received line on screen and in the log\n"
+        "\t                      with a timestamp. MODE is \"wall\" (wall clock),\n"
+        "\t                      \"mono\" (time since connection) or \"delta\" (time\n"
+        "\t                      since previous line)\n"
         "\t-X                  - Output as hexa bytes\n"
         "\t-Y                  - Output as hexa and ascii\n"
         "\t-x[exit] KEY        - Exit connection key. May be in integer as 0x01 or 001\n"
         "\t                      or in a \"control-a\", \"cntrl/a\" or \"ctrl/a\" form\n"
         "\t                      Default is \"cntrl/a\".\n"
+        "\t-i[o] BACKEND       - Relay loop backend: \"select\" (default), \"uring\"\n"
+        "\t                      or \"threads\". uring falls back to select if kernel\n"
+        "\t                      lacks io_uring. threads reads every source in its own\n"
+        "\t                      thread, so slow terminal never stalls the device\n"
+        "\t-ring SIZE          - Receive ring size for \"threads\" backend, may have\n"
+        "\t                      K or M suffix. Default is 4M, minimum is 64K\n"
+        "\t-rt PRIO            - Run relay thread(s) with SCHED_FIFO priority PRIO\n"
+        "\t                      (1..99)\n"
+        "\t-cpu LIST           - Pin relay thread(s) to CPUs, like \"2\" or \"2,3\" or \"2-3\"\n"
+        "\t-mlock              - Lock and prefault all memory\n"
+        "\t-latency            - Report scheduling latency observed during the session,\n"
+        "\t                      probed on a CPU out of \"-cpu\" LIST if there is one\n"
+        "\t-k[ey] KEY          - Command key, same form as for \"-x\", default is\n"
+        "\t                      \"cntrl/t\". \"none\" disables commands. Press it and\n"
+        "\t                      \"h\" for the list of commands\n"
+        "\t-S[crollback] SIZE  - Keep SIZE bytes (K, M or G suffix) of the session\n"
+        "\t                      in memory for search\n"
+        "\t-send PROTO:FILE[,FILE...]\n"
+        "\t                    - Send files when connected. PROTO is \"x\" (xmodem),\n"
+        "\t                      \"1k\" (xmodem-1k), \"y\" (ymodem) or \"z\" (zmodem)\n"
+        "\t-recv PROTO[:PATH]  - Receive files when connected, PATH is file name for\n"
+        "\t                      xmodem and directory for ymodem and zmodem\n"
+        "\t-pace MODE          - Pacing of text sent by \"-type\", command key \"f\" and\n"
+        "\t                      pastes: \"none\" (default), \"chunk[:SIZE[:MS]]\",\n"
+        "\t                      \"line[:MS]\", \"prompt:STRING[:MS]\" or \"adaptive\"\n"
+        "\t-type FILE          - Send FILE as typed text when connected\n"
+        "\t-p[ipe]             - Use stdin/stdout instead of the terminal, data is\n"
+        "\t                      passed as is, no exit or command keys. After stdin\n"
+        "\t                      EOF the target output is copied until its EOF or\n"
+        "\t                      \"-linger\" silence\n"
+        "\t-linger MS          - Target silence to exit after stdin EOF, default 1000\n"
+        "\t-B[ridge] ENDPOINT  - Relay the target to ENDPOINT instead of the terminal\n"
+        "\t-capture FILE       - Record data of both directions to FILE, merged,\n"
+        "\t                      with time and direction of every chunk\n"
+        "\t-overload MODE      - Never wait for the screen: what it doesn't take is\n"
+        "\t                      logged but not shown, the view is refreshed 10\n"
+        "\t                      times a second instead. MODE is \"skip\" (a \"[N KB\n"
+        "\t                      skipped]\" marker), \"lines\" (marker and the last\n"
+        "\t                      line) or \"screen\" (marker and the last screen)\n"
+        "\t-trigger PATTERN    - Keep the last data in memory and save it to a new\n"
+        "\t                      file when PATTERN is received, with the data after\n"
+        "\t                      it. May be given a few times, any PATTERN triggers\n"
+        "\t-trigger-size PRE[:POST]\n"
+        "\t                    - Bytes saved before and after the trigger, may have\n"
+        "\t                      K or M suffix. Default is 4M:1M\n"
+        "\t-trigger-file PREFIX\n"
+        "\t                    - Files are PREFIX-YYYYMMDD-HHMMSS.mmm.log, default\n"
+        "\t                      PREFIX is \"con-trigger\"\n"
+        "\t-share PATH         - Let any number of observers watch the session on\n"
+        "\t                      UNIX socket PATH, read-only\n"
+        "\t-copilot PATH       - Let one co-pilot watch and type on UNIX socket PATH\n"
+        "\t-metrics ENDPOINT   - Serve live counters in Prometheus text format on\n"
+        "\t                      \"unix:PATH\" or \"tcp:PORT\" (localhost)\n"
+        "\t-coalesce US[:SIZE] - Hold keyboard input up to US microseconds or SIZE\n"
+        "\t                      bytes (default 1K) and send it at once. Enter and\n"
+        "\t                      control characters are sent without delay\n"
+        "\t-coalesce-out US[:SIZE]\n"
+        "\t                    - Hold target data for the screen up to US\n"
+        "\t                      microseconds or SIZE bytes (default 4K) and write\n"
+        "\t                      it at once. Echo of keys typed is not delayed\n"
+        "\t-sock OPTIONS       - Socket options, comma separated: \"nodelay[=0|1]\",\n"
+        "\t                      \"quickack[=0|1]\", \"sndbuf=SIZE\", \"rcvbuf=SIZE\",\n"
+        "\t                      \"keepalive=IDLE[:INTVL[:CNT]]\" (seconds, 0 - off),\n"
+        "\t                      \"user-timeout=MS\". Default is nodelay, keepalive\n"
+        "\t                      30:5:3 and quickack in interactive sessions\n"
         "\t-q                  - Be quiet\n"
         "\n"
         "Switches specific for tty_device:\n"
         "\t-t[erm]             - Work as serial communicaton program. The is a default\n"
         "\t                      mode. Note that \"-b\" switch assumes \"-t\"\n"
         "\t-b[aud] <baud_rate> - Set the baud rate for target connection.\n"
+        "\t-b auto[:SECONDS]   - Find the baud rate of a talking device, trying\n"
+        "\t                      the usual ones for up to SECONDS (default 10)\n"
         "\n"
         "Switches specific for socket connection:\n"
         "\t-s[erver]           - Accept connection to socket as server.\n"
         "\t-c[lient]           - Connection to socket as client.\n"
         ;
-    fprintf(stderr, msg, s, s, s, s,    s, s, s, s,    s, s, s, s,    s);
+    fprintf(stderr, msg, s, s, s, s,    s, s, s, s,    s, s, s, s,    s, s, s, s,    s, s, s, s);
     exit (1);
 }
 
 void finish(int stat = 0)
 {
     fprintf(stderr, "\r\n");
+    if (bracketed_paste)
+        fputs("\033[?2004l", stderr);
+    if (probe)
+    {
+        probe->stop();
+        probe->report(stderr);
+        delete probe;
+        probe = 0;
+    }
+    target.close();
+    peer.close();
+    capture.close();
+    trigger.close();
+    metrics.stop();
+    share.stop();
     if (tty)
     {
         delete tty;
         tty = 0;
     }
-    if (tty1 >= 0)
+    logger.close();
+    exit (stat);
+}
+extern "C" void finish_int(int)
+{
+    finish(1);
+}
+
+// Parse size with optional K/M/G suffix
+bool parse_size(const char *s, size_t& size)
+{
+    char          *end;
+    unsigned long v = strtoul(s, &end, 0);
+
+    switch (*end)
+    {
+    case 'k':
+    case 'K':
+        v <<= 10;
+        end++;
+        break;
+    case 'm':
+    case 'M':
+        v <<= 20;
+        end++;
+        break;
+    case 'g':
+    case 'G':
+        v <<= 30;
+        end++;
+        break;
+    }
+    if (*end || end == s)
+        return false;
+    size = v;
+    return true;
+}
+
+// Parse socket options: comma separated "nodelay[=0|1]", "quickack[=0|1]",
+// "sndbuf=SIZE", "rcvbuf=SIZE", "keepalive=IDLE[:INTVL[:CNT]]" (seconds)
+// or "keepalive=0" and "user-timeout=MS"
+bool parse_sock_opts(const char *s, Endpoint::SockOpts& o)
+{
+    std::string list = s;
+    size_t      pos = 0;
+
+    while (pos <= list.size())
+    {
+        size_t      comma = list.find(',', pos);
+        std::string item = list.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+        pos = comma == std::string::npos ? list.size() + 1 : comma + 1;
+
+        size_t      eq = item.find('=');
+        std::string name = item.substr(0, eq);
+        const char  *val = eq == std::string::npos ? 0 : item.c_str() + eq + 1;
+        char        *end;
+        size_t      size;
+
+        if (name == "nodelay"  ||  name == "quickack")
+        {
+            bool on = true;
+            if (val)
+            {
+                if (strcmp(val, "0")  &&  strcmp(val, "1"))
+                    return false;
+                on = *val == '1';
+            }
+            if (name == "nodelay")
+                o.nodelay = on;
+            else
+            {
+                o.quickack = on;
+                quickack_set = true;
+            }
+        }
+        else if ((name == "sndbuf"  ||  name == "rcvbuf")  &&  val)
+        {
+            if (!parse_size(val, size)  ||  !size  ||  size > 0x40000000)
+                return false;
+            (name == "sndbuf" ? o.sndbuf : o.rcvbuf) = (int)size;
+        }
+        else if (name == "keepalive"  &&  val)
+        {
+            int v[3] = { 0, o.keepintvl, o.keepcnt };
+            for (int i=0; i<3; i++)
+            {
+                v[i] = (int)strtol(val, &end, 0);
+                if (end == val  ||  v[i] < 0  ||  (i  &&  !v[i]))
+                    return false;
+                if (!*end)
+                    break;
+                if (*end != ':'  ||  i == 2)
+                    return false;
+                val = end + 1;
+            }
+            o.keepidle = v[0] ? v[0] : -1;
+            o.keepintvl = v[1];
+            o.keepcnt = v[2];
+        }
+        else if (name == "user-timeout"  &&  val)
+        {
+            long v = strtol(val, &end, 0);
+            if (*end  ||  end == val  ||  v < 0)
+                return false;
+            o.user_timeout = v;
+        }
+        else
+            return false;
+    }
+    return true;
+}
+
+// Parse KEY specification: integer as 0x01 or 001 or "control-a",
+// "cntrl/a" or "ctrl/a" form
+unsigned char parse_key(char *s)
+{
+    char          *end;
+    unsigned char key = (unsigned char)strtol(s, &end, 0);
+
+    if (*end)
+    {
+        char *p = strchr(s, '/');
+        if (!p)
+            p = strchr(s, '-');
+        if (!p)
+            PERR("No delimiter ('-' or '/') found in \"KEY\" specification.\n");
+
+        *p++ = 0;
+        if (!strcasecmp(s, "control")
+            || !strcasecmp(s, "cntrl")
+            || !strcasecmp(s, "ctrl"))
+        {
+        }
+        else
+        {
+            fprintf(stderr, "No modificator found in \"KEY\" specification.\n");
+            fprintf(stderr, "Can be \"control\", \"cntrl\" or \"ctrl\"\n");
+            finish(1);
+        }
+
+        if (strlen(p) != 1)
+        {
+            fprintf(stderr, "Should be one character after modificator in \"KEY\" specification.\n");
+            fprintf(stderr, "Can be \"control\", \"cntrl\" or \"ctrl\"\n");
+            finish(1);
+        }
+
+        if (*p >= 0x40 && *p <= 0x60)
+            key = *p - 0x40;
+        else if (*p > 0x60)
+            key = *p - 0x60;
+        else
+        {
+            fprintf(stderr, "Invalid character after modificator in \"KEY\" specification.\n");
+            fprintf(stderr, "Can be \"control\", \"cntrl\" or \"ctrl\"\n");
+            finish(1);
+        }
+    }
+    return key;
+}
+
+// CPU for relay thread "n" (0 - main thread), -1 if not pinned
+int rt_cpu(const int n)
+{
+    return rt_cpus.empty() ? -1 : rt_cpus[n % rt_cpus.size()];
+}
+
+int readn(int fd, void *ptr, int nbytes)
+{
+    int     nread;
+
+    do
+        nread = read(fd, ptr, nbytes);
+    while (nread < 0 && (errno == EINTR || errno == EAGAIN));
+    return nread;
+}
+
+int writen(int fd, const void *ptr, int nbytes)
+{
+    int     nwritten;
+
+    do
+        nwritten = write(fd, ptr, nbytes);
+    while (nwritten < 0 && (errno == EINTR || errno == EAGAIN));
+    return nwritten;
+}
+
+// Read from socket together with kernel receive timestamp (SO_TIMESTAMPNS)
+// If no timestamp is supplied by kernel the current time is used
+int read_stamped(int fd, void *ptr, int nbytes, timespec& ts)
+{
+    char           cbuf[CMSG_SPACE(sizeof(timespec))];
+    struct iovec   iov;
+    struct msghdr  msg;
+    int            nread;
+
+    iov.iov_base = ptr;
+    iov.iov_len = nbytes;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    do
+        nread = recvmsg(fd, &msg, 0);
+    while (nread < 0 && (errno == EINTR || errno == EAGAIN));
+
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); nread > 0 && c; c = CMSG_NXTHDR(&msg, c))
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+            return nread;
+        }
+    tstamp.now(ts);
+    return nread;
+}
+
+struct Link;
+typedef const unsigned char *(*CliData)(Link& l, const unsigned char *buf, const int cnt,
+                                        const timespec& ts, int& out_cnt);
+
+// Connection relayed by con_core()
+struct Link
+{
+    int        cli_fd;
+    const char *cli_name;
+    int        term_in;       // keyboard or stdin
+    int        term_out;      // screen or stdout
+    int        msg_fd;        // messages of con itself
+    const char *term_name;
+    bool       filter_colors;
+    bool       sock_stamps;
+    bool       interactive;   // exit and command keys are recognized
+    bool       half_closed;   // terminal input is over, client output is waited for
+    bool       done;          // ended by EOF, exit key or timer, not by error
+    uint64_t   last_rx;       // ms, last data from client
+    bool       cli_quickack;  // TCP_QUICKACK is re-armed after every read,
+    bool       term_quickack; // the kernel clears it
+    std::string held;         // coalesced data for client
+    std::string flushed;      // held data being sent
+    uint64_t    flush_at;     // us, held data is due
+    std::string out_held;     // coalesced data for terminal
+    std::string out_flushed;
+    uint64_t    out_flush_at;
+    timespec    out_ts;       // arrival of the first byte held
+    uint64_t    key_us;       // us, last data from terminal
+    int        pty_fd;        // pty master, its termios go to "pty_peer" tty
+    int        pty_peer;
+    uint64_t   pty_next;      // ms, next termios check
+    speed_t    pty_speed;     // termios seen last
+    tcflag_t   pty_cflag;
+    CliData    cli_data;      // client data for the terminal, see cli_mode()
+    Dgram      *cli_dg;       // UDP sockets are read and written by them,
+    Dgram      *term_dg;      // 0 - not UDP
+};
+
+enum Relay { RELAY_OK, RELAY_EXIT, RELAY_FAIL };
+
+const int MAXBUF = 16 * 1024;
+
+// Receive ring of the threads backend: a read of MAXBUF with its chunk
+// header has to fit in one piece, even behind a chunk not consumed yet
+const size_t MIN_RING = 64 * 1024;
+
+static uint64_t now_ms()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static uint64_t now_us()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/*
+ * Keystroke coalescing
+ *
+ * With "-coalesce" data for the client is held up to coalesce_us or
+ * until coalesce_max bytes are collected, so typing and pastes go over
+ * a slow link in fewer segments. Enter and other control characters
+ * (escape sequences of cursor keys too) flush it at once
+ */
+
+// Held data which is due (or all of it if "force") for the client.
+// Returns false if there is nothing to send
+static bool held_due(Link& l, const unsigned char *&p, int& cnt, const bool force = false)
+{
+    if (l.held.empty()  ||  (!force  &&  now_us() < l.flush_at))
+        return false;
+    l.flushed.swap(l.held);
+    l.held.clear();
+    p = (const unsigned char *)l.flushed.data();
+    cnt = l.flushed.size();
+    return true;
+}
+
+// Data for client: hold it or return what is to be sent now (cnt may be 0)
+static void coalesce(Link& l, const unsigned char *&p, int& cnt)
+{
+    if (!coalesce_us  ||  !cnt)
+        return;
+
+    bool flush = false;
+    for (int i=0; i<cnt  &&  !flush; i++)
+        flush = p[i] < 0x20  ||  p[i] == 0x7f;
+    if (l.held.empty())
+        l.flush_at = now_us() + coalesce_us;
+    l.held.append((const char *)p, cnt);
+    cnt = 0;
+    if (flush  ||  l.held.size() >= coalesce_max)
+        held_due(l, p, cnt, true);
+}
+
+/*
+ * Output coalescing
+ *
+ * A device trickling bytes would cost a terminal write per read. With
+ * "-coalesce-out" data for the terminal is held up to out_coalesce_us
+ * or until out_coalesce_max bytes are collected and written at once.
+ * Data arriving within ECHO_US of a keystroke is echo and goes without
+ * delay, the delay is felt only on output nobody is typing to.
+ */
+const uint64_t ECHO_US = 100000;
+
+// Held terminal data which is due (or all of it if "force"), "ts" is
+// when it arrived. Returns false if there is nothing to write
+static bool out_due(Link& l, const unsigned char *&p, int& cnt, timespec& ts, const bool force = false)
+{
+    if (l.out_held.empty()  ||  (!force  &&  now_us() < l.out_flush_at))
+        return false;
+    l.out_flushed.swap(l.out_held);
+    l.out_held.clear();
+    p = (const unsigned char *)l.out_flushed.data();
+    cnt = l.out_flushed.size();
+    ts = l.out_ts;
+    return true;
+}
+
+// Data for terminal: hold it or return what is to be written now (cnt may be 0)
+static void out_coalesce(Link& l, const unsigned char *&p, int& cnt, timespec& ts)
+{
+    if (!out_coalesce_us  ||  !cnt)
+        return;
+
+    uint64_t now = now_us();
+    if (l.out_held.empty())
+    {
+        l.out_flush_at = now + out_coalesce_us;
+        l.out_ts = ts;
+    }
+    l.out_held.append((const char *)p, cnt);
+    cnt = 0;
+    if (now - l.key_us < ECHO_US  ||  l.out_held.size() >= out_coalesce_max)
+        out_due(l, p, cnt, ts, true);
+}
+
+/*
+ * pty line settings
+ *
+ * Program which uses the pty sets speed, stop bits and flow control as
+ * on a real serial port. In bridge mode they go to the tty on the other
+ * side: checked before every data relayed and every PTY_POLL_MS
+ * meanwhile. Linux pty is always 8 bits without parity, so these can't
+ * be seen. Sockets have nothing to set
+ */
+const int      PTY_POLL_MS = 10;
+const tcflag_t PTY_CFLAGS = CSTOPB | CRTSCTS;
+
+// Copy speed and line settings, returns false on failure
+static bool line_copy(const termios& from, const int to_fd, const int when)
+{
+    termios t;
+    if (tcgetattr(to_fd, &t) < 0)
+        return false;
+    cfsetispeed(&t, cfgetispeed(&from));
+    cfsetospeed(&t, cfgetospeed(&from));
+    t.c_cflag = (t.c_cflag & ~PTY_CFLAGS) | (from.c_cflag & PTY_CFLAGS);
+    return tcsetattr(to_fd, when, &t) == 0;
+}
+
+static void pty_sync(Link& l)
+{
+    termios t;
+
+    if (l.pty_fd < 0  ||  tcgetattr(l.pty_fd, &t) < 0)
+        return;
+    l.pty_next = now_ms() + PTY_POLL_MS;
+    if (cfgetospeed(&t) == l.pty_speed  &&  (t.c_cflag & PTY_CFLAGS) == l.pty_cflag)
+        return;
+    l.pty_speed = cfgetospeed(&t);
+    l.pty_cflag = t.c_cflag & PTY_CFLAGS;
+
+    // Data already relayed goes with the old settings
+    if (!line_copy(t, l.pty_peer, TCSADRAIN))
+        fprintf(stderr, "Can't set tty line: %s\n", strerror(errno));
+    else if (!quiet_flag)
+        fprintf(stderr, "tty line: %u baud, %d stop bit(s)%s\n", Tty::speed_value(t),
+                t.c_cflag & CSTOPB ? 2 : 1, t.c_cflag & CRTSCTS ? ", RTS/CTS" : "");
+}
+
+// Receive time of data is needed
+static bool read_stamps()
+{
+    return tstamp.enabled()  ||  capture.enabled()  ||  metrics.enabled();
+}
+
+static uint64_t us_since(const timespec& from, const timespec& to)
+{
+    int64_t d = (to.tv_sec - from.tv_sec) * 1000000LL + (to.tv_nsec - from.tv_nsec) / 1000;
+    return d > 0 ? d : 0;
+}
+
+// Write to the client or the terminal output, UDP ones get datagrams
+static int link_write(const Link& l, const int fd, const void *p, const int cnt)
+{
+    Dgram *d = fd == l.cli_fd ? l.cli_dg : fd == l.term_out ? l.term_dg : 0;
+    return d ? d->write(p, cnt) : writen(fd, p, cnt);
+}
+
+// Read from the client or the terminal input
+static int link_read(const Link& l, const int fd, void *p, const int cnt)
+{
+    Dgram *d = fd == l.cli_fd ? l.cli_dg : fd == l.term_in ? l.term_dg : 0;
+    return d ? d->read(p, cnt) : readn(fd, p, cnt);
+}
+
+// Datagrams received and not read yet, the descriptor is not readable for them
+static bool dgram_pending(const Link& l)
+{
+    return (l.cli_dg  &&  l.cli_dg->pending())  ||  (!l.half_closed  &&  l.term_dg  &&  l.term_dg->pending());
+}
+
+// Write data read at "ts" in direction "dir" (0 - from client, 1 - to it)
+// and account it
+static int relay_write(const Link& l, const int dir, const unsigned char *p, const int cnt, const timespec& ts)
+{
+    const int fd = dir ? l.cli_fd : l.term_out;
+    if (!dir  &&  display.enabled())
+        return display.write(p, cnt) ? cnt : -1;
+    if (!metrics.enabled()  ||  !cnt)
+        return link_write(l, fd, p, cnt);
+
+    timespec start, end;
+    tstamp.now(start);
+    int n = link_write(l, fd, p, cnt);
+    tstamp.now(end);
+    metrics.written(dir, us_since(ts, end), us_since(start, end));
+    return n;
+}
+
+// Write all the output held, before a message or the end of the session
+static bool out_flush(Link& l)
+{
+    const unsigned char *p;
+    int                 n;
+    timespec            ts;
+    return !out_due(l, p, n, ts, true)  ||  relay_write(l, 0, p, n, ts) == n;
+}
+
+// TCP socket and quick ACKs are wanted
+static bool quickack_wanted(const int fd)
+{
+    int       proto;
+    socklen_t len = sizeof(proto);
+    return sock_opts.quickack  &&
+        getsockopt(fd, SOL_SOCKET, SO_PROTOCOL, &proto, &len) == 0  &&  proto == IPPROTO_TCP;
+}
+
+static void quickack(const int fd)
+{
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+}
+
+// Column of the hexa output, the lines go on across reads
+static int hexa_col = 0;
+
+// Write "cnt" bytes as hexa, with ASCII if "ascii", return the end
+static char *hexa_dump(char *p, const unsigned char *buf, const int cnt, const bool ascii)
+{
+    static const char digits[] = "0123456789abcdef";
+    const int         inline_cnt = ascii ? hexa_ascii_inline : hexa_inline;
+
+    for (int i=0; i<cnt; i++)
+    {
+        const unsigned char c = buf[i];
+        *p++ = '0';
+        *p++ = 'x';
+        *p++ = digits[c >> 4];
+        *p++ = digits[c & 0xf];
+        *p++ = ' ';
+        if (ascii)
+        {
+            *p++ = '[';
+            *p++ = c >= ' '  &&  c <= '~' ? c : '.';
+            memcpy(p, "]   ", 4);
+            p += 4;
+        }
+        if (++hexa_col == inline_cnt)
+        {
+            *p++ = '\r';
+            *p++ = '\n';
+            hexa_col = 0;
+        }
+    }
+    return p;
+}
+
+/*
+ * Relay modes of the client data
+ *
+ * A mode tells at compile time what cli_data() does with the data.
+ * cli_data() is instantiated for the common option combinations, the
+ * one of the session is picked once, so the relay of plain or logged
+ * data has no tests of the options per read. ModeAny tests them at run
+ * time, for the rest of the combinations: capture, metrics, scrollback,
+ * triggers, observers, quick ACKs and pty line following.
+ */
+template<bool STAMP, bool LOG, int HEXA> struct Mode
+{
+    static bool stamp()  { return STAMP; }
+    static bool log()    { return LOG;   }
+    static int  hexa()   { return HEXA;  }     // 0 - none, 1 - hexa, 2 - hexa and ASCII
+    static bool extras() { return false; }
+};
+
+struct ModeAny
+{
+    static bool stamp()  { return tstamp.enabled();  }
+    static bool log()    { return logger.enabled();  }
+    static int  hexa()   { return hexa_ascii_flag ? 2 : hexa_flag ? 1 : 0; }
+    static bool extras() { return true; }
+};
+
+// Prepare data received from client for the terminal: add timestamps,
+// log it and convert to hexa if required.
+// Returns the data to be written to terminal (may be "buf" itself)
+template<class M> static const unsigned char *cli_data(Link& l, const unsigned char *buf, const int cnt,
+                                                       const timespec& ts, int& out_cnt)
+{
+    static unsigned char sbuf[MAXBUF * (Tstamp::MAXLEN + 1) + Tstamp::MAXLEN];
+    static char          xbuf[MAXBUF * 16];
+    const unsigned char  *out = buf;
+
+    out_cnt = cnt;
+    if (M::extras())
+    {
+        capture.record(0, ts, buf, cnt);
+        if (metrics.enabled())
+            metrics.read(Metrics::IN, cnt);
+        if (l.cli_quickack)
+            quickack(l.cli_fd);
+        pty_sync(l);
+    }
+    if (l.half_closed)
+        l.last_rx = now_ms();
+    if (M::stamp())
+    {
+        out_cnt = tstamp.stamp(buf, cnt, ts, sbuf);
+        out = sbuf;
+    }
+    if (M::log())
+        logger.write(out, out_cnt, l.filter_colors);
+    if (M::extras()  &&  scrollback.enabled())
+        scrollback.append(out, out_cnt);
+    if (M::extras()  &&  trigger.enabled()  &&  trigger.write(out, out_cnt)  &&  !quiet_flag)
+    {
+        if (trigger.failed())
+            fprintf(stderr, "\r\nTrigger \"%s\": can't write \"%s\": %s\r\n", trigger.pattern(), trigger.file(),
+                    strerror(trigger.error()));
+        else
+            fprintf(stderr, "\r\nTrigger \"%s\": saving to \"%s\"\r\n", trigger.pattern(), trigger.file());
+    }
+
+    if (M::hexa())
+    {
+        out = (const unsigned char *)xbuf;
+        out_cnt = hexa_dump(xbuf, buf, cnt, M::hexa() == 2) - xbuf;
+    }
+    if (M::extras()  &&  share.enabled())
+        share.write(out, out_cnt);
+    return out;
+}
+
+// cli_data() of the session options
+static CliData cli_mode(const Link& l)
+{
+    if (capture.enabled()  ||  metrics.enabled()  ||  scrollback.enabled()  ||  trigger.enabled()  ||  share.enabled()  ||
+        l.cli_quickack  ||  l.pty_fd >= 0)
+        return cli_data<ModeAny>;
+
+    const bool s = tstamp.enabled(), lg = logger.enabled();
+    if (hexa_ascii_flag)
+        return s ? cli_data<ModeAny> : lg ? cli_data<Mode<false, true, 2> > : cli_data<Mode<false, false, 2> >;
+    if (hexa_flag)
+        return s ? cli_data<ModeAny> : lg ? cli_data<Mode<false, true, 1> > : cli_data<Mode<false, false, 1> >;
+    if (s)
+        return lg ? cli_data<Mode<true, true, 0> > : cli_data<Mode<true, false, 0> >;
+    return lg ? cli_data<Mode<false, true, 0> > : cli_data<Mode<false, false, 0> >;
+}
+
+/*
+ * Command mode
+ *
+ * Command key followed by:
+ *   /      - search the scrollback backwards, pattern is typed after it
+ *   n      - next (older) match of the last pattern
+ *   s      - send files, protocol and file names are typed after it
+ *   r      - receive files, protocol and file or directory are typed after it
+ *   f      - send text file as typed, the file name is typed after it
+ *   h or ? - help
+ *   command key - send the command key itself
+ */
+enum CmdState { CMD_IDLE, CMD_KEY, CMD_LINE };
+static CmdState    cmd_state = CMD_IDLE;
+static char        cmd_kind;          // command the line is typed for
+static std::string cmd_line;
+static std::string search_pat;
+static uint64_t    search_pos = 0;
+
+static void term_msg(Link& l, const char *msg, int len = -1)
+{
+    if (len < 0)
+        len = strlen(msg);
+    out_flush(l);
+    writen(l.msg_fd, msg, len);
+}
+
+// Show lines around scrollback position "pos", the match is highlighted
+static void show_match(Link& l, const uint64_t pos)
+{
+    const int   CONTEXT = 2;
+    const size_t MAXSHOW = 16 * 1024;
+    uint64_t    line = scrollback.line_at(pos);
+    uint64_t    from = scrollback.line_start(line > CONTEXT ? line - CONTEXT : 0);
+    uint64_t    to = scrollback.line_start(line + CONTEXT + 1);
+    std::string text;
+    std::string out;
+
+    if (to - from > MAXSHOW)
+    {
+        from = pos > MAXSHOW / 2 && pos - MAXSHOW / 2 > from ? pos - MAXSHOW / 2 : from;
+        to = from + MAXSHOW;
+    }
+    scrollback.copy(from, to, text);
+
+    str::sappend(out, "\r\n\033[7m----- line %llu, %llu lines back -----\033[0m\r\n",
+                (unsigned long long)line + 1, (unsigned long long)(scrollback.lines() - line));
+    for (size_t i=0; i<text.size(); i++)
+    {
+        if (from + i == pos)
+            out += "\033[7m";
+        if (text[i] == '\n' && (i == 0 || text[i-1] != '\r'))
+            out += '\r';
+        out += text[i];
+        if (from + i + 1 == pos + search_pat.size())
+            out += "\033[0m";
+    }
+    if (!text.empty() && text[text.size()-1] != '\n')
+        out += "\r\n";
+    out += "\033[7m-----\033[0m\r\n";
+    term_msg(l, out.data(), out.size());
+}
+
+static void do_search(Link& l)
+{
+    std::string msg;
+
+    if (!scrollback.enabled())
+    {
+        term_msg(l, "\r\n(scrollback is not enabled, use -S SIZE)\r\n");
+        return;
+    }
+    if (search_pat.empty())
+    {
+        term_msg(l, "\r\n(no search pattern)\r\n");
+        return;
+    }
+    int64_t pos = scrollback.rfind(search_pat, search_pos);
+    if (pos < 0)
+    {
+        str::sappend(msg, "\r\n(\"%s\" not found)\r\n", search_pat.c_str());
+        term_msg(l, msg.data(), msg.size());
+        search_pos = scrollback.end();
+        return;
+    }
+    search_pos = pos;
+    show_match(l, pos);
+}
+
+/*
+ * File transfer and paced text send
+ *
+ * The transfer runs on the open client descriptor with its current
+ * settings, the relay is suspended meanwhile. It's requested from
+ * command mode or command line and started by the backend loop when
+ * the descriptors may be taken over. Text (a file or a bracketed paste)
+ * is sent the same way, paced according to "-pace".
+ */
+struct Action
+{
+    enum Kind { NONE, SEND, RECEIVE, TYPE };
+
+    Kind                     kind;
+    xfer::Proto              proto;
+    std::vector<std::string> args;
+    std::string              text;      // TYPE without file argument
+};
+static Action action = { Action::NONE, xfer::ZMODEM, std::vector<std::string>(), std::string() };
+static std::string paste_queue;     // pastes made while an action was pending
+
+// Parse "PROTO [ARG ...]", words are separated by any of "seps"
+static bool parse_action(const Action::Kind kind, const char *s, const char *seps, Action& a)
+{
+    std::vector<std::string> w;
+    const char               *s0 = s;
+
+    while (*s)
+    {
+        size_t n = strcspn(s, seps);
+        if (n)
+            w.push_back(std::string(s, n));
+        s += n;
+        if (*s)
+            s++;
+    }
+    a.kind = kind;
+    if (kind == Action::TYPE)
+    {
+        // The file name is taken as is
+        a.args.assign(1, s0);
+        return *s0 != 0;
+    }
+    if (w.empty()  ||  !xfer::parse_proto(w[0].c_str(), a.proto))
+        return false;
+    a.args.assign(w.begin() + 1, w.end());
+    if (kind == Action::SEND  &&  a.args.empty())
+        return false;
+    if (kind == Action::RECEIVE  &&  (a.proto == xfer::XMODEM || a.proto == xfer::XMODEM1K)  &&  a.args.size() != 1)
+        return false;
+    return a.args.size() <= 1  ||  kind == Action::SEND;
+}
+
+// Transfer progress and messages go to the terminal, Esc or Ctrl/C aborts
+class ConXferIo : public XferIo
+{
+public:
+    ConXferIo(Link& l) : l(l), start(0), shown(0) {}
+
+    void progress(const char *name, const uint64_t done, const uint64_t total)
+    {
+        uint64_t now = now_ms();
+        if (cur != name)
+        {
+            cur = name;
+            start = now;
+            shown = 0;
+        }
+        if (now - shown < 200  &&  done != total)
+            return;
+        shown = now;
+
+        std::string m;
+        uint64_t    ms = now > start ? now - start : 1;
+        str::sappend(m, "\r%s: %llu", name, (unsigned long long)done);
+        if (total)
+            str::sappend(m, " of %llu", (unsigned long long)total);
+        str::sappend(m, " bytes, %llu B/s   ", (unsigned long long)(done * 1000 / ms));
+        term_msg(l, m.data(), m.size());
+    }
+
+    void pass(const unsigned char *p, const int n)
+    {
+        timespec            ts;
+        int                 out_cnt;
+        if (read_stamps())
+            tstamp.now(ts);
+        const unsigned char *out = l.cli_data(l, p, n, ts, out_cnt);
+        link_write(l, l.term_out, out, out_cnt);
+    }
+
+    bool drain()
+    {
+        return !isatty(l.cli_fd)  ||  tcdrain(l.cli_fd) == 0;
+    }
+
+    void message(const char *msg)
+    {
+        std::string m;
+        str::sappend(m, "\r\n(%s)\r\n", msg);
+        term_msg(l, m.data(), m.size());
+    }
+
+protected:
+    Link&       l;
+    std::string cur;
+    uint64_t    start;
+    uint64_t    shown;
+
+    static bool abort_key(const unsigned char *p, const size_t n)
+    {
+        return memchr(p, '\033', n)  ||  memchr(p, 0x03, n);
+    }
+
+    int raw_write(const unsigned char *buf, const int cnt)
+    {
+        return link_write(l, l.cli_fd, buf, cnt);
+    }
+};
+
+// Transfer reading the client descriptor itself
+class FdXferIo : public ConXferIo
+{
+public:
+    FdXferIo(Link& l) : ConXferIo(l) {}
+
+protected:
+    int raw_read(unsigned char *buf, const int max, const int timeout_ms)
+    {
+        uint64_t deadline = now_ms() + timeout_ms;
+        pollfd   fds[2];
+
+        // Keys are watched for abort in interactive session only
+        fds[0].fd = l.cli_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = l.term_in;
+        fds[1].events = POLLIN;
+        fds[1].revents = 0;
+        for (;;)
+        {
+            uint64_t now = now_ms();
+            int      rc = poll(fds, l.interactive ? 2 : 1, now < deadline ? deadline - now : 0);
+            if (rc < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+            }
+            if (rc == 0)
+                return 0;
+            if (fds[1].revents)
+            {
+                // Other keys are ignored during transfer
+                unsigned char keys[64];
+                int           n = ::read(l.term_in, keys, sizeof(keys));
+                if (n <= 0  ||  abort_key(keys, n))
+                    return -1;
+            }
+            if (fds[0].revents)
+            {
+                int n = ::read(l.cli_fd, buf, max);
+                if (n < 0  &&  errno == EINTR)
+                    continue;
+                return n > 0 ? n : -1;
+            }
+        }
+    }
+};
+
+// Send text file or paste, paced
+static bool type_text(Link& l, ConXferIo& io, Action& a)
+{
+    std::string m;
+
+    if (!a.args.empty())
+    {
+        FILE *f = fopen(a.args[0].c_str(), "rb");
+        if (!f)
+        {
+            str::sappend(m, "\r\n(%s: %s)\r\n", a.args[0].c_str(), strerror(errno));
+            term_msg(l, m.data(), m.size());
+            return false;
+        }
+        char   buf[64 * 1024];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+            a.text.append(buf, n);
+        fclose(f);
+    }
+    pace::as_typed(a.text);
+
+    if (a.text.size() > 64  ||  pace_cfg.mode != pace::NONE)
+    {
+        str::sappend(m, "\r\n(sending %lu bytes, Esc or Ctrl/C to abort)\r\n", (unsigned long)a.text.size());
+        term_msg(l, m.data(), m.size());
+    }
+
+    pace::Stats st;
+    bool        ok = pace::send(io, pace_cfg, a.text, st);
+
+    m.clear();
+    str::sappend(m, "\r\n(%s %llu of %lu bytes in %llu.%03llu s",
+                 ok ? "sent" : "aborted, sent", (unsigned long long)st.sent, (unsigned long)a.text.size(),
+                 (unsigned long long)(st.elapsed_ms / 1000), (unsigned long long)(st.elapsed_ms % 1000));
+    if (st.elapsed_ms)
+        str::sappend(m, ", %llu B/s", (unsigned long long)(st.sent * 1000 / st.elapsed_ms));
+    if (st.timeouts)
+        str::sappend(m, ", %u waits timed out", st.timeouts);
+    if (pace_cfg.mode == pace::ADAPTIVE)
+        str::sappend(m, ", window %lu", (unsigned long)st.window);
+    m += ")\r\n";
+    term_msg(l, m.data(), m.size());
+    return ok;
+}
+
+static bool run_action(Link& l, ConXferIo& io)
+{
+    Action              a = action;
+    std::string         m;
+    const unsigned char *p;
+    int                 n;
+
+    action.kind = Action::NONE;
+    action.text.clear();
+    if (!paste_queue.empty())
+    {
+        // Typed after this one
+        action.kind = Action::TYPE;
+        action.args.clear();
+        action.text.swap(paste_queue);
+    }
+    if (held_due(l, p, n, true)  &&  !io.write(p, n))
+        return false;
+    if (a.kind == Action::TYPE)
+        return type_text(l, io, a);
+    str::sappend(m, "\r\n(%s %s, Esc or Ctrl/C to abort)\r\n",
+                 xfer::proto_name(a.proto), a.kind == Action::SEND ? "send" : "receive");
+    term_msg(l, m.data(), m.size());
+
+    bool ok;
+    if (a.kind == Action::SEND)
+        ok = xfer::send(io, a.proto, a.args);
+    else
+        ok = xfer::receive(io, a.proto, a.args.empty() ? 0 : a.args[0].c_str());
+    term_msg(l, ok ? "\r\n(transfer complete)\r\n" : "\r\n(transfer failed)\r\n");
+    return ok;
+}
+
+// Handle one character in command mode.
+// Returns true if the character should be sent to client as is
+static bool command(Link& l, const unsigned char c)
+{
+    switch (cmd_state)
+    {
+    case CMD_IDLE:
+        break;
+    case CMD_KEY:
+        cmd_state = CMD_IDLE;
+        if (c == cmdChr)
+            return true;
+        switch (c)
+        {
+        case '/':
+            cmd_state = CMD_LINE;
+            cmd_kind = c;
+            cmd_line.clear();
+            term_msg(l, "\r\n(search) ");
+            break;
+        case 'f':
+            cmd_state = CMD_LINE;
+            cmd_kind = c;
+            cmd_line.clear();
+            term_msg(l, "\r\n(send text file) ");
+            break;
+        case 's':
+        case 'r':
+            cmd_state = CMD_LINE;
+            cmd_kind = c;
+            cmd_line.clear();
+            term_msg(l, c == 's' ? "\r\n(send: x|1k|y|z FILE...) " : "\r\n(receive: x|1k FILE or y|z [DIR]) ");
+            break;
+        case 'n':
+            do_search(l);
+            break;
+        case 'h':
+        case '?':
+            term_msg(l,
+                     "\r\n"
+                     "  /     - search scrollback backwards\r\n"
+                     "  n     - next (older) match\r\n"
+                     "  s     - send files (xmodem, xmodem-1k, ymodem, zmodem)\r\n"
+                     "  r     - receive files\r\n"
+                     "  f     - send text file as typed, paced by -pace\r\n"
+                     "  h, ?  - this help\r\n"
+                     "  Repeat the command key to send it\r\n");
+            break;
+        default:
+            term_msg(l, "\007");
+        }
+        break;
+    case CMD_LINE:
+        if (c == '\r' || c == '\n')
+        {
+            cmd_state = CMD_IDLE;
+            if (cmd_kind != '/')
+            {
+                Action::Kind kind = cmd_kind == 's' ? Action::SEND : cmd_kind == 'r' ? Action::RECEIVE : Action::TYPE;
+                if (!cmd_line.empty()  &&  !parse_action(kind, cmd_line.c_str(), " ", action))
+                {
+                    action.kind = Action::NONE;
+                    term_msg(l, "\r\n(invalid transfer request)\r\n");
+                }
+                break;
+            }
+            if (!cmd_line.empty())
+            {
+                search_pat = cmd_line.substr(0, Scrollback::MAXPAT);
+                search_pos = scrollback.end();
+            }
+            do_search(l);
+        }
+        else if (c == 0x7f || c == '\b')
+        {
+            if (!cmd_line.empty())
+            {
+                cmd_line.erase(cmd_line.size() - 1);
+                term_msg(l, "\b \b");
+            }
+        }
+        else if (c == '\033' || c == 0x03)
+        {
+            cmd_state = CMD_IDLE;
+            term_msg(l, "\r\n");
+        }
+        else if (c >= ' ')
+        {
+            cmd_line += c;
+            term_msg(l, (const char *)&c, 1);
+        }
+        break;
+    }
+    return false;
+}
+
+// Bracketed paste is collected and sent paced. Leaves in "buf" and
+// "cnt" the data typed out of pastes, before and after them
+static const char  PASTE_START[] = "\033[200~";
+static const char  PASTE_END[] = "\033[201~";
+static bool        pasting = false;
+static std::string paste;
+
+static void paste_data(const unsigned char *&buf, int& cnt)
+{
+    static std::string  typed;
+    const size_t        ML = sizeof(PASTE_START) - 1;
+    const unsigned char *p = buf;
+    int                 n = cnt;
+
+    if (!pasting  &&  !memmem(buf, cnt, PASTE_START, ML))
+        return;
+    typed.clear();
+    while (n > 0)
+    {
+        if (!pasting)
+        {
+            const unsigned char *m = (const unsigned char *)memmem(p, n, PASTE_START, ML);
+            if (!m)
+            {
+                typed.append((const char *)p, n);
+                break;
+            }
+            typed.append((const char *)p, m - p);
+            pasting = true;
+            paste.clear();
+            n -= m + ML - p;
+            p = m + ML;
+            continue;
+        }
+
+        // The end mark may have started in the previous read
+        size_t from = paste.size() > ML ? paste.size() - ML : 0;
+        paste.append((const char *)p, n);
+        size_t e = paste.find(PASTE_END, from);
+        if (e == std::string::npos)
+            break;
+        size_t tail = paste.size() - e - ML;
+        p += n - tail;
+        n = tail;
+        pasting = false;
+        paste.resize(e);
+        if (action.kind == Action::NONE)
+        {
+            action.kind = Action::TYPE;
+            action.args.clear();
+            action.text.swap(paste);
+        }
+        else
+            paste_queue += paste;
+        paste.clear();
+    }
+    buf = (const unsigned char *)typed.data();
+    cnt = typed.size();
+}
+
+// Data received from terminal at "ts": check for exit key, handle command
+// mode, log and capture it. Sets "cnt" to 0 if nothing should be sent to client
+static Relay term_data(Link& l, const unsigned char *&buf, int& cnt, const timespec& ts)
+{
+    static unsigned char cmd_char;
+
+    if (l.term_quickack)
+        quickack(l.term_in);
+    if (metrics.enabled())
+        metrics.read(Metrics::OUT, cnt);
+    l.key_us = now_us();
+    pty_sync(l);
+    if (bracketed_paste  &&  cmd_state == CMD_IDLE)
+    {
+        paste_data(buf, cnt);
+        if (!cnt)
+            return RELAY_OK;
+    }
+    if (!l.interactive)
+    {
+        // Pipe data goes as is
+        logger.write(buf, cnt, l.filter_colors);
+        capture.record(1, ts, buf, cnt);
+        return RELAY_OK;
+    }
+    if (cnt == 1  &&  *buf == exitChr)
+        return RELAY_EXIT;
+    if (cmd_state == CMD_IDLE  &&  cnt == 1  &&  cmdChr >= 0  &&  *buf == cmdChr)
+    {
+        cmd_state = CMD_KEY;
+        cnt = 0;
+        return RELAY_OK;
+    }
+    if (cmd_state != CMD_IDLE)
+    {
+        // Command mode eats everything but the literal command key
+        int n = 0;
+        for (int i=0; i<cnt; i++)
+            if (command(l, buf[i]))
+            {
+                cmd_char = buf[i];
+                n = 1;
+            }
+        buf = &cmd_char;
+        cnt = n;
+    }
+    if (cnt)
+        logger.write(buf, cnt, l.filter_colors);
+    capture.record(1, ts, buf, cnt);
+    return RELAY_OK;
+}
+
+// Terminal input EOF. Interactive session ends. In pipe and bridge modes
+// the client gets EOF too (write side of a socket is shut down) and the
+// relay goes on until the client EOF or "linger_ms" of client silence
+static Relay term_eof(Link& l)
+{
+    if (l.interactive)
+    {
+        fprintf(stderr, "\r\n\"%s\" EOF\n", l.term_name);
+        return RELAY_FAIL;
+    }
+
+    // io_uring relay has moved held data to its queue already
+    const unsigned char *p;
+    int                 n;
+    if (held_due(l, p, n, true)  &&  link_write(l, l.cli_fd, p, n) != n)
+    {
+        fprintf(stderr, "\r\n\"%s\" write error: %s\n", l.cli_name, strerror(errno));
+        return RELAY_FAIL;
+    }
+    if (l.cli_dg)
+        l.cli_dg->end();
+    else if (shutdown(l.cli_fd, SHUT_WR) < 0  &&  isatty(l.cli_fd))
+        tcdrain(l.cli_fd);
+    l.half_closed = true;
+    l.last_rx = now_ms();
+    return RELAY_OK;
+}
+
+/*
+ * Timers
+ *
+ * Things done at some time rather than on data arrival. Backends wait
+ * for data no longer than timer_wait() and call timers() on every pass.
+ * Held keystrokes and output are written by backends themselves when
+ * held_due() and out_due().
+ */
+
+// Microseconds until the nearest timer, -1 - no timers
+static int timer_wait(Link& l)
+{
+    uint64_t next = ~0ULL;
+    uint64_t now = now_us();
+
+    if (l.half_closed)
+        next = (l.last_rx + linger_ms) * 1000;
+    if (l.pty_fd >= 0  &&  l.pty_next * 1000 < next)
+        next = l.pty_next * 1000;
+    if (!l.held.empty()  &&  l.flush_at < next)
+        next = l.flush_at;
+    if (!l.out_held.empty()  &&  l.out_flush_at < next)
+        next = l.out_flush_at;
+    if (display.overloaded()  &&  now + display.wait() < next)
+        next = now + display.wait();
+    if (next == ~0ULL)
+        return -1;
+    if (next <= now)
+        return 0;
+    return next - now < 0x7fffffff ? (int)(next - now) : 0x7fffffff;
+}
+
+// timer_wait() for ppoll(), 0 - no timers
+static timespec *timer_ts(Link& l, timespec& ts)
+{
+    int wait = timer_wait(l);
+    if (wait < 0)
+        return 0;
+    ts.tv_sec = wait / 1000000;
+    ts.tv_nsec = wait % 1000000 * 1000LL;
+    return &ts;
+}
+
+static Relay timers(Link& l)
+{
+    uint64_t now = now_ms();
+
+    if (l.pty_fd >= 0  &&  now >= l.pty_next)
+        pty_sync(l);
+    // Screen write errors show at the next data
+    display.tick();
+    if (l.half_closed  &&  now >= l.last_rx + linger_ms)
+        return RELAY_EXIT;
+    return RELAY_OK;
+}
+
+// Keystrokes of the co-pilot (see Share): logged and captured as the
+// terminal ones, no commands and no exit key. Returns false on failure
+static bool copilot_data(Link& l, const unsigned char *buf, const int cnt)
+{
+    const unsigned char *p;
+    int                 n;
+    timespec            ts;
+
+    if (read_stamps())
+        tstamp.now(ts);
+    if (metrics.enabled())
+        metrics.read(Metrics::OUT, cnt);
+    l.key_us = now_us();
+    logger.write(buf, cnt, l.filter_colors);
+    capture.record(1, ts, buf, cnt);
+    if (held_due(l, p, n, true)  &&  link_write(l, l.cli_fd, p, n) != n)
+        return false;
+    return relay_write(l, 1, buf, cnt, ts) == cnt;
+}
+
+static void core_select(Link& l)
+{
+    static unsigned char buf[MAXBUF];
+    timespec             rx_ts;
+    fd_set               rds;
+    fd_set               except_ds;
+    int                  copilot = share.input_fd();
+    int                  num = (l.cli_fd > l.term_in ? l.cli_fd : l.term_in) + 1;
+
+    if (copilot >= num)
+        num = copilot + 1;
+
+    for (;;)
+    {
+        FD_ZERO(&rds);
+        FD_ZERO(&except_ds);
+        FD_SET(l.cli_fd, &rds);
+        FD_SET(l.cli_fd, &except_ds);
+        if (!l.half_closed)
+        {
+            FD_SET(l.term_in, &rds);
+            FD_SET(l.term_in, &except_ds);
+            if (copilot >= 0)
+                FD_SET(copilot, &rds);
+        }
+
+        // Datagrams read already are not signalled by select()
+        timeval tv;
+        int     wait = dgram_pending(l) ? 0 : timer_wait(l);
+        tv.tv_sec = wait / 1000000;
+        tv.tv_usec = wait % 1000000;
+        if (select(num, &rds, 0, &except_ds, wait < 0 ? 0 : &tv) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            RERR("select failure: %s\n", strerror(errno));
+        }
+
+        if (FD_ISSET(l.cli_fd, &except_ds))
+            RERR("\r\n\"%s\" error\n", l.cli_name);
+        if (FD_ISSET(l.term_in, &except_ds))
+            RERR("\r\n\"%s\" error\n", l.term_name);
+
+        if (FD_ISSET(l.cli_fd, &rds)  ||  (l.cli_dg  &&  l.cli_dg->pending()))
+        {
+            // From client to terminal
+            int buf_cnt;
+            if (l.sock_stamps)
+                buf_cnt = read_stamped(l.cli_fd, buf, MAXBUF, rx_ts);
+            else
+            {
+                buf_cnt = link_read(l, l.cli_fd, buf, MAXBUF);
+                if (read_stamps())
+                    tstamp.now(rx_ts);
+            }
+            if (buf_cnt < 0)
+                RERR("\r\n\"%s\" read error: %s\n", l.cli_name, strerror(errno));
+            if (buf_cnt == 0)
+            {
+                l.done = true;
+                out_flush(l);
+                RERR("\r\n\"%s\" EOF\n", l.cli_name);
+            }
+
+            int                 out_cnt;
+            const unsigned char *out = l.cli_data(l, buf, buf_cnt, rx_ts, out_cnt);
+            out_coalesce(l, out, out_cnt, rx_ts);
+            if (relay_write(l, 0, out, out_cnt, rx_ts) != out_cnt)
+                RERR("\r\n\"%s\" write error: %s\n", l.term_name, strerror(errno));
+        }
+        if (!l.half_closed  &&  (FD_ISSET(l.term_in, &rds)  ||  (l.term_dg  &&  l.term_dg->pending())))
+        {
+            // From terminal to client
+            int buf_cnt = link_read(l, l.term_in, buf, MAXBUF);
+            if (buf_cnt < 0)
+                RERR("\r\n\"%s\" read error: %s\n", l.term_name, strerror(errno));
+            if (buf_cnt == 0)
+            {
+                if (term_eof(l) != RELAY_OK)
+                    return;
+                continue;
+            }
+            timespec            ts;
+            const unsigned char *p = buf;
+            if (read_stamps())
+                tstamp.now(ts);
+            if (term_data(l, p, buf_cnt, ts) == RELAY_EXIT)
+            {
+                l.done = true;
+                break;
+            }
+            if (echo_flag  &&  link_write(l, l.term_out, p, buf_cnt) != buf_cnt)
+                RERR("\r\n\"%s\" write error: %s\n", l.term_name, strerror(errno));
+            coalesce(l, p, buf_cnt);
+            if (relay_write(l, 1, p, buf_cnt, ts) != buf_cnt)
+                RERR("\r\n\"%s\" write error: %s\n", l.cli_name, strerror(errno));
+        }
+        if (!l.half_closed  &&  copilot >= 0  &&  FD_ISSET(copilot, &rds))
+        {
+            // From the co-pilot to client, the pipe is never at EOF
+            int buf_cnt = read(copilot, buf, MAXBUF);
+            if (buf_cnt > 0  &&  !copilot_data(l, buf, buf_cnt))
+                RERR("\r\n\"%s\" write error: %s\n", l.cli_name, strerror(errno));
+        }
+        // A paste queued behind an action goes right after it
+        while (action.kind != Action::NONE)
+        {
+            FdXferIo io(l);
+            run_action(l, io);
+        }
+        if (timers(l) != RELAY_OK)
+        {
+            l.done = true;
+            break;
+        }
+        const unsigned char *p;
+        int                 n;
+        if (held_due(l, p, n)  &&  link_write(l, l.cli_fd, p, n) != n)
+            RERR("\r\n\"%s\" write error: %s\n", l.cli_name, strerror(errno));
+        if (out_due(l, p, n, rx_ts)  &&  relay_write(l, 0, p, n, rx_ts) != n)
+            RERR("\r\n\"%s\" write error: %s\n", l.term_name, strerror(errno));
+    }
+}
+
+/*
+ * io_uring relay
+ *
+ * Both directions are served by a single io_uring_enter() per loop:
+ * it submits the writes and re-armed reads prepared on the previous
+ * pass and waits for the next completions. Reads go to registered
+ * buffers (READ_FIXED) or, on sockets, are multishot receives into a
+ * provided buffers ring. Only one write per descriptor is in flight,
+ * everything arrived meanwhile is queued behind it and goes out with
+ * the next write.
+ */
+enum { UD_READ = 0, UD_WRITE = 2, UD_CANCEL = 4 };
+
+// Output side of the io_uring relay
+struct UWriter
+{
+    int         fd;
+    const char  *name;
+    std::string pending;
+    std::string inflight;
+    size_t      off;
+    bool        busy;
+    timespec    pending_ts;   // read time of the oldest pending data
+    timespec    inflight_ts;
+    timespec    started;      // the write is submitted
+};
+
+// Queue data read at "ts" for writer "w"
+static void uring_queue(UWriter& w, const unsigned char *p, const int cnt, const timespec& ts)
+{
+    if (w.pending.empty())
+        w.pending_ts = ts;
+    w.pending.append((const char *)p, cnt);
+}
+
+// Input side of the io_uring relay
+struct UReader
+{
+    struct Held
+    {
+        const unsigned char *p;
+        int                 cnt;
+        int                 bid;
+    };
+
+    int              fd;
+    const char       *name;
+    unsigned char    *buf;        // registered buffer for READ_FIXED
+    bool             multishot;
+    bool             armed;
+    int              status;      // 1 - ok, 0 - EOF, < 0 - -errno
+    UWriter          *dst;        // back pressure is applied by this queue
+    std::deque<Held> held;        // completions waiting for the queue to drain
+};
+
+static const size_t URING_QMAX = 64 * 1024;
+
+// Data completed on reader "src" (0 - client, 1 - terminal), queue it to writers
+static Relay uring_data(Link& l, const int src, UWriter *w, const unsigned char *p, int cnt)
+{
+    if (src == 0)
+    {
+        timespec rx_ts;
+        int      out_cnt;
+        if (read_stamps())
+            tstamp.now(rx_ts);
+        const unsigned char *out = l.cli_data(l, p, cnt, rx_ts, out_cnt);
+        out_coalesce(l, out, out_cnt, rx_ts);
+        if (out_cnt)
+            uring_queue(w[0], out, out_cnt, rx_ts);
+        return RELAY_OK;
+    }
+
+    timespec ts;
+    if (read_stamps())
+        tstamp.now(ts);
+    Relay rc = term_data(l, p, cnt, ts);
+    if (rc != RELAY_OK)
+        return rc;
+    if (echo_flag)
+        uring_queue(w[0], p, cnt, ts);
+    coalesce(l, p, cnt);
+    if (cnt)
+        uring_queue(w[1], p, cnt, ts);
+    return RELAY_OK;
+}
+
+// Handle completions: finish writes and hold the data read.
+// Returns false on failure
+static bool uring_reap(Uring& ring, UWriter *w, UReader *r, unsigned char (*pool)[MAXBUF])
+{
+    io_uring_cqe *c;
+
+    while ((c = ring.cqe()))
+    {
+        unsigned long ud = c->user_data;
+        int           res = c->res;
+        unsigned      flags = c->flags;
+        ring.seen();
+
+        if (ud == UD_CANCEL)
+            continue;
+        if (ud >= UD_WRITE)
+        {
+            UWriter& wr = w[ud - UD_WRITE];
+            if (res == -EINTR)
+                res = 0;    // Blocking tty write in io-wq interrupted, retried
+            if (res < 0)
+            {
+                fprintf(stderr, "\r\n\"%s\" write error: %s\n", wr.name, strerror(-res));
+                return false;
+            }
+            wr.off += res;
+            if (wr.off < wr.inflight.size())
+            {
+                // Short write, send the rest
+                io_uring_sqe *e = ring.sqe();
+                if (!e)
+                {
+                    fprintf(stderr, "\r\nio_uring submission queue overflow\n");
+                    return false;
+                }
+                e->opcode = IORING_OP_WRITE;
+                e->fd = wr.fd;
+                e->off = (unsigned long long)-1;
+                e->addr = (unsigned long)(wr.inflight.data() + wr.off);
+                e->len = wr.inflight.size() - wr.off;
+                e->user_data = ud;
+            }
+            else
+            {
+                wr.busy = false;
+                if (metrics.enabled())
+                {
+                    timespec now;
+                    tstamp.now(now);
+                    metrics.written(ud - UD_WRITE, us_since(wr.inflight_ts, now), us_since(wr.started, now));
+                }
+            }
+            continue;
+        }
+
+        UReader& rd = r[ud - UD_READ];
+        if (!(rd.multishot && (flags & IORING_CQE_F_MORE)))
+            rd.armed = false;
+        if (res == -ENOBUFS)
+            continue;   // All provided buffers are in use, re-armed later
+        if (res == -EINVAL  &&  rd.multishot)
+        {
+            // Kernel without multishot receive
+            rd.multishot = false;
+            continue;
+        }
+        if (res == -ECANCELED  ||  res == -EINTR)
+            continue;   // Cancelled for file transfer
+        if (res <= 0)
+        {
+            if (rd.status == 1)
+                rd.status = res;
+            continue;
+        }
+
+        UReader::Held h;
+        h.cnt = res;
+        h.bid = -1;
+        h.p = rd.buf;
+        if (flags & IORING_CQE_F_BUFFER)
+        {
+            h.bid = flags >> IORING_CQE_BUFFER_SHIFT;
+            h.p = pool[h.bid];
+        }
+        rd.held.push_back(h);
+    }
+    return true;
+}
+
+// Returns false if io_uring is not available, the caller should use other backend
+static bool core_uring(Link& l)
+{
+    const unsigned       POOL = 16;
+    static unsigned char rxbuf[2][MAXBUF];
+    static unsigned char pool[POOL][MAXBUF];
+    Uring                ring;
+    UWriter              w[2];
+    UReader              r[2];
+
+    if (!ring.init(16))
+        return false;
+
+    iovec iov[2];
+    for (int i=0; i<2; i++)
+    {
+        iov[i].iov_base = rxbuf[i];
+        iov[i].iov_len = MAXBUF;
+    }
+    if (!ring.register_buffers(iov, 2))
+        return false;
+
+    // Blocking reads are served by io-wq workers, keep them on relay CPUs
+    if (!rt_cpus.empty())
+        ring.iowq_affinity(rt_cpus);
+
+    // w[0]/r[0] - terminal output and client input, w[1]/r[1] - the opposite
+    w[0].fd = l.term_out;
+    w[0].name = l.term_name;
+    w[1].fd = l.cli_fd;
+    w[1].name = l.cli_name;
+    r[0].fd = l.cli_fd;
+    r[0].name = l.cli_name;
+    r[1].fd = l.term_in;
+    r[1].name = l.term_name;
+    for (int i=0; i<2; i++)
+    {
+        w[i].off = 0;
+        w[i].busy = false;
+        r[i].buf = rxbuf[i];
+        r[i].multishot = false;
+        r[i].armed = false;
+        r[i].status = 1;
+        r[i].dst = &w[i];
+    }
+
+    // Multishot receive on client socket
+    int       type;
+    socklen_t type_l = sizeof(type);
+    if (getsockopt(l.cli_fd, SOL_SOCKET, SO_TYPE, &type, &type_l) == 0  &&  type == SOCK_STREAM)
+        r[0].multishot = ring.provide_buffers(0, &pool[0][0], POOL, MAXBUF);
+
+    for (;;)
+    {
+        // Held keystrokes, all of them after terminal EOF
+        const unsigned char *p;
+        int                 n;
+        if (held_due(l, p, n, r[1].status != 1))
+        {
+            timespec ts;
+            if (read_stamps())
+                tstamp.now(ts);
+            uring_queue(w[1], p, n, ts);
+        }
+        // Held output, all of it after client EOF
+        timespec ts;
+        if (out_due(l, p, n, ts, r[0].status != 1))
+            uring_queue(w[0], p, n, ts);
+
+        for (int i=0; i<2; i++)
+        {
+            // Data held by back pressure
+            while (!r[i].held.empty()  &&  r[i].dst->pending.size() < URING_QMAX)
+            {
+                UReader::Held h = r[i].held.front();
+                r[i].held.pop_front();
+                Relay rc = uring_data(l, i, w, h.p, h.cnt);
+                if (h.bid >= 0)
+                    ring.recycle(h.bid);
+                if (rc != RELAY_OK)
+                {
+                    l.done = rc == RELAY_EXIT;
+                    return true;
+                }
+            }
+
+            // EOF or error is handled after all the data before it is written
+            if (r[i].status != 1  &&  !(i == 1 && l.half_closed)  &&
+                r[i].held.empty()  &&  !r[i].dst->busy  &&  r[i].dst->pending.empty())
+            {
+                if (r[i].status < 0)
+                    TERR("\r\n\"%s\" read error: %s\n", r[i].name, strerror(-r[i].status));
+                if (i == 0)
+                {
+                    l.done = true;
+                    TERR("\r\n\"%s\" EOF\n", r[i].name);
+                }
+                if (term_eof(l) != RELAY_OK)
+                    return true;
+            }
+
+            // Re-arm reads
+            if (!r[i].armed  &&  r[i].status == 1  &&  r[i].held.empty()  &&  r[i].dst->pending.size() < URING_QMAX  &&
+                action.kind == Action::NONE)
+            {
+                io_uring_sqe *e = ring.sqe();
+                if (!e)
+                    TERR("\r\nio_uring submission queue overflow\n");
+                e->fd = r[i].fd;
+                e->user_data = UD_READ + i;
+                if (r[i].multishot)
+                {
+                    e->opcode = IORING_OP_RECV;
+                    e->ioprio = IORING_RECV_MULTISHOT;
+                    e->flags = IOSQE_BUFFER_SELECT;
+                    e->buf_group = 0;
+                }
+                else
+                {
+                    e->opcode = IORING_OP_READ_FIXED;
+                    e->off = (unsigned long long)-1;    // current position of regular files
+                    e->addr = (unsigned long)r[i].buf;
+                    e->len = MAXBUF;
+                    e->buf_index = i;
+                }
+                r[i].armed = true;
+            }
+
+            // Start writes
+            if (!w[i].busy  &&  !w[i].pending.empty())
+            {
+                io_uring_sqe *e = ring.sqe();
+                if (!e)
+                    TERR("\r\nio_uring submission queue overflow\n");
+                w[i].inflight.swap(w[i].pending);
+                w[i].pending.clear();
+                w[i].off = 0;
+                w[i].busy = true;
+                w[i].inflight_ts = w[i].pending_ts;
+                if (metrics.enabled())
+                    tstamp.now(w[i].started);
+                e->opcode = IORING_OP_WRITE;
+                e->fd = w[i].fd;
+                e->off = (unsigned long long)-1;
+                e->addr = (unsigned long)w[i].inflight.data();
+                e->len = w[i].inflight.size();
+                e->user_data = UD_WRITE + i;
+            }
+        }
+
+        if (action.kind != Action::NONE)
+        {
+            // The transfer reads the descriptors itself: cancel the reads,
+            // let the writes complete and run it
+            for (int i=0; i<2; i++)
+                if (r[i].armed)
+                {
+                    io_uring_sqe *e = ring.sqe();
+                    if (!e)
+                        TERR("\r\nio_uring submission queue overflow\n");
+                    e->opcode = IORING_OP_ASYNC_CANCEL;
+                    e->fd = -1;
+                    e->addr = UD_READ + i;
+                    e->user_data = UD_CANCEL;
+                }
+            while (r[0].armed || r[1].armed || w[0].busy || w[1].busy)
+            {
+                if (ring.enter(1) < 0)
+                    TERR("io_uring_enter failure: %s\n", strerror(errno));
+                if (!uring_reap(ring, w, r, pool))
+                    return true;
+            }
+            FdXferIo io(l);
+            run_action(l, io);
+            continue;
+        }
+
+        if (metrics.enabled())
+            for (int i=0; i<2; i++)
+                metrics.queue(i, w[i].pending.size() + (w[i].busy ? w[i].inflight.size() - w[i].off : 0), 0);
+
+        // Timers run when all the output is written, nothing is left behind
+        bool idle = !w[0].busy  &&  w[0].pending.empty()  &&  r[0].held.empty();
+        if (idle  &&  timers(l) != RELAY_OK)
+        {
+            l.done = true;
+            return true;
+        }
+        if (ring.enter(1, idle ? timer_wait(l) : -1) < 0)
+            TERR("io_uring_enter failure: %s\n", strerror(errno));
+        if (!uring_reap(ring, w, r, pool))
+            return true;
+    }
+}
+
+/*
+ * Threaded relay
+ *
+ * Every source descriptor gets its own receive thread which reads
+ * straight into a lock-free SPSC ring. The output (main) thread drains
+ * the rings, so a slow terminal never delays reading of the device.
+ * If a ring is full the received data is dropped and counted. In pipe
+ * mode nothing may be lost: the receiver waits for room instead.
+ */
+struct Receiver
+{
+    int        fd;
+    Dgram      *dg;       // UDP socket, 0 - not
+    int        cpu;
+    const char *name;
+    bool       sock_stamps;
+    Spsc       ring;
+    int        wake;      // eventfd to wake the output thread
+    int        stop;      // eventfd to stop the receiver
+    int        status;    // 1 - ok, 0 - EOF, < 0 - -errno
+    bool       lossless;  // wait for room in the ring instead of dropping
+    bool       full;      // the receiver waits for room
+    int        room;      // eventfd to wake the receiver when room is made
+    pthread_t  thread;
+};
+
+static void *receiver(void *arg)
+{
+    Receiver      *r = (Receiver *)arg;
+    unsigned char scratch[MAXBUF];
+    pollfd        fds[2];
+    int           status = 1;
+
+    fds[0].fd = r->fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = r->stop;
+    fds[1].events = POLLIN;
+    while (status == 1)
+    {
+        // Datagrams read already are not signalled by poll()
+        fds[1].revents = 0;
+        if (!(r->dg  &&  r->dg->pending())  &&  poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            status = -errno;
+            break;
+        }
+        if (fds[1].revents)
+            return 0;
+
+        unsigned char *p = r->ring.reserve(MAXBUF);
+        if (!p  &&  r->lossless)
+        {
+            // Announce the wait first, the output thread may have made room meanwhile
+            __atomic_store_n(&r->full, true, __ATOMIC_SEQ_CST);
+            p = r->ring.reserve(MAXBUF);
+            if (!p)
+            {
+                pollfd w[2];
+                w[0].fd = r->room;
+                w[0].events = POLLIN;
+                w[1].fd = r->stop;
+                w[1].events = POLLIN;
+                if (poll(w, 2, -1) > 0  &&  w[0].revents)
+                {
+                    eventfd_t v;
+                    eventfd_read(r->room, &v);
+                }
+                continue;
+            }
+            __atomic_store_n(&r->full, false, __ATOMIC_RELAXED);
+        }
+        timespec      ts;
+        int           n;
+        if (r->sock_stamps)
+            n = read_stamped(r->fd, p ? p : scratch, MAXBUF, ts);
+        else
+        {
+            n = r->dg ? r->dg->read(p ? p : scratch, MAXBUF) : readn(r->fd, p ? p : scratch, MAXBUF);
+            tstamp.now(ts);
+        }
+        if (n <= 0)
+            status = n < 0 ? -errno : 0;
+        else if (!p)
+            r->ring.drop(n);
+        else if (r->ring.commit(n, ts))
+            eventfd_write(r->wake, 1);
+    }
+    __atomic_store_n(&r->status, status, __ATOMIC_RELEASE);
+    eventfd_write(r->wake, 1);
+    return 0;
+}
+
+static void stop_receivers(Receiver *r, const int n)
+{
+    for (int i=0; i<n; i++)
+    {
+        eventfd_write(r[i].stop, 1);
+        pthread_join(r[i].thread, 0);
+        close(r[i].stop);
+        close(r[i].room);
+    }
+    if (!quiet_flag)
+        for (int i=0; i<n; i++)
+            fprintf(stderr, "\r\n\"%s\" ring: max depth %lu of %lu bytes, %lu bytes dropped in %lu chunks",
+                    r[i].name, (unsigned long)r[i].ring.max_depth(), (unsigned long)r[i].ring.capacity(),
+                    r[i].ring.dropped(), r[i].ring.drops());
+}
+
+// Wake the receiver waiting for room in its ring
+static void made_room(Receiver& r)
+{
+    // Pops are seen by the receiver before it's checked for waiting
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&r.full, __ATOMIC_SEQ_CST))
+    {
+        __atomic_store_n(&r.full, false, __ATOMIC_RELAXED);
+        eventfd_write(r.room, 1);
+    }
+}
+
+// Drain receiver "i" (0 - client, 1 - terminal)
+static Relay drain(Link& l, Receiver& r, const int i)
+{
+    const unsigned char *p;
+    size_t              cnt;
+    timespec            ts;
+
+    while ((p = r.ring.front(cnt, ts)))
+    {
+        if (i == 0)
+        {
+            int                 out_cnt;
+            const unsigned char *out = l.cli_data(l, p, cnt, ts, out_cnt);
+            out_coalesce(l, out, out_cnt, ts);
+            if (relay_write(l, 0, out, out_cnt, ts) != out_cnt)
+            {
+                fprintf(stderr, "\r\n\"%s\" write error: %s\n", l.term_name, strerror(errno));
+                return RELAY_FAIL;
+            }
+        }
+        else
+        {
+            int n = cnt;
+            if (term_data(l, p, n, ts) == RELAY_EXIT)
+                return RELAY_EXIT;
+            cnt = n;
+            if (echo_flag  &&  link_write(l, l.term_out, p, cnt) != (int)cnt)
+            {
+                fprintf(stderr, "\r\n\"%s\" write error: %s\n", l.term_name, strerror(errno));
+                return RELAY_FAIL;
+            }
+            coalesce(l, p, n);
+            cnt = n;
+            if (relay_write(l, 1, p, cnt, ts) != (int)cnt)
+            {
+                fprintf(stderr, "\r\n\"%s\" write error: %s\n", l.cli_name, strerror(errno));
+                return RELAY_FAIL;
+            }
+        }
+        r.ring.pop();
+    }
+    made_room(r);
+    return RELAY_OK;
+}
+
+// Transfer reading the client ring, keys are taken from the terminal ring
+class RingXferIo : public ConXferIo
+{
+public:
+    RingXferIo(Link& l, Receiver *r, const int wake) : ConXferIo(l), r(r), wake(wake), off(0) {}
+
+protected:
+    Receiver *r;
+    int      wake;
+    size_t   off;      // consumed part of the front record
+
+    int raw_read(unsigned char *buf, const int max, const int timeout_ms)
+    {
+        uint64_t deadline = now_ms() + timeout_ms;
+
+        for (;;)
+        {
+            const unsigned char *p;
+            size_t              cnt;
+            timespec            ts;
+
+            while ((p = r[1].ring.front(cnt, ts)))
+            {
+                bool stop = l.interactive  &&  abort_key(p, cnt);
+                r[1].ring.pop();
+                made_room(r[1]);
+                if (stop)
+                    return -1;
+            }
+            if ((p = r[0].ring.front(cnt, ts)))
+            {
+                size_t n = cnt - off < (size_t)max ? cnt - off : max;
+                memcpy(buf, p + off, n);
+                off += n;
+                if (off == cnt)
+                {
+                    r[0].ring.pop();
+                    made_room(r[0]);
+                    off = 0;
+                }
+                return n;
+            }
+            int status = __atomic_load_n(&r[1].status, __ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&r[0].status, __ATOMIC_ACQUIRE) != 1  ||
+                status < 0  ||  (status == 0 && l.interactive))
+                return -1;
+
+            uint64_t now = now_ms();
+            if (now >= deadline)
+                return 0;
+            pollfd fd;
+            fd.fd = wake;
+            fd.events = POLLIN;
+            if (poll(&fd, 1, deadline - now) > 0)
+            {
+                eventfd_t v;
+                eventfd_read(wake, &v);
+            }
+        }
+    }
+};
+
+static void core_threads(Link& l)
+{
+    Receiver r[2];
+    int      wake = eventfd(0, 0);
+    int      started = 0;
+
+    if (wake < 0)
+        RERR("eventfd: %s\n", strerror(errno));
+
+    r[0].fd = l.cli_fd;
+    r[0].name = l.cli_name;
+    r[0].sock_stamps = l.sock_stamps;
+    r[0].dg = l.cli_dg;
+    r[1].fd = l.term_in;
+    r[1].name = l.term_name;
+    r[1].sock_stamps = false;
+    r[1].dg = l.term_dg;
+    for (int i=0; i<2; i++)
+    {
+        r[i].wake = wake;
+        r[i].cpu = rt_cpu(i + 1);
+        r[i].status = 1;
+        r[i].lossless = !l.interactive;
+        r[i].full = false;
+        r[i].stop = eventfd(0, 0);
+        r[i].room = eventfd(0, 0);
+        if (r[i].stop < 0  ||  r[i].room < 0  ||  !r[i].ring.init(i == 0 ? ring_size : MIN_RING))
+        {
+            fprintf(stderr, "Receiver setup failure: %s\n", strerror(errno));
+            break;
+        }
+        if (pthread_create(&r[i].thread, 0, receiver, &r[i]))
+        {
+            fprintf(stderr, "pthread_create failure\n");
+            break;
+        }
+        started++;
+        // Set here to fail the session as the main thread does
+        if ((rt_prio || r[i].cpu >= 0)  &&  !rt::set_thread(r[i].thread, rt_prio, r[i].cpu))
+        {
+            fprintf(stderr, "Can't set scheduling parameters: %s\n", strerror(errno));
+            break;
+        }
+    }
+
+    while (started == 2)
+    {
+        Relay rc = RELAY_OK;
+        for (int i=0; i<2 && rc == RELAY_OK; i++)
+        {
+            rc = drain(l, r[i], i);
+            int status = __atomic_load_n(&r[i].status, __ATOMIC_ACQUIRE);
+            if (rc == RELAY_OK  &&  status != 1  &&  !(i == 1 && l.half_closed))
+            {
+                // All the data before EOF or error is drained already
+                rc = drain(l, r[i], i);
+                if (rc != RELAY_OK)
+                    break;
+                if (status < 0)
+                {
+                    fprintf(stderr, "\r\n\"%s\" read error: %s\n", r[i].name, strerror(-status));
+                    rc = RELAY_FAIL;
+                }
+                else if (i == 0)
+                {
+                    out_flush(l);
+                    fprintf(stderr, "\r\n\"%s\" EOF\n", r[i].name);
+                    rc = RELAY_EXIT;
+                }
+                else
+                    rc = term_eof(l);
+            }
+        }
+        if (rc != RELAY_OK)
+        {
+            l.done = rc == RELAY_EXIT;
+            break;
+        }
+        if (metrics.enabled())
+            for (int i=0; i<2; i++)
+                metrics.queue(i, r[i].ring.depth(), r[i].ring.dropped());
+        if (action.kind != Action::NONE)
+        {
+            RingXferIo io(l, r, wake);
+            run_action(l, io);
+            continue;
+        }
+
+        // Timers run when the client ring is drained, nothing is left behind
+        size_t   cnt;
+        timespec ts;
+        if (!r[0].ring.front(cnt, ts)  &&  timers(l) != RELAY_OK)
+        {
+            l.done = true;
+            break;
+        }
+        const unsigned char *p;
+        int                 n;
+        if (held_due(l, p, n)  &&  link_write(l, l.cli_fd, p, n) != n)
+        {
+            fprintf(stderr, "\r\n\"%s\" write error: %s\n", l.cli_name, strerror(errno));
+            break;
+        }
+        if (out_due(l, p, n, ts)  &&  relay_write(l, 0, p, n, ts) != n)
+        {
+            fprintf(stderr, "\r\n\"%s\" write error: %s\n", l.term_name, strerror(errno));
+            break;
+        }
+
+        pollfd fd;
+        fd.fd = wake;
+        fd.events = POLLIN;
+        int ready = ppoll(&fd, 1, timer_ts(l, ts), 0);
+        if (ready < 0  &&  errno != EINTR)
+        {
+            fprintf(stderr, "poll failure: %s\n", strerror(errno));
+            break;
+        }
+        eventfd_t v;
+        if (ready > 0  &&  eventfd_read(wake, &v) < 0  &&  errno != EINTR)
+        {
+            fprintf(stderr, "eventfd read failure: %s\n", strerror(errno));
+            break;
+        }
+    }
+
+    stop_receivers(r, started);
+    close(wake);
+}
+
+/*
+ * Zero-copy relay
+ *
+ * Between sockets, pipes and files, when the data isn't looked at (no
+ * log, timestamps, hexa or scrollback), it's moved by splice() through
+ * a pipe per direction and never copied to user space.
+ */
+static bool spliceable(const int fd)
+{
+    struct stat st;
+    return fstat(fd, &st) == 0  &&  (S_ISSOCK(st.st_mode) || S_ISFIFO(st.st_mode) || S_ISREG(st.st_mode));
+}
+
+static void splice_loop(Link& l, int (*pipes)[2])
+{
+    const size_t CHUNK = 64 * 1024;
+    const int    src[2] = { l.cli_fd, l.term_in };
+    const int    dst[2] = { l.term_out, l.cli_fd };
+    const char   *src_name[2] = { l.cli_name, l.term_name };
+    const char   *dst_name[2] = { l.term_name, l.cli_name };
+
+    for (;;)
+    {
+        pollfd fds[2];
+        fds[0].fd = l.cli_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = l.half_closed ? -1 : l.term_in;
+        fds[1].events = POLLIN;
+        timespec ts;
+        if (ppoll(fds, 2, timer_ts(l, ts), 0) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            RERR("poll failure: %s\n", strerror(errno));
+        }
+
+        for (int d=0; d<2; d++)
+        {
+            if (!fds[d].revents)
+                continue;
+            ssize_t n = splice(src[d], 0, pipes[d][1], 0, CHUNK, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n < 0  &&  (errno == EAGAIN || errno == EINTR))
+                continue;
+            if (n < 0)
+                RERR("\r\n\"%s\" read error: %s\n", src_name[d], strerror(errno));
+            if (n == 0)
+            {
+                if (d == 1)
+                {
+                    if (term_eof(l) != RELAY_OK)
+                        return;
+                    continue;
+                }
+                l.done = true;
+                RERR("\r\n\"%s\" EOF\n", l.cli_name);
+            }
+            if (d == 0  &&  l.half_closed)
+                l.last_rx = now_ms();
+            while (n > 0)
+            {
+                ssize_t m = splice(pipes[d][0], 0, dst[d], 0, n, SPLICE_F_MOVE);
+                if (m < 0  &&  errno == EINTR)
+                    continue;
+                if (m <= 0)
+                    RERR("\r\n\"%s\" write error: %s\n", dst_name[d], strerror(errno));
+                n -= m;
+            }
+        }
+        if (timers(l) != RELAY_OK)
+        {
+            l.done = true;
+            return;
+        }
+    }
+}
+
+static void core_splice(Link& l)
+{
+    int pipes[2][2];
+
+    if (pipe2(pipes[0], O_CLOEXEC) < 0)
+        RERR("pipe: %s\n", strerror(errno));
+    if (pipe2(pipes[1], O_CLOEXEC) < 0)
+    {
+        close(pipes[0][0]);
+        close(pipes[0][1]);
+        RERR("pipe: %s\n", strerror(errno));
+    }
+    splice_loop(l, pipes);
+    for (int i=0; i<2; i++)
+    {
+        close(pipes[i][0]);
+        close(pipes[i][1]);
+    }
+}
+
+// Relay between client and terminal (keyboard and screen or, in pipe
+// mode, stdin and stdout). Returns false if ended by an error
+bool con_core(int cli_fd, const char *cli_name, int term_in, int term_out, const char *term_name,
+              bool filter_colors, Dgram *cli_dg, Dgram *term_dg)
+{
+    Link l;
+
+    l.cli_fd = cli_fd;
+    l.cli_name = cli_name;
+    l.term_in = term_in;
+    l.term_out = term_out;
+    l.interactive = !pipe_flag  &&  !bridge_flag;
+    l.msg_fd = l.interactive ? term_out : 2;
+    l.term_name = term_name;
+    l.filter_colors = filter_colors;
+    l.sock_stamps = false;
+    l.half_closed = false;
+    l.done = false;
+    l.last_rx = 0;
+    l.cli_quickack = quickack_wanted(cli_fd);
+    l.term_quickack = quickack_wanted(term_in);
+    l.flush_at = 0;
+    l.out_flush_at = 0;
+    l.key_us = 0;
+    l.pty_fd = -1;
+    l.pty_peer = -1;
+    l.pty_next = 0;
+    l.pty_speed = 0;
+    l.pty_cflag = 0;
+    l.cli_data = 0;
+    l.cli_dg = cli_dg;
+    l.term_dg = term_dg;
+
+    // pty bridged to tty: line settings follow the pty
+    int ptn;
+    if (bridge_flag  &&  cli_fd != term_in)
+        for (int i=0; i<2; i++)
+        {
+            int fd = i ? term_in : cli_fd, other = i ? cli_fd : term_in;
+            if (ioctl(fd, TIOCGPTN, &ptn) == 0  &&  isatty(other))
+            {
+                l.pty_fd = fd;
+                l.pty_peer = other;
+                pty_sync(l);
+            }
+        }
+
+    if (tstamp.enabled()  ||  capture.enabled())
+    {
+        // Kernel receive timestamps are available on sockets only
+        int one = 1;
+        l.sock_stamps = backend == BE_SELECT  &&  !cli_dg  &&
+            setsockopt(cli_fd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one)) == 0;
+        tstamp.start(l.sock_stamps);
+    }
+    if (capture.enabled())
+    {
+        timespec ts;
+        tstamp.now(ts);
+        capture.start(cli_name, term_name, ts);
+    }
+    if (metrics.enabled())
+        metrics.session_start(cli_name, term_name, isatty(cli_fd) ? cli_fd : -1, isatty(term_in) ? term_in : -1);
+
+    // Pastes are collected for paced send
+    if (pace_cfg.mode != pace::NONE  &&  l.interactive  &&  isatty(term_out))
+    {
+        term_msg(l, "\033[?2004h");
+        bracketed_paste = true;
+    }
+
+    l.cli_data = cli_mode(l);
+
+    // The screen, not the other side of a bridge
+    if (display_mode  &&  !bridge_flag  &&  !term_dg  &&  !display.open(term_out, display_mode))
+        fprintf(stderr, "Overload mode is off, \"%s\": %s\r\n", term_name, strerror(errno));
+
+    // Transfer requested on command line goes first
+    if (action.kind != Action::NONE)
     {
-        close(tty1);
-        tty1 = -1;
+        FdXferIo io(l);
+        run_action(l, io);
     }
-    if (tty1_name)
+
+    // Data nobody looks at goes the zero-copy way
+    bool plain = !l.interactive  &&  !tstamp.enabled()  &&  !logger.enabled()  &&  !hexa_flag  &&  !hexa_ascii_flag  &&
+        !scrollback.enabled()  &&  !echo_flag  &&  !coalesce_us  &&  !out_coalesce_us  &&  !capture.enabled()  &&  !metrics.enabled()  &&
+        !trigger.enabled()  &&  !display_mode  &&  !share.enabled()  &&  !cli_dg  &&  !term_dg;
+    Backend be = backend;
+    if (be == BE_SELECT  &&  plain  &&  spliceable(cli_fd)  &&  spliceable(term_in)  &&  spliceable(term_out))
+        core_splice(l);
+    else
     {
-        free(tty1_name);
-        tty1_name = 0;
+        // io_uring reads a datagram per request, select batches them.
+        // Its writes are queued, the screen is written by select.
+        // Co-pilot input is a third source, select takes any number
+        if (be == BE_URING  &&  (cli_dg  ||  term_dg  ||  display.enabled()))
+            be = BE_SELECT;
+        if (share.input_fd() >= 0)
+            be = BE_SELECT;
+        if (be == BE_URING  &&  !core_uring(l))
+        {
+            if (!quiet_flag)
+                fprintf(stderr, "io_uring is not available (%s), using select\r\n", strerror(errno));
+            backend = be = BE_SELECT;
+        }
+        if (be == BE_THREADS)
+            core_threads(l);
+        else if (be == BE_SELECT)
+            core_select(l);
     }
-    if (log_file)
+
+    out_flush(l);
+    if (bracketed_paste)
     {
-        fclose(log_file);
-        log_file = NULL;
+        term_msg(l, "\033[?2004l");
+        bracketed_paste = false;
     }
-    exit (stat);
-}
-extern "C" void finish_int(int)
-{
-    finish(1);
+    capture.flush();
+    trigger.flush();
+    display.close();
+    if (metrics.enabled())
+        metrics.session_end(l.done);
+    return l.done;
 }
 
-int readn(int fd, void *ptr, int nbytes)
+// Find the speed of the target tty with "-b auto" or exit
+static void detect_baud(Endpoint& e)
 {
-    int     nread;
-
-    do
-        nread = read(fd, ptr, nbytes);
-    while (nread < 0 && (errno == EINTR || errno == EAGAIN));
-    return nread;
+    Autobaud ab;
+
+    if (!quiet_flag)
+        fprintf(stderr, "Detecting baud rate of %s, up to %d s\r\n", e.name(), autobaud_ms / 1000);
+    int rate = ab.detect(*tty, e.fd(), autobaud_ms, !quiet_flag);
+    if (rate < 0)
+        PERR("Baud rate detection on %s: %s\n", e.name(), strerror(errno));
+    if (quiet_flag)
+        return;
+    if (rate)
+        fprintf(stderr, "Baud rate %d, %d%% text\r\n", rate, ab.score() < 100 ? ab.score() : 100);
+    else
+        fprintf(stderr, "Nothing received from %s, baud rate is not changed\r\n", e.name());
 }
 
-int writen(int fd, const void *ptr, int nbytes)
+// Open endpoint or exit
+static void open_endpoint(Endpoint& e)
 {
-    int     nwritten;
-
-    do
-        nwritten = write(fd, ptr, nbytes);
-    while (nwritten < 0 && (errno == EINTR || errno == EAGAIN));
-    return nwritten;
+    if (e.open(*tty))
+    {
+        if (autobaud_ms  &&  &e == &target  &&  e.type() == Endpoint::TTY)
+            detect_baud(e);
+        return;
+    }
+    if (e.type() == Endpoint::TTY)
+        PERR("Can't open tty device %s: %s\n", e.name(), strerror(errno));
+    PERR("%s: %s\n", e.what(), strerror(errno));
 }
 
-enum Pstate { REGULAR, COLOR, CRNL };
-static Pstate log_pstate = REGULAR;
-static int    cr_count = 0;
-void log(const unsigned char *buf, const int buf_cnt, bool filter_colors)
+/*
+ * Bridge mode
+ *
+ * The target is relayed to another endpoint with no terminal at all.
+ * Listening endpoints take connections one after another, clients are
+ * connected when there is somebody to relay to, ttys stay open. The
+ * process ends when neither side listens and the session is over.
+ */
+static void bridge(Endpoint& a, Endpoint& b, const bool filter_colors)
 {
-    if (!log_file)
-        return;
+    Endpoint *e[2] = { &a, &b };
 
-    if (filter_colors)
-    {
-        for (int i=0; i<buf_cnt; i++)
+    // Peer gone is the end of the session, not of the bridge
+    signal(SIGPIPE, SIG_IGN);
+
+    for (int i=0; i<2; i++)
+        if (e[i]->listener()  ||  e[i]->type() == Endpoint::TTY)
         {
-            switch(log_pstate)
-            {
-            case REGULAR:
-                if (buf[i] == '\033')
-                    log_pstate = COLOR;
-                else if (buf[i] == '\r')
-                {
-                    log_pstate = CRNL;
-                    cr_count++;
-                }
-                else
-                    fwrite(&buf[i], 1, 1, log_file);
-                break;
-            case COLOR:
-                if (buf[i] == 'm')
-                    log_pstate = REGULAR;
-                break;
-            case CRNL:
-                if (buf[i] == '\r')
-                    cr_count++;
-                else if (buf[i] == '\n')
-                {
-                    fwrite(&buf[i], 1, 1, log_file);
-                    cr_count = 0;
-                }
-                else
-                {
-                    for (int j=0; j<cr_count; j++)
-                        fwrite("\r", 1, 1, log_file);
-                    fwrite(&buf[i], 1, 1, log_file);
-                    cr_count = 0;
-                }
-                log_pstate = REGULAR;
-                break;
-            }
+            open_endpoint(*e[i]);
+            if (!quiet_flag)
+                fprintf(stderr, "%s is open\n", e[i]->name());
         }
+
+    // pty starts with the line settings of the tty
+    for (int i=0; i<2; i++)
+    {
+        termios t;
+        if (e[i]->type() == Endpoint::PTY  &&  e[!i]->type() == Endpoint::TTY  &&
+            tcgetattr(e[!i]->fd(), &t) == 0)
+            line_copy(t, e[i]->listen_fd(), TCSANOW);
     }
-    else
-        fwrite(buf, buf_cnt, 1, log_file);
-}
 
-void con_core(int cli_fd, const char *cli_name, int term_fd, const char *term_name, bool filter_colors)
-{
-    const int            MAXBUF = 1024;
-    static unsigned char buf[MAXBUF];
-    static int           term_cnt = 0;
-    fd_set               rds;
-    fd_set               except_ds;
-    int                  num = (cli_fd > term_fd ? cli_fd : term_fd) + 1;
     for (;;)
     {
-        FD_ZERO(&rds);
-        FD_ZERO(&except_ds);
-        FD_SET(cli_fd, &rds);
-        FD_SET(term_fd, &rds);
-        FD_SET(cli_fd, &except_ds);
-        FD_SET(term_fd, &except_ds);
-
-        if (select(num, &rds, 0, &except_ds, 0) < 0)
-            RERR("select failure: %s\n", strerror(errno));
-
-        if (FD_ISSET(cli_fd, &except_ds))
-            RERR("\r\n\"%s\" error\n", cli_name);
-        if (FD_ISSET(term_fd, &except_ds))
-            RERR("\r\n\"%s\" error\n", term_name);
-
-        if (FD_ISSET(cli_fd, &rds))
-        {
-            // From client to terminal
-            int buf_cnt = readn(cli_fd, buf, MAXBUF);
-            if (buf_cnt < 0)
-                RERR("\r\n\"%s\" read error: %s\n", cli_name, strerror(errno));
-            if (buf_cnt == 0)
-                RERR("\r\n\"%s\" EOF\n", cli_name);
-            if (hexa_ascii_flag)
-            {
-                for (int i=0; i<buf_cnt; i++)
-                {
-                    char xbuf[16];
-                    sprintf(xbuf, "0x%02x [%c]   ", buf[i]&0xff, buf[i] >= ' ' && buf[i] <= '~' ? buf[i] : '.');
-                    if (writen(term_fd, xbuf, strlen(xbuf)) != (int)strlen(xbuf))
-                        RERR("\r\n\"%s\" write error: %s\n", term_name, strerror(errno));
-                    term_cnt++;
-                    if (term_cnt == hexa_ascii_inline)
-                    {
-                        if (writen(term_fd, "\r\n", 2) != 2)
-                            RERR("\r\n\"%s\" write error: %s\n", term_name, strerror(errno));
-                        term_cnt = 0;
-                    }
-                }
-            }
-            else if (hexa_flag)
+        for (int i=0; i<2; i++)
+            if (e[i]->listener()  &&  !e[i]->connected())
             {
-                for (int i=0; i<buf_cnt; i++)
-                {
-                    char xbuf[8];
-                    sprintf(xbuf, "0x%02x ", buf[i]&0xff);
-                    if (writen(term_fd, xbuf, strlen(xbuf)) != (int)strlen(xbuf))
-                        RERR("\r\n\"%s\" write error: %s\n", term_name, strerror(errno));
-                    term_cnt++;
-                    if (term_cnt == hexa_inline)
-                    {
-                        if (writen(term_fd, "\r\n", 2) != 2)
-                            RERR("\r\n\"%s\" write error: %s\n", term_name, strerror(errno));
-                        term_cnt = 0;
-                    }
-                }
+                if (!quiet_flag)
+                    fprintf(stderr, "%s waiting for connection\n", e[i]->name());
+                if (!e[i]->accept())
+                    PERR("%s: %s\n", e[i]->what(), strerror(errno));
+                if (!quiet_flag)
+                    fprintf(stderr, "%s: connection accepted from %s\n", e[i]->name(), e[i]->peer());
             }
-            else
+        for (int i=0; i<2; i++)
+            if (!e[i]->connected())
             {
-                if (writen(term_fd, buf, buf_cnt) != buf_cnt)
-                    RERR("\r\n\"%s\" write error: %s\n", term_name, strerror(errno));
+                open_endpoint(*e[i]);
+                if (!quiet_flag)
+                    fprintf(stderr, "Connected to %s\n", e[i]->name());
             }
-            if (log_file)
-                log(buf, buf_cnt, filter_colors);
-        }
-        if (FD_ISSET(term_fd, &rds))
-        {
-            // From terminal to client
-            int buf_cnt = readn(term_fd, buf, MAXBUF);
-            if (buf_cnt < 0)
-                RERR("\r\n\"%s\" read error: %s\n", term_name, strerror(errno));
-            if (buf_cnt == 0)
-                RERR("\r\n\"%s\" EOF\n", term_name);
-            if (buf_cnt == 1  &&  *buf == exitChr)
-                break;
-            if (echo_flag  &&  writen(term_fd, buf, buf_cnt) != buf_cnt)
-                RERR("\r\n\"%s\" write error: %s\n", term_name, strerror(errno));
-            if (writen(cli_fd, buf, buf_cnt) != buf_cnt)
-                RERR("\r\n\"%s\" write error: %s\n", cli_name, strerror(errno));
-            if (log_file)
-                log(buf, buf_cnt, filter_colors);
-       }
+
+        bool ok = con_core(a.fd(), a.name(), b.fd(), b.fd(), b.name(), filter_colors, a.dgram(), b.dgram());
+        if (!a.listener()  &&  !b.listener())
+            finish(ok ? 0 : 1);
+
+        // Sockets are closed with the session
+        for (int i=0; i<2; i++)
+            if (e[i]->type() != Endpoint::TTY)
+                e[i]->disconnect();
     }
 }
 
 int main(int ac, char *av[])
 {
     int                  TargetBaud = 0, nparams=0;
-    bool                 tty_flag=false, socket_flag=false, cli_flag=false, srv_flag=false, quiet_flag=false;
+    bool                 tty_flag=false, socket_flag=false, cli_flag=false, srv_flag=false;
     bool                 filter_colors = false;
+    bool                 mlock_flag = false, latency_flag = false;
     char                 *TargetCon = 0;
+    const char           *metrics_spec = 0;
+    const char           *share_path = 0;
+    const char           *copilot_path = 0;
 
     /* Command line parsing. */
     if (ac < 2)
@@ -325,46 +2733,104 @@ int main(int ac, char *av[])
                 if (++i >= ac)
                     PERR("After switch \"%s\" baud rate is expected.\n",av[--i]);
                 char *end;
-                TargetBaud = (int)strtol(av[i], &end, 0);
-                if (*end)
-                    PERR("Invalid baud rate: \"%s\" -- ?\n", end);
+                if (!strncmp(av[i], "auto", 4))
+                {
+                    long s = 10;
+                    if (av[i][4] == ':')
+                    {
+                        s = strtol(av[i] + 5, &end, 0);
+                        if (*end  ||  s <= 0  ||  s > 3600)
+                            PERR("Invalid detection time: \"%s\" -- ?\n", av[i] + 5);
+                    }
+                    else if (av[i][4])
+                        PERR("Invalid baud rate: \"%s\" -- ?\n", av[i]);
+                    autobaud_ms = s * 1000;
+                    TargetBaud = 0;
+                }
+                else
+                {
+                    TargetBaud = (int)strtol(av[i], &end, 0);
+                    if (*end)
+                        PERR("Invalid baud rate: \"%s\" -- ?\n", end);
+                    autobaud_ms = 0;
+                }
                 tty_flag = true;
             }
             else if (!strcmp(av[i], "l")  ||  !strcmp(av[i], "log"))
             {
                 if (++i >= ac)
                     PERR("After switch \"%s\" baud rate is expected.\n",av[--i]);
-                if (log_file)
+                if (logger.enabled())
                     PERR("Log file have to be specified only once\n");
-                log_file = fopen(av[i], "w");
-                if (!log_file)
+                if (!logger.open(av[i]))
                     PERR("File \"%s\" open error: %s\n", av[i], strerror(errno));
             }
             else if (!strcmp(av[i], "a")  ||  !strcmp(av[i], "append"))
             {
-                time_t    t;
-                struct tm *tmp;
-                char      outstr[200];
-
                 if (++i >= ac)
                     PERR("After switch \"%s\" baud rate is expected.\n",av[--i]);
-                if (log_file)
+                if (logger.enabled())
                     PERR("Log file have to be specified only once\n");
-                log_file = fopen(av[i], "a");
-                fprintf(log_file, "\n\n\n*****     New CON session");
-                if (!log_file)
+                if (!logger.open(av[i], true))
                     PERR("File \"%s\" open error: %s\n", av[i], strerror(errno));
-                 t = time(NULL);
-                 tmp = localtime(&t);
-                 if (tmp &&  strftime(outstr, sizeof(outstr)-1, "%a, %d %b %y %T %z", tmp))
-                     fprintf(log_file, ", started at %s     *****\n\n\n", outstr);
-                 else
-                     fprintf(log_file, "     *****\n\n\n");
             }
             else if (!strcmp(av[i], "n")  ||  !strcmp(av[i], "nocolor"))
             {
                 filter_colors = true;
             }
+            else if (!strcmp(av[i], "T")  ||  !strcmp(av[i], "timestamp"))
+            {
+                if (++i >= ac)
+                    PERR("After switch \"%s\" timestamp mode is expected.\n",av[--i]);
+                if (!tstamp.set_mode(av[i]))
+                    PERR("Invalid timestamp mode: \"%s\" -- ?\n", av[i]);
+            }
+            else if (!strcmp(av[i], "i")  ||  !strcmp(av[i], "io"))
+            {
+                if (++i >= ac)
+                    PERR("After switch \"%s\" backend name is expected.\n",av[--i]);
+                if (!strcmp(av[i], "select"))
+                    backend = BE_SELECT;
+                else if (!strcmp(av[i], "uring"))
+                    backend = BE_URING;
+                else if (!strcmp(av[i], "threads"))
+                    backend = BE_THREADS;
+                else
+                    PERR("Invalid backend: \"%s\" -- ?\n", av[i]);
+            }
+            else if (!strcmp(av[i], "ring"))
+            {
+                if (++i >= ac)
+                    PERR("After switch \"%s\" ring size is expected.\n",av[--i]);
+                if (!parse_size(av[i], ring_size))
+                    PERR("Invalid ring size: \"%s\" -- ?\n", av[i]);
+                if (ring_size < MIN_RING)
+                    PERR("Ring size \"%s\" is too small, the minimum is %uK\n", av[i], (unsigned)(MIN_RING / 1024));
+            }
+            else if (!strcmp(av[i], "rt"))
+            {
+                if (++i >= ac)
+                    PERR("After switch \"%s\" priority is expected.\n",av[--i]);
+                char *end;
+                rt_prio = (int)strtol(av[i], &end, 0);
+                if (*end || rt_prio < 1 || rt_prio > 99)
+                    PERR("Invalid real-time priority: \"%s\" -- ?\n", av[i]);
+            }
+            else if (!strcmp(av[i], "cpu"))
+            {
+                if (++i >= ac)
+                    PERR("After switch \"%s\" CPU list is expected.\n",av[--i]);
+                if (!rt::parse_cpus(av[i], rt_cpus))
+                    PERR("Invalid CPU list: \"%s\" -- ?\n", av[i]);
+            }
+            else if (!strcmp(av[i], "mlock"))
+            {
+                mlock_flag = true;
+            }
+            else if (!strcmp(av[i], "latency"))
+            {
+                latency_flag = true;
+            }
             else if (!strcmp(av[i], "t")  ||  !strcmp(av[i], "term"))
             {
                 tty_flag = true;
@@ -385,47 +2851,161 @@ int main(int ac, char *av[])
             {
                 if (++i >= ac)
                     PERR("After switch \"%s\" quit character is expected.\n",av[--i]);
+                exitChr = parse_key(av[i]);
+            }
+            else if (!strcmp(av[i], "k")  ||  !strcmp(av[i], "key"))
+            {
+                if (++i >= ac)
+                    PERR("After switch \"%s\" command key is expected.\n",av[--i]);
+                cmdChr = strcmp(av[i], "none") ? parse_key(av[i]) : -1;
+            }
+            else if (!strcmp(av[i], "S")  ||  !strcmp(av[i], "scrollback"))
+            {
+                size_t size;
+                if (++i >= ac)
+                    PERR("After switch \"%s\" scrollback size is expected.\n",av[--i]);
+                if (!parse_size(av[i], size) || !size)
+                    PERR("Invalid scrollback size: \"%s\" -- ?\n", av[i]);
+                scrollback.init(size);
+            }
+            else if (!strcmp(av[i], "send")  ||  !strcmp(av[i], "recv"))
+            {
+                Action::Kind kind = av[i][0] == 's' ? Action::SEND : Action::RECEIVE;
+                if (++i >= ac)
+                    PERR("After switch \"%s\" transfer is expected.\n",av[--i]);
+                if (!parse_action(kind, av[i], ":,", action))
+                    PERR("Invalid transfer: \"%s\" -- ?\n", av[i]);
+            }
+            else if (!strcmp(av[i], "pace"))
+            {
+                if (++i >= ac)
+                    PERR("After switch \"%s\" pacing is expected.\n",av[--i]);
+                if (!pace::parse(av[i], pace_cfg))
+                    PERR("Invalid pacing: \"%s\" -- ?\n", av[i]);
+            }
+            else if (!strcmp(av[i], "type"))
+            {
+                if (++i >= ac)
+                    PERR("After switch \"%s\" file name is expected.\n",av[--i]);
+                if (!parse_action(Action::TYPE, av[i], "", action))
+                    PERR("Invalid file name: \"%s\" -- ?\n", av[i]);
+            }
+            else if (!strcmp(av[i], "p")  ||  !strcmp(av[i], "pipe"))
+            {
+                pipe_flag = true;
+            }
+            else if (!strcmp(av[i], "B")  ||  !strcmp(av[i], "bridge"))
+            {
+                if (++i >= ac)
+                    PERR("After switch \"%s\" endpoint is expected.\n",av[--i]);
+                if (!peer.parse(av[i]))
+                    PERR("Invalid endpoint: \"%s\" -- ?\n", av[i]);
+                bridge_flag = true;
+            }
+            else if (!strcmp(av[i], "capture"))
+            {
+                if (++i >= ac)
+                    PERR("After switch \"%s\" file name is expected.\n",av[--i]);
+                if (capture.enabled())
+                    PERR("Capture file have to be specified only once\n");
+                if (!capture.open(av[i]))
+                    PERR("File \"%s\" open error: %s\n", av[i], strerror(errno));
+            }
+            else if (!strcmp(av[i], "overload"))
+            {
+                if (++i >= ac)
+                    PERR("After switch \"%s\" mode is expected.\n",av[--i]);
+                if (!Display::parse(av[i], display_mode))
+                    PERR("Invalid overload mode: \"%s\" -- ?\n", av[i]);
+            }
+            else if (!strcmp(av[i], "trigger"))
+            {
+                if (++i >= ac)
+                    PERR("After switch \"%s\" pattern is expected.\n",av[--i]);
+                if (!trigger.add(str::unescape(av[i]).c_str()))
+                    PERR("Invalid trigger pattern: \"%s\" -- ?\n", av[i]);
+            }
+            else if (!strcmp(av[i], "trigger-size"))
+            {
+                if (++i >= ac)
+                    PERR("After switch \"%s\" size is expected.\n",av[--i]);
+                std::string pre(av[i], strcspn(av[i], ":"));
+                const char  *post = strchr(av[i], ':');
+                if (!parse_size(pre.c_str(), trigger_pre)  ||  trigger_pre > 0x40000000)
+                    PERR("Invalid trigger size: \"%s\" -- ?\n", av[i]);
+                if (post  &&  !parse_size(post + 1, trigger_post))
+                    PERR("Invalid trigger size: \"%s\" -- ?\n", av[i]);
+            }
+            else if (!strcmp(av[i], "trigger-file"))
+            {
+                if (++i >= ac)
+                    PERR("After switch \"%s\" file prefix is expected.\n",av[--i]);
+                trigger_prefix = av[i];
+            }
+            else if (!strcmp(av[i], "share")  ||  !strcmp(av[i], "copilot"))
+            {
+                if (++i >= ac)
+                    PERR("After switch \"%s\" socket path is expected.\n",av[--i]);
+                if (av[i - 1][0] == 's')
+                    share_path = av[i];
+                else
+                    copilot_path = av[i];
+            }
+            else if (!strcmp(av[i], "metrics"))
+            {
+                if (++i >= ac)
+                    PERR("After switch \"%s\" endpoint is expected.\n",av[--i]);
+                metrics_spec = av[i];
+            }
+            else if (!strcmp(av[i], "coalesce"))
+            {
+                if (++i >= ac)
+                    PERR("After switch \"%s\" time is expected.\n",av[--i]);
                 char *end;
-                exitChr = (unsigned char)strtol(av[i], &end, 0);
-                if (*end)
+                long us = strtol(av[i], &end, 0);
+                if (*end == ':')
                 {
-                    char *p = strchr(av[i], '/');
-                    if (!p)
-                        p = strchr(av[i], '-');
-                    if (!p)
-                        PERR("No delimiter ('-' or '/') found in \"KEY\" specification.\n");
-
-                    *p++ = 0;
-                    if (!strcasecmp(av[i], "control")
-                        || !strcasecmp(av[i], "cntrl")
-                        || !strcasecmp(av[i], "ctrl"))
-                    {
-                    }
-                    else
-                    {
-                        fprintf(stderr, "No modificator found in \"KEY\" specification.\n");
-                        fprintf(stderr, "Can be \"control\", \"cntrl\" or \"ctrl\"\n");
-                        finish(1);
-                    }
-
-                    if (strlen(p) != 1)
-                    {
-                        fprintf(stderr, "Should be one character after modificator in \"KEY\" specification.\n");
-                        fprintf(stderr, "Can be \"control\", \"cntrl\" or \"ctrl\"\n");
-                        finish(1);
-                    }
-
-                    if (*p >= 0x40 && *p <= 0x60)
-                        exitChr = *p - 0x40;
-                    else if (*p > 0x60)
-                        exitChr = *p - 0x60;
-                    else
-                    {
-                        fprintf(stderr, "Invalid character after modificator in \"KEY\" specification.\n");
-                        fprintf(stderr, "Can be \"control\", \"cntrl\" or \"ctrl\"\n");
-                        finish(1);
-                    }
+                    if (!parse_size(end + 1, coalesce_max)  ||  !coalesce_max)
+                        PERR("Invalid coalescing size: \"%s\" -- ?\n", end + 1);
                 }
+                else if (*end)
+                    PERR("Invalid coalescing time: \"%s\" -- ?\n", av[i]);
+                if (us < 0  ||  us > 10000000)
+                    PERR("Invalid coalescing time: \"%s\" -- ?\n", av[i]);
+                coalesce_us = us;
+            }
+            else if (!strcmp(av[i], "coalesce-out"))
+            {
+                if (++i >= ac)
+                    PERR("After switch \"%s\" time is expected.\n",av[--i]);
+                char *end;
+                long us = strtol(av[i], &end, 0);
+                if (*end == ':')
+                {
+                    if (!parse_size(end + 1, out_coalesce_max)  ||  !out_coalesce_max)
+                        PERR("Invalid coalescing size: \"%s\" -- ?\n", end + 1);
+                }
+                else if (*end)
+                    PERR("Invalid coalescing time: \"%s\" -- ?\n", av[i]);
+                if (us < 0  ||  us > 10000000)
+                    PERR("Invalid coalescing time: \"%s\" -- ?\n", av[i]);
+                out_coalesce_us = us;
+            }
+            else if (!strcmp(av[i], "sock"))
+            {
+                if (++i >= ac)
+                    PERR("After switch \"%s\" socket options are expected.\n",av[--i]);
+                if (!parse_sock_opts(av[i], sock_opts))
+                    PERR("Invalid socket options: \"%s\" -- ?\n", av[i]);
+            }
+            else if (!strcmp(av[i], "linger"))
+            {
+                if (++i >= ac)
+                    PERR("After switch \"%s\" time is expected.\n",av[--i]);
+                char *end;
+                linger_ms = (int)strtol(av[i], &end, 0);
+                if (*end || linger_ms < 0)
+                    PERR("Invalid linger time: \"%s\" -- ?\n", av[i]);
             }
             else if (!strcmp(av[i], "s")  ||  !strcmp(av[i], "server"))
             {
@@ -455,308 +3035,142 @@ int main(int ac, char *av[])
 
     if (nparams != 1)
         PERR("Invalid number of parameters.\n");
-    if ((socket_flag && tty_flag)  ||  (srv_flag && cli_flag))
+    if ((socket_flag && tty_flag)  ||  (srv_flag && cli_flag)  ||  (bridge_flag && pipe_flag))
         PERR("Mutually exclusive flags are specified.\n");
 
-    // tty or socket ?
-    if (!socket_flag && !tty_flag)
+    if (!target.parse(TargetCon))
     {
-        if (strchr(TargetCon, ':'))
-            // Contains ':' - most probably socket
-            socket_flag = true;
-        else
-            // Otherwise - most probably tty
-            tty_flag = true;
-    }
+        // tty or socket ?
+        if (!socket_flag && !tty_flag)
+        {
+            if (strchr(TargetCon, ':'))
+                // Contains ':' - most probably socket
+                socket_flag = true;
+            else
+                // Otherwise - most probably tty
+                tty_flag = true;
+        }
 
-    // server or client ?
-    if (socket_flag  &&  (!srv_flag && !cli_flag))
-    {
-        if (*TargetCon == ':')
-            // Starts with ':' - most probably server
-            srv_flag = true;
-        else if (strchr(TargetCon, ':'))
-            // Contains ':' - most probably client
-            srv_flag = true;
+        // server or client ?
+        if (socket_flag  &&  (!srv_flag && !cli_flag))
+        {
+            if (*TargetCon == ':')
+                // Starts with ':' - most probably server
+                srv_flag = true;
+            else if (strchr(TargetCon, ':'))
+                // Contains ':' - most probably client
+                cli_flag = true;
+            else
+                PERR("\'%s\" is ambiguous - server or client flag must be specified\n", TargetCon);
+        }
+        //fprintf(stderr, "socket_flag:%d, tty_flag:%d, srv_flag:%d, cli_flag:%d\n", socket_flag, tty_flag, srv_flag, cli_flag);
+
+        bool inet = strchr(TargetCon, ':') != 0;
+        if (tty_flag)
+            target.set(Endpoint::TTY, TargetCon, TargetBaud);
+        else if (srv_flag)
+            target.set(inet ? Endpoint::TCP_LISTEN : Endpoint::UNIX_LISTEN, TargetCon);
         else
-            PERR("\'%s\" is ambiguous - server or client flag must be specified\n", TargetCon);
+            target.set(inet ? Endpoint::TCP : Endpoint::UNIX, TargetCon);
     }
-    //fprintf(stderr, "socket_flag:%d, tty_flag:%d, srv_flag:%d, cli_flag:%d\n", socket_flag, tty_flag, srv_flag, cli_flag);
+
+    // Keystrokes are ACKed at once, the echo isn't held by delayed ACK
+    if (!quickack_set)
+        sock_opts.quickack = !pipe_flag  &&  !bridge_flag;
+    target.tune(sock_opts);
+    peer.tune(sock_opts);
 
     signal(SIGINT,  finish_int);
     signal(SIGQUIT, finish_int);
     signal(SIGTERM, finish_int);
     signal(SIGPIPE, finish_int);
+
+    // Real-time setup, before any buffer is allocated
+    if (mlock_flag  &&  !rt::lock_memory())
+        PERR("Can't lock memory: %s\n", strerror(errno));
+    // The probe keeps off the relay CPUs, the process affinity is still full
+    int probe_cpu = rt::spare_cpu(rt_cpus);
+    if ((rt_prio || !rt_cpus.empty())  &&  !rt::set_thread(pthread_self(), rt_prio, rt_cpu(0)))
+        PERR("Can't set scheduling parameters: %s\n", strerror(errno));
+    if (latency_flag)
+    {
+        probe = new rt::Probe();
+        if (!probe->start(rt_prio, probe_cpu))
+            PERR("Can't start latency probe: %s\n", strerror(errno));
+    }
+
+    trigger.init(trigger_prefix, trigger_pre, trigger_post);
+    if (metrics_spec  &&  !metrics.serve(metrics_spec))
+        PERR("Metrics on \"%s\": %s\n", metrics_spec, strerror(errno));
+    if ((share_path  ||  copilot_path)  &&  !share.serve(share_path, copilot_path))
+        PERR("Sharing on \"%s\": %s\n", share_path ? share_path : copilot_path, strerror(errno));
+
     tty = new Tty();
 
-    // Open second connection, always to /dev/tty
-    int tty2 = tty->open(tty2_name);
-    if (tty2 == -1)
-        PERR("Can't open /dev/tty: %s\n", strerror(errno));
+    if (bridge_flag)
+        bridge(target, peer, filter_colors);
+
+    // Open second connection: /dev/tty or, in pipe mode, stdin and stdout
+    int tty2 = -1;
+    int term_in = 0, term_out = 1;
+    if (pipe_flag)
+        tty2_name = "stdin";
+    else
+    {
+        tty2 = tty->open(tty2_name);
+        if (tty2 == -1)
+            PERR("Can't open /dev/tty: %s\n", strerror(errno));
+        term_in = term_out = tty2;
+    }
 
     // Open first connection
-    if (socket_flag)
+    open_endpoint(target);
+    if (target.listener())
     {
-        if (srv_flag)
+        if (!quiet_flag)
+            fprintf(stderr, "\r\n%s wating for connection, use Cntrl/%c to exit\r\n", target.name(), exitChr+0x40);
+        for (;;)
         {
-            int        one=1;
-            const int  name_l = sizeof(((struct hostent*)0)->h_name) + 1;
-            char       name[name_l];
-            name[name_l-1] = 0;
-
-            char *p = strchr(TargetCon, ':');
-            if (!p)
+            fd_set  rds;
+            int     lsn = target.listen_fd();
+            bool    pty = target.type() == Endpoint::PTY;
+            timeval tv = { 0, 10000 };    // pty is polled for its user
+
+            FD_ZERO(&rds);
+            if (!pty)
+                FD_SET(lsn, &rds);
+            if (tty2 >= 0)
+                FD_SET(tty2, &rds);
+            if (select((lsn > tty2 ? lsn : tty2) + 1, &rds, 0, 0, pty ? &tv : 0) < 0)
+                PERR("select failure: %s\n", strerror(errno));
+            if (pty ? target.pending() : FD_ISSET(lsn, &rds))
             {
-                /*
-                 * UNIX socket server
-                 */
-
-                struct sockaddr_un  serv_addr;
-                int                 servlen;
-                const int           addr_l = sizeof(((struct sockaddr_un*)0)->sun_path) + 1;
-                char                addr[addr_l];
-                addr[addr_l-1] = 0;
-
-                // Open a TCP socket (an Internet stream socket).
-                if ((tty1 = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
-                    PERR("socket (AF_UNIX): %s", strerror(errno));
-
-                // Reuse address
-                if (setsockopt(tty1, SOL_SOCKET, SO_REUSEADDR, (char *) &one, sizeof(one)) < 0)
-                    PERR("setsockopt (SO_REUSEADDR): %s", strerror(errno));
-
-                // Bind our local address so that the client can send to us.
-                memset((char *) &serv_addr, 0, sizeof(serv_addr));
-                serv_addr.sun_family = AF_UNIX;
-                strncpy(serv_addr.sun_path, TargetCon, sizeof(serv_addr.sun_path)-1);
-                servlen = strlen(serv_addr.sun_path) + sizeof(serv_addr.sun_family);
-                unlink(serv_addr.sun_path);
-                if (bind(tty1, (struct sockaddr *)&serv_addr, servlen) < 0)
-                    PERR("bind: %s", strerror(errno));
-
-                // Get ready to accept connection
-                if (listen(tty1, 1) < 0)
-                    PERR("listen: %s", strerror(errno));
-
-                tty1_name = (char *)malloc(strlen(TargetCon) + 16);
-                snprintf(tty1_name, 32, "Unix domain server %s", TargetCon);
+                if (!target.accept())
+                    PERR("%s: %s\n", target.what(), strerror(errno));
                 if (!quiet_flag)
-                    fprintf(stderr, "\r\n%s wating for connection, use Cntrl/%c to exit\r\n", tty1_name, exitChr+0x40);
-                for (;;)
-                {
-                    fd_set  rds;
-
-                    FD_ZERO(&rds);
-                    FD_SET(tty1, &rds);
-                    FD_SET(tty2, &rds);
-                    if (select((tty1 > tty2 ? tty1 : tty2) + 1, &rds, 0, 0, 0) < 0)
-                        PERR("select failure: %s\n", strerror(errno));
-                    if (FD_ISSET(tty1, &rds))
-                    {
-                        struct sockaddr_un  cli_unix_addr;
-                        int                 clilen = sizeof(cli_unix_addr);
-
-                        cli_unix_addr.sun_path[0] = 0;
-                        int new_sock = accept(tty1, (struct sockaddr *)&cli_unix_addr, (socklen_t *)&clilen);
-                        if (new_sock < 0)
-                            PERR("accept: %s", strerror(errno));
-
-                        if (strlen(cli_unix_addr.sun_path))
-                            strncpy(addr, cli_unix_addr.sun_path, addr_l-1);
-                        else
-                            strcpy(addr, "unkonown client");
-
-                        if (!quiet_flag)
-                            fprintf(stderr, "Connection accepted from %s, use Cntrl/%c to exit\r\n", addr, exitChr+0x40);
-                        con_core(new_sock, tty1_name, tty2, tty2_name, filter_colors);
-                        close(new_sock);
-                        if (!quiet_flag)
-                            fprintf(stderr, "\r\n\r\n%s wating for connection, use Cntrl/%c to exit\r\n", tty1_name, exitChr+0x40);
-                    }
-                    if (FD_ISSET(tty2, &rds))
-                    {
-                        unsigned char ch;
-                        int buf_cnt = read(tty2, &ch, 1);
-                        if (buf_cnt < 0)
-                            PERR("\r\n\"%s\" read error: %s\n", tty2_name, strerror(errno));
-                        if (buf_cnt == 0)
-                            PERR("\r\n\"%s\" EOF\n", tty2_name);
-                        if (ch == exitChr)
-                            finish(0);
-                    }
-                }
-            }
-            else
-            {
-                /*
-                 * TCP socket server
-                 */
-                char      *end;
-
-                TargetCon = p + 1;
-                int port = (int)strtol(TargetCon, &end, 0);
-                if (*end)
-                    PERR("Invalid port value: \"%s\" -- ?\n", end);
-
-                struct sockaddr_in  serv_addr;
-                struct hostent      *hent;
-
-                // Open a TCP socket (an Internet stream socket).
-                if ((tty1 = socket(AF_INET, SOCK_STREAM, 0)) < 0)
-                    PERR("socket (AF_INET): %s", strerror(errno));
-
-                // Reuse address
-                if (setsockopt(tty1, SOL_SOCKET, SO_REUSEADDR, (char *) &one, sizeof(one)) < 0)
-                    PERR("setsockopt (SO_REUSEADDR): %s", strerror(errno));
-
-                // Bind our local address so that the client can send to us.
-                memset((char *) &serv_addr, 0, sizeof(serv_addr));
-                serv_addr.sin_family      = AF_INET;
-                serv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-                serv_addr.sin_port        = htons(port);
-                if (bind(tty1, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
-                    PERR("bind: %s", strerror(errno));
-
-                // Get ready to accept connection
-                if (listen(tty1, 1) < 0)
-                    PERR("listen: %s", strerror(errno));
-
-                tty1_name = (char*)malloc(32);
-                snprintf(tty1_name, 32, "TCP server :%d", port);
+                    fprintf(stderr, "Connection accepted from %s, use Cntrl/%c to exit\r\n", target.peer(), exitChr+0x40);
+                bool ok = con_core(target.fd(), target.name(), term_in, term_out, tty2_name, filter_colors, target.dgram(), 0);
+                target.disconnect();
+                if (pipe_flag)
+                    finish(ok ? 0 : 1);   // stdin is consumed by this connection
                 if (!quiet_flag)
-                    fprintf(stderr, "\r\n%s wating for connection, use Cntrl/%c to exit\r\n", tty1_name, exitChr+0x40);
-                for (;;)
-                {
-                    fd_set  rds;
-
-                    FD_ZERO(&rds);
-                    FD_SET(tty1, &rds);
-                    FD_SET(tty2, &rds);
-                    if (select((tty1 > tty2 ? tty1 : tty2) + 1, &rds, 0, 0, 0) < 0)
-                        PERR("select failure: %s\n", strerror(errno));
-                    if (FD_ISSET(tty1, &rds))
-                    {
-                        struct sockaddr_in  cli_inet_addr;
-                        int                 clilen = sizeof(cli_inet_addr);
-                        const int           addr_l = 16;  // Max inet_ntoa()
-                        char                addr[addr_l];
-                        addr[addr_l-1] = 0;
-
-                        int new_sock = accept(tty1, (struct sockaddr *)&cli_inet_addr, (socklen_t *)&clilen);
-                        if (new_sock < 0)
-                            PERR("accept: %s", strerror(errno));
-
-                        // Determine the client host name
-                        hent = gethostbyaddr((char *)&cli_inet_addr.sin_addr,
-                                             sizeof(cli_inet_addr.sin_addr), AF_INET);
-                        if (hent)
-                            strncpy(name, hent->h_name, name_l-1);
-                        else
-                            strncpy(name, "???", name_l-1);
-
-                        strncpy(addr, inet_ntoa(cli_inet_addr.sin_addr), addr_l-1);
-                        if (!quiet_flag)
-                            fprintf(stderr,"Connection accepted from %s (%s), use Cntrl/%c to exit\r\n", name, addr, exitChr+0x40);
-                        con_core(new_sock, tty1_name, tty2, tty2_name, filter_colors);
-                        close(new_sock);
-                        if (!quiet_flag)
-                            fprintf(stderr, "\r\n\r\n%s wating for connection, use Cntrl/%c to exit\r\n", tty1_name, exitChr+0x40);
-                    }
-                    if (FD_ISSET(tty2, &rds))
-                    {
-                        unsigned char ch;
-                        int buf_cnt = read(tty2, &ch, 1);
-                        if (buf_cnt < 0)
-                            PERR("\r\n\"%s\" read error: %s\n", tty2_name, strerror(errno));
-                        if (buf_cnt == 0)
-                            PERR("\r\n\"%s\" EOF\n", tty2_name);
-                        if (ch == exitChr)
-                            finish(0);
-                    }
-                }
-            }
-        }
-        else if (cli_flag)
-        {
-            char *p = strchr(TargetCon, ':');
-            if (!p)
-            {
-                /*
-                 * UNIX local socket client
-                 */
-
-                struct sockaddr_un  serv_addr;
-                int                 servlen;
-
-                // Fill the "serv_addr" structure
-                memset((char *) &serv_addr, 0, sizeof(serv_addr));
-                serv_addr.sun_family      = AF_UNIX;
-                strncpy(serv_addr.sun_path, TargetCon, sizeof(serv_addr.sun_path)-1);
-                servlen = strlen(serv_addr.sun_path) + sizeof(serv_addr.sun_family);
-
-                // Open a UNIX socket
-                if ( (tty1 = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
-                    PERR("socket (AF_UNIX): %s", strerror(errno));
-                tty1_name = strdup(TargetCon);
-
-                // Connect to the server.
-                if (connect(tty1, (struct sockaddr *) &serv_addr, servlen) < 0)
-                    PERR("connect: %s", strerror(errno));
-
+                    fprintf(stderr, "\r\n\r\n%s wating for connection, use Cntrl/%c to exit\r\n", target.name(), exitChr+0x40);
             }
-            else
+            if (tty2 >= 0  &&  FD_ISSET(tty2, &rds))
             {
-                /*
-                 * TCP socket client
-                 */
-
-                *p = '\0';
-                char *end;
-                int port = (int)strtol(p+1, &end, 0);
-                if (*end)
-                    PERR("Invalid port value: \"%s\" -- ?\n", end);
-                struct sockaddr_in  serv_addr;
-                struct hostent      *hent;
-
-                // Try to determinate server IP address
-                if ((hent = gethostbyname(TargetCon)) == NULL)
-                    PERR("gethostbyname(%s): %s\n", TargetCon, hstrerror(h_errno));
-
-                // Fill the "serv_addr" structure
-                memset((char *) &serv_addr, 0, sizeof(serv_addr));
-                serv_addr.sin_family      = AF_INET;
-                memcpy(&serv_addr.sin_addr, (*(hent->h_addr_list)), sizeof(struct in_addr));
-                serv_addr.sin_port        = htons(port);
-
-                // Open a TCP socket (an Internet stream socket).
-                if ( (tty1 = socket(AF_INET, SOCK_STREAM, 0)) < 0)
-                    PERR("socket (AF_INET): %s", strerror(errno));
-
-                // Connect to the server.
-                if (connect(tty1, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0)
-                    PERR("connect: %s", strerror(errno));
-
-                tty1_name = (char*)malloc(strlen(TargetCon) + 32);
-                snprintf(tty1_name, strlen(TargetCon) + 32, "%s:%d", TargetCon, port);
+                unsigned char ch;
+                int buf_cnt = read(tty2, &ch, 1);
+                if (buf_cnt < 0)
+                    PERR("\r\n\"%s\" read error: %s\n", tty2_name, strerror(errno));
+                if (buf_cnt == 0)
+                    PERR("\r\n\"%s\" EOF\n", tty2_name);
+                if (ch == exitChr)
+                    finish(0);
             }
         }
-        else
-            PERR("Internal error #1\n");
-
-    }
-    else if (tty_flag)
-    {
-        tty1_name = strdup(TargetCon);
-        tty1 = tty->open(TargetCon, TargetBaud);
-        if (tty1 < 0)
-            PERR("Can't open tty device %s: %s\n", TargetCon, strerror(errno));
-
-        if (!quiet_flag)
-            fprintf(stderr, "Connected to %s, use Cntrl/%c to exit\r\n", tty1_name, exitChr+0x40);
     }
-    else
-        PERR("Internal error #2\n");
 
-    con_core(tty1, tty1_name, tty2, tty2_name, filter_colors);
-    finish();
+    if (target.type() == Endpoint::TTY  &&  !quiet_flag)
+        fprintf(stderr, "Connected to %s, use Cntrl/%c to exit\r\n", target.name(), exitChr+0x40);
+    finish(con_core(target.fd(), target.name(), term_in, term_out, tty2_name, filter_colors, target.dgram(), 0) ? 0 : 1);
 }
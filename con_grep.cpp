@@ -0,0 +1,697 @@
+/*************************************
+ * Indexed search of con logs
+ *************************************
+ *
+ * The log is mapped and searched by threads, each one a run of blocks,
+ * for a substring (SSE2 scan of its first and last bytes, candidates
+ * are compared) or a regex (lines with the longest literal it requires,
+ * or all of them if it requires none).
+ *
+ * The index is kept next to the log, LOG.cidx: blocks of about 16K cut
+ * at line ends with the number of their first line, starts of "-a"
+ * sessions and, with -g, a bitmap of the trigrams of every block. Only
+ * blocks having all trigrams of the literal are searched then. A log
+ * that grew is indexed from its last block on, it's found by hashes of
+ * the log head and of the end of the part indexed. The index is of the
+ * host byte order, it's not copied to other machines.
+ */
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <regex.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <string>
+#include <vector>
+
+static const size_t BLOCK = 16 * 1024;         // indexed unit, cut at a line end
+static const size_t JOB = 4 * 1024 * 1024;     // run of blocks a thread takes at once
+static const int    GRAM_BITS = 8192;          // trigram bitmap of a block
+static const int    MAXTHREADS = 64;
+static const size_t HASHED = 4096;             // log head and tail hashed to tell a log that grew
+static const char   INDEX_MAGIC[8] = "CONIDX1";
+static const char   SESSION_MARK[] = "*****     New CON session";
+
+// Block or session: offset of its first line and the line number
+struct Mark
+{
+    uint64_t off;
+    uint64_t line;
+};
+
+struct IndexHeader
+{
+    char     magic[8];
+    uint64_t size;          // of the log indexed
+    uint64_t head, tail;    // hashes
+    uint32_t block;
+    uint32_t gram_bits;     // 0 - no trigrams
+    uint64_t blocks;
+    uint64_t sessions;
+};
+
+struct Index
+{
+    IndexHeader          h;
+    std::vector<Mark>    blocks;
+    std::vector<Mark>    sessions;
+    std::vector<uint8_t> grams;      // GRAM_BITS / 8 per block
+};
+
+struct Query
+{
+    std::string lit;       // substring searched, of the regex: required
+    std::string lo, up;    // cases of it compared
+    bool        icase;
+    bool        regex;
+    regex_t     re;
+};
+
+// Part of the log a thread searches, lines matching are collected
+struct Job
+{
+    uint64_t              beg, end;
+    uint64_t              line;      // number of the line at "beg"
+    size_t                block;     // index block of "beg"
+    std::vector<uint64_t> hits;      // line offsets, with line numbers if they are wanted
+    uint64_t              count;
+};
+
+static const char   *log_data;
+static uint64_t     log_size;
+static const Index  *log_index;
+static Query        query;
+static bool         want_lines = false;
+static bool         count_only = false;
+static Job          *jobs;
+static int          njobs;
+static int          next_job = 0;
+static unsigned char fold[256];
+
+static uint64_t hash(const char *p, const size_t n)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i=0; i<n; i++)
+        h = (h ^ (unsigned char)p[i]) * 1099511628211ULL;
+    return h;
+}
+
+static uint64_t head_hash(const uint64_t size)
+{
+    return hash(log_data, size < HASHED ? size : HASHED);
+}
+
+static uint64_t tail_hash(const uint64_t size)
+{
+    uint64_t n = size < HASHED ? size : HASHED;
+    return hash(log_data + size - n, n);
+}
+
+// Bit of the last 3 bytes of "v", folded
+static unsigned gram_hash(const uint32_t v)
+{
+    return (v << 8) * 2654435761U >> 19;    // GRAM_BITS
+}
+
+static unsigned gram(const unsigned char a, const unsigned char b, const unsigned char c)
+{
+    return gram_hash(fold[a] << 16 | fold[b] << 8 | fold[c]);
+}
+
+static uint64_t count_lines(const char *p, const size_t n)
+{
+    uint64_t cnt = 0;
+    size_t   i = 0;
+#ifdef __SSE2__
+    const __m128i nl = _mm_set1_epi8('\n');
+    for (; i + 16 <= n; i += 16)
+        cnt += __builtin_popcount(_mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i)), nl)));
+#endif
+    for (; i < n; i++)
+        cnt += p[i] == '\n';
+    return cnt;
+}
+
+// Index the log from block "from" on
+static void build(Index& x, const size_t from, const bool grams)
+{
+    uint64_t off = 0, line = 0;
+    if (from < x.blocks.size())
+    {
+        off = x.blocks[from].off;
+        line = x.blocks[from].line;
+    }
+    x.blocks.resize(from < x.blocks.size() ? from : x.blocks.size());
+    while (!x.sessions.empty()  &&  x.sessions.back().off >= off)
+        x.sessions.pop_back();
+    x.grams.resize(grams ? x.blocks.size() * (GRAM_BITS / 8) : 0);
+
+    while (off < log_size)
+    {
+        uint64_t end = off + BLOCK < log_size ? off + BLOCK : log_size;
+        const char *nl = (const char *)memchr(log_data + end - 1, '\n', log_size - end + 1);
+        end = nl ? nl - log_data + 1 : log_size;
+
+        Mark b = { off, line };
+        x.blocks.push_back(b);
+        for (const char *p = log_data + off, *e = log_data + end;
+             (p = (const char *)memmem(p, e - p, SESSION_MARK, sizeof(SESSION_MARK) - 1)); p++)
+            if (p == log_data  ||  p[-1] == '\n')
+            {
+                Mark s = { (uint64_t)(p - log_data), line + count_lines(log_data + off, p - log_data - off) };
+                x.sessions.push_back(s);
+            }
+        if (grams)
+        {
+            x.grams.resize(x.blocks.size() * (GRAM_BITS / 8));
+            uint8_t             *bits = &x.grams[x.grams.size() - GRAM_BITS / 8];
+            const unsigned char *p = (const unsigned char *)log_data;
+            uint32_t            v = 0;
+            int                 run = 0;     // bytes since the line end
+            for (uint64_t i = off; i < end; i++)
+            {
+                if (p[i] == '\n')
+                {
+                    run = 0;
+                    continue;
+                }
+                v = v << 8 | fold[p[i]];
+                if (++run >= 3)
+                {
+                    unsigned g = gram_hash(v);
+                    bits[g >> 3] |= 1 << (g & 7);
+                }
+            }
+        }
+        line += count_lines(log_data + off, end - off);
+        off = end;
+    }
+
+    memcpy(x.h.magic, INDEX_MAGIC, sizeof(x.h.magic));
+    x.h.size = log_size;
+    x.h.head = head_hash(log_size);
+    x.h.tail = tail_hash(log_size);
+    x.h.block = BLOCK;
+    x.h.gram_bits = grams ? GRAM_BITS : 0;
+    x.h.blocks = x.blocks.size();
+    x.h.sessions = x.sessions.size();
+}
+
+static bool load(Index& x, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return false;
+    bool ok = fread(&x.h, sizeof(x.h), 1, f) == 1  &&  !memcmp(x.h.magic, INDEX_MAGIC, sizeof(x.h.magic))  &&
+        x.h.block == BLOCK  &&  (x.h.gram_bits == 0  ||  x.h.gram_bits == GRAM_BITS);
+    if (ok)
+    {
+        x.blocks.resize(x.h.blocks);
+        x.sessions.resize(x.h.sessions);
+        x.grams.resize(x.h.gram_bits ? x.h.blocks * (GRAM_BITS / 8) : 0);
+        ok = (x.blocks.empty()  ||  fread(&x.blocks[0], sizeof(Mark), x.blocks.size(), f) == x.blocks.size())  &&
+            (x.sessions.empty()  ||  fread(&x.sessions[0], sizeof(Mark), x.sessions.size(), f) == x.sessions.size())  &&
+            (x.grams.empty()  ||  fread(&x.grams[0], 1, x.grams.size(), f) == x.grams.size());
+    }
+    fclose(f);
+    return ok;
+}
+
+// Written aside and renamed, a reader never sees a part of it
+static bool save(const Index& x, const char *path)
+{
+    std::string tmp = std::string(path) + ".tmp";
+    FILE        *f = fopen(tmp.c_str(), "w");
+    if (!f)
+        return false;
+    bool ok = fwrite(&x.h, sizeof(x.h), 1, f) == 1  &&
+        (x.blocks.empty()  ||  fwrite(&x.blocks[0], sizeof(Mark), x.blocks.size(), f) == x.blocks.size())  &&
+        (x.sessions.empty()  ||  fwrite(&x.sessions[0], sizeof(Mark), x.sessions.size(), f) == x.sessions.size())  &&
+        (x.grams.empty()  ||  fwrite(&x.grams[0], 1, x.grams.size(), f) == x.grams.size());
+    ok = !fclose(f)  &&  ok  &&  !rename(tmp.c_str(), path);
+    if (!ok)
+        unlink(tmp.c_str());
+    return ok;
+}
+
+// Index of the log as it is now, "path" 0 - not kept
+static void update(Index& x, const char *path, const bool grams)
+{
+    bool loaded = path  &&  load(x, path);
+    bool same = loaded  &&  x.h.size <= log_size  &&  x.h.head == head_hash(x.h.size)  &&
+        x.h.tail == tail_hash(x.h.size)  &&  (x.h.gram_bits  ||  !grams);
+    if (same  &&  x.h.size == log_size)
+        return;
+    if (!same)
+    {
+        x.blocks.clear();
+        x.sessions.clear();
+    }
+
+    // The last block may have ended with a partial line, it's indexed again
+    build(x, same  &&  x.blocks.size() ? x.blocks.size() - 1 : 0, grams  ||  (same  &&  x.h.gram_bits));
+    if (path  &&  !save(x, path))
+        fprintf(stderr, "Can't write index \"%s\": %s\n", path, strerror(errno));
+}
+
+static bool equal(const char *p, const size_t from, const size_t to)
+{
+    if (!query.icase)
+        return !memcmp(p + from, query.lit.data() + from, to - from);
+    for (size_t i=from; i<to; i++)
+        if (fold[(unsigned char)p[i]] != (unsigned char)query.lo[i])
+            return false;
+    return true;
+}
+
+/* First place of the literal in [p, p+n), 0 - none. 16 places are tried
+   at once: their bytes compared to the first byte of the literal and the
+   bytes k-1 further to its last one, where both match the rest is
+   compared. */
+static const char *find(const char *p, const size_t n)
+{
+    const size_t k = query.lit.size();
+    if (n < k)
+        return 0;
+    if (k == 1  &&  !query.icase)
+        return (const char *)memchr(p, query.lit[0], n);
+
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i f1 = _mm_set1_epi8(query.lo[0]), f2 = _mm_set1_epi8(query.up[0]);
+    const __m128i l1 = _mm_set1_epi8(query.lo[k-1]), l2 = _mm_set1_epi8(query.up[k-1]);
+    for (; i + k + 15 <= n; i += 16)
+    {
+        __m128i  a = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i  b = _mm_loadu_si128((const __m128i *)(p + i + k - 1));
+        __m128i  fa = _mm_or_si128(_mm_cmpeq_epi8(a, f1), _mm_cmpeq_epi8(a, f2));
+        __m128i  lb = _mm_or_si128(_mm_cmpeq_epi8(b, l1), _mm_cmpeq_epi8(b, l2));
+        unsigned m = _mm_movemask_epi8(_mm_and_si128(fa, lb));
+        for (; m; m &= m - 1)
+        {
+            int j = __builtin_ctz(m);
+            if (k <= 2  ||  equal(p + i + j, 1, k - 1))
+                return p + i + j;
+        }
+    }
+#endif
+    for (; i + k <= n; i++)
+        if (equal(p + i, 0, k))
+            return p + i;
+    return 0;
+}
+
+// Collect the lines of the job matching
+static void search(Job& j)
+{
+    const char *base = log_data + j.beg;
+    const char *end = log_data + j.end;
+    const char *pos = base;
+    const char *counted = base;
+    uint64_t   line = j.line;
+    size_t     b = j.block;
+
+    while (pos < end)
+    {
+        const char *ls, *le, *hit;
+        if (query.lit.empty())
+        {
+            // Regex with no literal: the whole rest, the job is far below 2G
+            regmatch_t m;
+            m.rm_so = pos - base;
+            m.rm_eo = end - base;
+            if (regexec(&query.re, base, 1, &m, REG_STARTEND))
+                break;
+            hit = base + m.rm_so;
+        }
+        else if (!(hit = find(pos, end - pos)))
+            break;
+
+        ls = (const char *)memrchr(pos, '\n', hit - pos);
+        ls = ls ? ls + 1 : pos;
+        le = (const char *)memchr(hit, '\n', end - hit);
+        le = le ? le : end;
+        if (query.regex  &&  !query.lit.empty())
+        {
+            regmatch_t m;
+            m.rm_so = ls - base;
+            m.rm_eo = le - base;
+            if (regexec(&query.re, base, 1, &m, REG_STARTEND))
+            {
+                pos = le + 1;
+                continue;
+            }
+        }
+
+        j.count++;
+        if (!count_only)
+        {
+            if (want_lines)
+            {
+                // Lines are counted from the block of the hit
+                const std::vector<Mark>& bs = log_index->blocks;
+                while (b + 1 < bs.size()  &&  log_data + bs[b+1].off <= ls)
+                    b++;
+                if (log_data + bs[b].off > counted)
+                {
+                    counted = log_data + bs[b].off;
+                    line = bs[b].line;
+                }
+                line += count_lines(counted, ls - counted);
+                counted = ls;
+                j.hits.push_back(line);
+            }
+            j.hits.push_back(ls - log_data);
+        }
+        pos = le + 1;
+    }
+}
+
+static void *worker(void *)
+{
+    for (int i; (i = __sync_fetch_and_add(&next_job, 1)) < njobs; )
+        search(jobs[i]);
+    return 0;
+}
+
+// Longest literal an extended regex requires, "" if it's not known
+static std::string required(const char *re)
+{
+    std::string best, cur;
+    int         depth = 0;
+
+    if (strchr(re, '|'))
+        return best;
+    for (const char *p = re; *p; p++)
+    {
+        char c = *p;
+        if (c == '\\'  &&  p[1])
+        {
+            c = *++p;
+            if (!ispunct((unsigned char)c))
+                c = 0;
+        }
+        else if (c == '[')
+        {
+            // Bracket: up to "]" which is not the first one in it
+            const char *q = p + 1;
+            if (*q == '^')
+                q++;
+            if (*q == ']')
+                q++;
+            while (*q  &&  *q != ']')
+                q++;
+            p = *q ? q : q - 1;
+            c = 0;
+        }
+        else if (c == '*'  ||  c == '?'  ||  c == '{')
+        {
+            // The atom before is optional
+            if (!cur.empty())
+                cur.resize(cur.size() - 1);
+            if (c == '{')
+                while (p[1]  &&  *p != '}')
+                    p++;
+            c = 0;
+        }
+        else if (c == '(')
+        {
+            depth++;
+            c = 0;
+        }
+        else if (c == ')')
+        {
+            depth--;
+            c = 0;
+        }
+        else if (strchr(".^$+", c))
+            c = 0;
+
+        if (c  &&  !depth)
+            cur += c;
+        else
+        {
+            // "+" keeps the atom before, nothing after it is joined to it
+            if (cur.size() > best.size())
+                best = cur;
+            cur.clear();
+        }
+    }
+    if (cur.size() > best.size())
+        best = cur;
+    return best;
+}
+
+static void list_sessions(const Index& x)
+{
+    if (x.sessions.empty()  ||  x.sessions[0].off)
+        printf("%5d  line %-10d  start of the log\n", 0, 1);
+    for (size_t i=0; i<x.sessions.size(); i++)
+    {
+        const char *p = log_data + x.sessions[i].off + sizeof(SESSION_MARK) - 1;
+        const char *e = (const char *)memchr(p, '\n', log_data + log_size - p);
+        int         n = e ? e - p : log_data + log_size - p;
+        // ", started at ...     *****"
+        while (n  &&  (p[n-1] == '*'  ||  p[n-1] == ' '))
+            n--;
+        if (n > 2  &&  p[0] == ',')
+            p += 2, n -= 2;
+        printf("%5zu  line %-10llu  %.*s\n", i + 1, (unsigned long long)x.sessions[i].line + 1, n, p);
+    }
+}
+
+void usage(const char *s)
+{
+    fprintf(stderr, "Usage:\n\t%s [switches] PATTERN LOG\n\n", s);
+    fprintf(stderr, "Print lines of a con log with PATTERN, a substring or, with -E, an\n");
+    fprintf(stderr, "extended regex. The log is indexed to LOG.cidx at the first search and\n");
+    fprintf(stderr, "when it grows, the index is used by the next ones.\n\n");
+    fprintf(stderr, "\t-h[elp]             - Print help message.\n");
+    fprintf(stderr, "\t-E                  - PATTERN is an extended regex.\n");
+    fprintf(stderr, "\t-i                  - Ignore case (ASCII).\n");
+    fprintf(stderr, "\t-n                  - Prefix lines with their numbers.\n");
+    fprintf(stderr, "\t-c                  - Print the number of lines only.\n");
+    fprintf(stderr, "\t-s N                - Search session N only, the one started by the Nth\n");
+    fprintf(stderr, "\t                      \"New CON session\" header of \"-a\", 0 - before the\n");
+    fprintf(stderr, "\t                      first one, -1 - the last one.\n");
+    fprintf(stderr, "\t-S                  - List the sessions of LOG, no PATTERN then.\n");
+    fprintf(stderr, "\t-g                  - Index trigrams too, only the blocks that may have\n");
+    fprintf(stderr, "\t                      the literal of PATTERN are searched then. It costs\n");
+    fprintf(stderr, "\t                      6%% of the log size, the index keeps them.\n");
+    fprintf(stderr, "\t-x                  - Don't read or write the index file.\n");
+    fprintf(stderr, "\t-j N                - Search by N threads, default - one per CPU.\n");
+    fprintf(stderr, "\nExit status: 0 - lines found, 1 - none, 2 - error.\n");
+    exit (2);
+}
+
+int main(int ac, char *av[])
+{
+    const char *pattern = 0, *log_name = 0;
+    bool       list = false, grams = false, keep = true;
+    int        session = -2;
+    long       threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    query.icase = query.regex = false;
+    for (int i=1; i<ac; i++)
+    {
+        if (!strcmp(av[i], "-h")  ||  !strcmp(av[i], "-help")  ||  !strcmp(av[i], "-?"))
+            usage(av[0]);
+        if (!strcmp(av[i], "-s")  ||  !strcmp(av[i], "-j"))
+        {
+            if (++i >= ac)
+            {
+                fprintf(stderr, "After switch \"%s\" a number is expected.\n", av[--i]);
+                fprintf(stderr, "\nType \"%s -h\" for help.\n", av[0]);
+                return 2;
+            }
+            if (av[i-1][1] == 's')
+                session = atoi(av[i]);
+            else
+                threads = atoi(av[i]);
+            continue;
+        }
+        if (av[i][0] == '-'  &&  av[i][1]  &&  !av[i][2]  &&  strchr("EincSgx", av[i][1]))
+        {
+            switch (av[i][1])
+            {
+            case 'E':  query.regex = true;   break;
+            case 'i':  query.icase = true;   break;
+            case 'n':  want_lines = true;    break;
+            case 'c':  count_only = true;    break;
+            case 'S':  list = true;          break;
+            case 'g':  grams = true;         break;
+            case 'x':  keep = false;         break;
+            }
+            continue;
+        }
+        if (av[i][0] == '-'  &&  av[i][1])
+        {
+            fprintf(stderr, "Invalid switch \"%s\".\n", av[i]);
+            fprintf(stderr, "Type \"%s -h\" for help.\n", av[0]);
+            return 2;
+        }
+        if (!pattern  &&  !list)
+            pattern = av[i];
+        else if (!log_name)
+            log_name = av[i];
+        else
+            usage(av[0]);
+    }
+    if (!log_name)
+        usage(av[0]);
+    if (threads < 1)
+        threads = 1;
+    if (threads > MAXTHREADS)
+        threads = MAXTHREADS;
+
+    for (int c=0; c<256; c++)
+        fold[c] = c >= 'A'  &&  c <= 'Z' ? c + 'a' - 'A' : c;
+    if (pattern)
+    {
+        // Every line has the empty string
+        if (!*pattern)
+        {
+            pattern = "^";
+            query.regex = true;
+        }
+        query.lit = query.regex ? required(pattern) : pattern;
+        query.lo = query.up = query.lit;
+        if (query.icase)
+            for (size_t i=0; i<query.lit.size(); i++)
+            {
+                query.lo[i] = fold[(unsigned char)query.lit[i]];
+                query.up[i] = query.lo[i] >= 'a'  &&  query.lo[i] <= 'z' ? query.lo[i] - 'a' + 'A' : query.lo[i];
+            }
+        int rc;
+        if (query.regex  &&  (rc = regcomp(&query.re, pattern, REG_EXTENDED | REG_NEWLINE |
+                                           (query.icase ? REG_ICASE : 0) | (query.lit.empty() ? 0 : REG_NOSUB))))
+        {
+            char msg[256];
+            regerror(rc, &query.re, msg, sizeof(msg));
+            fprintf(stderr, "Invalid regex \"%s\": %s\n", pattern, msg);
+            return 2;
+        }
+    }
+
+    int         fd = open(log_name, O_RDONLY);
+    struct stat st;
+    if (fd < 0  ||  fstat(fd, &st) < 0)
+    {
+        fprintf(stderr, "Can't open \"%s\": %s\n", log_name, strerror(errno));
+        return 2;
+    }
+    log_size = st.st_size;
+    log_data = "";
+    if (log_size  &&  (log_data = (const char *)mmap(0, log_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+    {
+        fprintf(stderr, "Can't map \"%s\": %s\n", log_name, strerror(errno));
+        return 2;
+    }
+
+    Index       x;
+    std::string path = std::string(log_name) + ".cidx";
+    update(x, keep ? path.c_str() : 0, grams);
+    log_index = &x;
+    if (list)
+    {
+        list_sessions(x);
+        return 0;
+    }
+
+    // Part searched
+    const int n = x.sessions.size();
+    uint64_t  beg = 0, end = log_size, line = 0;
+    if (session == -1)
+        session = n;
+    if (session != -2)
+    {
+        if (session < 0  ||  session > n)
+        {
+            fprintf(stderr, "No session %d in \"%s\", it has %d.\n", session, log_name, n);
+            return 2;
+        }
+        if (session)
+        {
+            beg = x.sessions[session-1].off;
+            line = x.sessions[session-1].line;
+        }
+        if (session < n)
+            end = x.sessions[session].off;
+    }
+
+    // Trigrams of the literal, blocks missing any of them are skipped
+    std::vector<unsigned> need;
+    if (x.h.gram_bits  &&  query.lit.size() >= 3)
+        for (size_t i=0; i+2<query.lit.size(); i++)
+            need.push_back(gram(query.lit[i], query.lit[i+1], query.lit[i+2]));
+
+    std::vector<Job> js;
+    for (size_t b=0; pattern  &&  b<x.blocks.size(); b++)
+    {
+        uint64_t bb = x.blocks[b].off;
+        uint64_t be = b + 1 < x.blocks.size() ? x.blocks[b+1].off : log_size;
+        if (be <= beg  ||  bb >= end)
+            continue;
+        const uint8_t *bits = need.empty() ? 0 : &x.grams[b * (GRAM_BITS / 8)];
+        size_t        k = 0;
+        while (k < need.size()  &&  bits[need[k] >> 3] & 1 << (need[k] & 7))
+            k++;
+        if (k < need.size())
+            continue;
+
+        bb = bb > beg ? bb : beg;
+        be = be < end ? be : end;
+        if (js.empty()  ||  js.back().end != bb  ||  js.back().end - js.back().beg >= JOB)
+        {
+            Job j;
+            j.beg = j.end = bb;
+            j.line = bb == beg ? line : x.blocks[b].line;
+            j.block = b;
+            j.count = 0;
+            js.push_back(j);
+        }
+        js.back().end = be;
+    }
+
+    jobs = js.empty() ? 0 : &js[0];
+    njobs = js.size();
+    pthread_t tid[MAXTHREADS];
+    int       started = 0;
+    while (started < threads - 1  &&  started < njobs - 1  &&  !pthread_create(&tid[started], 0, worker, 0))
+        started++;
+    worker(0);
+    for (int i=0; i<started; i++)
+        pthread_join(tid[i], 0);
+
+    // Lines in the log order
+    uint64_t total = 0;
+    setvbuf(stdout, 0, _IOFBF, 1024 * 1024);
+    for (size_t i=0; i<js.size(); i++)
+    {
+        const std::vector<uint64_t>& h = js[i].hits;
+        total += js[i].count;
+        for (size_t k=0; k<h.size(); k++)
+        {
+            if (want_lines)
+                printf("%llu:", (unsigned long long)h[k++] + 1);
+            const char *p = log_data + h[k];
+            const char *e = (const char *)memchr(p, '\n', log_data + log_size - p);
+            fwrite_unlocked(p, (e ? e : log_data + log_size) - p, 1, stdout);
+            putc_unlocked('\n', stdout);
+        }
+    }
+    if (count_only)
+        printf("%llu\n", (unsigned long long)total);
+    return total ? 0 : 1;
+}
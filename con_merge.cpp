@@ -0,0 +1,518 @@
+/*************************************
+ * Merge con logs and consoles by time
+ *************************************
+ *
+ * Sources are con logs with wall clock stamps ("-T wall"), con captures
+ * ("-capture") and live endpoints. Every line goes out once, stamped and
+ * tagged with its source, in the order of time: a k-way merge over a
+ * heap of the sources keyed by the time of their next line. Only a
+ * buffer of lines per source is kept, any size of input streams through.
+ *
+ * Lines of live sources are stamped when they arrive, they go out as
+ * soon as no file line is older. Lines of a log with no stamp (headers
+ * of "-a" sessions) take the time of the line before, at the beginning
+ * of the log - of the first stamp.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "endpoint.h"
+#include "tstamp.h"
+#include "tty.h"
+
+static const size_t BUFSIZE = 256 * 1024;   // per source, the longest line too
+static const int    MAXSRC = 256;
+static const size_t MAXTAG = 64;
+static const char   CAPTURE_MAGIC[] = "# con capture, session started ";
+
+struct Line
+{
+    int64_t ts;      // us since the epoch
+    size_t  off;     // in the source buffer
+    size_t  len;
+};
+
+struct Source
+{
+    std::string       tag;
+    std::string       label;       // tag as printed, padded, with the separator
+    std::string       spec;
+    int               fd;          // file
+    Endpoint          *ep;         // live source
+    bool              capture;
+    bool              eof;
+    bool              done;
+    std::vector<char> buf;
+    size_t            beg, end;    // data not cut to lines yet
+    std::deque<Line>  lines;       // in the buffer, it's not refilled until they go
+    int64_t           last;        // time of the previous line
+    int64_t           base;        // capture session start
+    int64_t           start;       // live: arrival of the line being received
+};
+
+static Tstamp      stamp;
+static FILE        *out = stdout;
+static int         tag_width = 0;
+
+static int64_t now_us()
+{
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static bool digits(const char *p, const int n)
+{
+    for (int i=0; i<n; i++)
+        if (p[i] < '0'  ||  p[i] > '9')
+            return false;
+    return true;
+}
+
+static int num(const char *p, const int n)
+{
+    int v = 0;
+    for (int i=0; i<n; i++)
+        v = v * 10 + p[i] - '0';
+    return v;
+}
+
+// "YYYY-MM-DD HH:MM:SS.uuuuuu" local time to us since the epoch, -1 if
+// it's not one. mktime() is called once per second of the stamps
+static int64_t parse_wall(const char *p, const size_t len)
+{
+    static char   cached[19];
+    static time_t cached_sec = -1;
+
+    if (len < 26  ||  p[4] != '-'  ||  p[7] != '-'  ||  p[10] != ' '  ||  p[13] != ':'  ||
+        p[16] != ':'  ||  p[19] != '.'  ||  !digits(p, 4)  ||  !digits(p + 5, 2)  ||
+        !digits(p + 8, 2)  ||  !digits(p + 11, 2)  ||  !digits(p + 14, 2)  ||
+        !digits(p + 17, 2)  ||  !digits(p + 20, 6))
+        return -1;
+    if (cached_sec < 0  ||  memcmp(cached, p, sizeof(cached)))
+    {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        tm.tm_year = num(p, 4) - 1900;
+        tm.tm_mon = num(p + 5, 2) - 1;
+        tm.tm_mday = num(p + 8, 2);
+        tm.tm_hour = num(p + 11, 2);
+        tm.tm_min = num(p + 14, 2);
+        tm.tm_sec = num(p + 17, 2);
+        tm.tm_isdst = -1;
+        if ((cached_sec = mktime(&tm)) < 0)
+            return -1;
+        memcpy(cached, p, sizeof(cached));
+    }
+    return cached_sec * 1000000LL + num(p + 20, 6);
+}
+
+// Time of a line, -1 - it has none
+static int64_t line_time(Source& s, const char *p, const size_t len)
+{
+    if (!s.capture)
+        return len > 28  &&  p[0] == '['  &&  p[27] == ']' ? parse_wall(p + 1, len - 1) : -1;
+
+    // Capture: a header starts a session, a record has the time since
+    // it, lines of a record after the first one have no time
+    const size_t n = sizeof(CAPTURE_MAGIC) - 1;
+    if (len > n  &&  !memcmp(p, CAPTURE_MAGIC, n))
+    {
+        int64_t t = parse_wall(p + n, len - n);
+        if (t >= 0)
+            s.base = t;
+        return -1;
+    }
+    size_t i = 0;
+    while (i < len  &&  p[i] == ' ')
+        i++;
+    if (i >= 13  ||  i == len  ||  p[i] < '0'  ||  p[i] > '9')
+        return -1;
+    int64_t sec = 0, us = 0;
+    for (; i < len  &&  p[i] >= '0'  &&  p[i] <= '9'; i++)
+        sec = sec * 10 + p[i] - '0';
+    if (i + 7 > len  ||  p[i] != '.'  ||  !digits(p + i + 1, 6))
+        return -1;
+    us = num(p + i + 1, 6);
+    return s.base + sec * 1000000 + us;
+}
+
+// Cut the buffered data to lines, "ts" is the time of live data read
+// now. At EOF the rest is a line too
+static void cut(Source& s, const int64_t ts)
+{
+    const char *b = &s.buf[0];
+
+    while (s.beg < s.end)
+    {
+        const char *nl = (const char *)memchr(b + s.beg, '\n', s.end - s.beg);
+        size_t      len;
+        if (nl)
+            len = nl - (b + s.beg);
+        else if (s.eof  ||  (s.beg == 0  &&  s.end == s.buf.size()))
+            len = s.end - s.beg;       // the last one, or too long
+        else
+            break;
+
+        Line l;
+        l.off = s.beg;
+        l.len = len;
+        s.beg += nl ? len + 1 : len;
+        if (l.len  &&  b[l.off + l.len - 1] == '\r')
+            l.len--;
+
+        if (s.ep)
+        {
+            l.ts = s.start;
+            s.start = ts;
+        }
+        else
+        {
+            l.ts = line_time(s, b + l.off, l.len);
+            // Capture comments are not data
+            if (s.capture  &&  l.len  &&  b[l.off] == '#')
+                continue;
+            // Log stamp is replaced by the one of the output
+            if (!s.capture  &&  l.ts >= 0)
+            {
+                size_t n = l.len > 28  &&  b[l.off + 28] == ' ' ? 29 : 28;
+                l.off += n;
+                l.len -= n;
+            }
+            // Lines before the first stamp take its time
+            if (l.ts >= 0  &&  s.last < 0)
+                for (size_t i=0; i<s.lines.size(); i++)
+                    s.lines[i].ts = l.ts;
+            if (l.ts < 0)
+                l.ts = s.last;
+        }
+        s.last = l.ts;
+        s.lines.push_back(l);
+    }
+}
+
+// Keep the partial line, make room for more data
+static void compact(Source& s)
+{
+    if (s.beg)
+    {
+        memmove(&s.buf[0], &s.buf[s.beg], s.end - s.beg);
+        s.end -= s.beg;
+        s.beg = 0;
+    }
+}
+
+// Read the next lines of a file
+static void refill(Source& s)
+{
+    while (s.lines.empty()  &&  !s.eof)
+    {
+        compact(s);
+        ssize_t n = read(s.fd, &s.buf[s.end], s.buf.size() - s.end);
+        if (n < 0  &&  errno == EINTR)
+            continue;
+        if (n < 0)
+            fprintf(stderr, "\"%s\" read error: %s\n", s.spec.c_str(), strerror(errno));
+        if (n <= 0)
+            s.eof = true;
+        else
+        {
+            if (!s.end  &&  s.last < 0)
+                s.capture = n >= (ssize_t)sizeof(CAPTURE_MAGIC) - 1  &&
+                    !memcmp(&s.buf[0], CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC) - 1);
+            s.end += n;
+        }
+        cut(s, 0);
+    }
+    if (s.lines.empty())
+        s.done = true;
+    for (size_t i=0; i<s.lines.size()  &&  s.lines[i].ts < 0; i++)
+        s.lines[i].ts = 0;
+}
+
+// Read what a live source has
+static void receive(Source& s)
+{
+    Endpoint& ep = *s.ep;
+
+    if (!ep.connected())
+    {
+        if (!ep.accept())
+        {
+            fprintf(stderr, "\"%s\" %s: %s\n", s.spec.c_str(), ep.what(), strerror(errno));
+            s.done = true;
+        }
+        else
+            fprintf(stderr, "%s: connection accepted from %s\n", ep.name(), ep.peer());
+        return;
+    }
+
+    compact(s);
+    Dgram   *d = ep.dgram();
+    int64_t ts = now_us();
+    int     n = d ? d->read(&s.buf[s.end], s.buf.size() - s.end) :
+        read(ep.fd(), &s.buf[s.end], s.buf.size() - s.end);
+    if (n < 0  &&  (errno == EINTR  ||  errno == EAGAIN))
+        return;
+    if (n <= 0)
+    {
+        if (n < 0)
+            fprintf(stderr, "\"%s\" read error: %s\n", s.spec.c_str(), strerror(errno));
+        s.eof = true;
+    }
+    if (s.beg == s.end)
+        s.start = ts;
+    if (n > 0)
+        s.end += n;
+    cut(s, ts);
+
+    // Listening source waits for the next connection
+    if (s.eof)
+    {
+        s.beg = s.end = 0;
+        s.eof = false;
+        if (ep.listener())
+            ep.disconnect();
+        else
+            s.done = true;
+    }
+}
+
+static void emit(Source& s, const Line& l)
+{
+    char     pfx[Tstamp::MAXLEN + MAXTAG + 4];
+    timespec ts;
+
+    ts.tv_sec = l.ts / 1000000;
+    ts.tv_nsec = l.ts % 1000000 * 1000;
+    int n = stamp.format(ts, pfx);
+    memcpy(pfx + n, s.label.data(), s.label.size());
+    fwrite_unlocked(pfx, n + s.label.size(), 1, out);
+    fwrite_unlocked(&s.buf[l.off], l.len, 1, out);
+    putc_unlocked('\n', out);
+}
+
+// Heap of sources with lines, the oldest line on top
+struct Older
+{
+    const std::vector<Source>& src;
+    bool operator()(const int a, const int b) const
+    {
+        const Line& x = src[a].lines.front();
+        const Line& y = src[b].lines.front();
+        return x.ts != y.ts ? x.ts > y.ts : a > b;
+    }
+};
+
+void usage(const char *s)
+{
+    fprintf(stderr, "Usage:\n\t%s [switches] [TAG=]SOURCE...\n\n", s);
+    fprintf(stderr, "Merge con logs, captures and consoles to one stream ordered by time.\n");
+    fprintf(stderr, "Every line is prefixed with its time and TAG (file or endpoint name\n");
+    fprintf(stderr, "by default). SOURCE is a con log written with \"-T wall\", a con capture\n");
+    fprintf(stderr, "or an endpoint: \"tty:DEVICE[,BAUD]\", \"tcp:HOST:PORT\", \"unix:PATH\",\n");
+    fprintf(stderr, "\"tcp-listen:PORT\", \"udp-listen:[ADDR:]PORT\" etc, see con -h. Lines of\n");
+    fprintf(stderr, "endpoints are stamped when they arrive.\n\n");
+    fprintf(stderr, "\t-h[elp]             - Print help message.\n");
+    fprintf(stderr, "\t-o FILE             - Write to FILE instead of stdout.\n");
+    exit (1);
+}
+
+int main(int ac, char *av[])
+{
+    std::vector<Source> src;
+    const char          *out_name = 0;
+
+    for (int i=1; i<ac; i++)
+    {
+        if (!strcmp(av[i], "-h")  ||  !strcmp(av[i], "-help")  ||  !strcmp(av[i], "-?"))
+            usage(av[0]);
+        if (!strcmp(av[i], "-o"))
+        {
+            if (++i >= ac)
+            {
+                fprintf(stderr, "After switch \"%s\" file name is expected.\n", av[--i]);
+                fprintf(stderr, "\nType \"%s -h\" for help.\n", av[0]);
+                return 1;
+            }
+            out_name = av[i];
+            continue;
+        }
+        if (av[i][0] == '-'  &&  av[i][1])
+        {
+            fprintf(stderr, "Invalid switch \"%s\".\n", av[i]);
+            fprintf(stderr, "Type \"%s -h\" for help.\n", av[0]);
+            return 1;
+        }
+
+        Source s;
+        const char *eq = strchr(av[i], '=');
+        const char *colon = strchr(av[i], ':');
+        s.spec = eq  &&  (!colon  ||  eq < colon) ? eq + 1 : av[i];
+        s.tag = eq  &&  (!colon  ||  eq < colon) ? std::string(av[i], eq - av[i]) : s.spec;
+        if (s.tag == s.spec  &&  strrchr(s.spec.c_str(), '/')  &&  !colon)
+            s.tag = strrchr(s.spec.c_str(), '/') + 1;
+        s.fd = -1;
+        s.ep = 0;
+        s.capture = s.eof = s.done = false;
+        s.beg = s.end = 0;
+        s.last = s.base = s.start = -1;
+        src.push_back(s);
+    }
+    if (src.empty())
+        usage(av[0]);
+    if (src.size() > (size_t)MAXSRC)
+    {
+        fprintf(stderr, "At most %d sources are merged.\n", MAXSRC);
+        return 1;
+    }
+
+    Tty tty(MAXSRC);
+    for (size_t i=0; i<src.size(); i++)
+    {
+        Source& s = src[i];
+        Endpoint *ep = new Endpoint();
+        if (ep->parse(s.spec.c_str())  &&  ep->type() != Endpoint::PTY)
+        {
+            if (!ep->open(tty))
+            {
+                fprintf(stderr, "\"%s\" %s: %s\n", s.spec.c_str(), ep->what(), strerror(errno));
+                return 1;
+            }
+            s.ep = ep;
+        }
+        else
+        {
+            delete ep;
+            if ((s.fd = open(s.spec.c_str(), O_RDONLY)) < 0)
+            {
+                fprintf(stderr, "Can't open \"%s\": %s\n", s.spec.c_str(), strerror(errno));
+                return 1;
+            }
+            posix_fadvise(s.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
+        s.buf.resize(BUFSIZE);
+        if (s.tag.size() > MAXTAG)
+            s.tag.resize(MAXTAG);
+        if ((int)s.tag.size() > tag_width)
+            tag_width = s.tag.size();
+    }
+    for (size_t i=0; i<src.size(); i++)
+    {
+        src[i].label = src[i].tag;
+        src[i].label.resize(tag_width, ' ');
+        src[i].label += " | ";
+    }
+    if (out_name  &&  !(out = fopen(out_name, "w")))
+    {
+        fprintf(stderr, "Can't open \"%s\": %s\n", out_name, strerror(errno));
+        return 1;
+    }
+    setvbuf(out, 0, _IOFBF, 1024 * 1024);
+    stamp.set_mode("wall");
+
+    Older            older = { src };
+    std::vector<int> heap;
+    for (size_t i=0; i<src.size(); i++)
+        if (!src[i].ep)
+        {
+            refill(src[i]);
+            if (!src[i].done)
+                heap.push_back(i);
+        }
+    std::make_heap(heap.begin(), heap.end(), older);
+
+    std::vector<pollfd> fds;
+    std::vector<int>    fds_src;
+    for (;;)
+    {
+        // Lines of files go while no live source may have an older one
+        bool live = false;
+        for (size_t i=0; i<src.size(); i++)
+            live |= src[i].ep  &&  !src[i].done;
+        int64_t now = live ? now_us() : 0;
+        while (!heap.empty())
+        {
+            int     i = heap.front();
+            Source& s = src[i];
+            if (live  &&  s.lines.front().ts > now)
+                break;
+            std::pop_heap(heap.begin(), heap.end(), older);
+            heap.pop_back();
+            emit(s, s.lines.front());
+            s.lines.pop_front();
+            if (s.lines.empty()  &&  !s.ep)
+                refill(s);
+            if (!s.lines.empty())
+            {
+                heap.push_back(i);
+                std::push_heap(heap.begin(), heap.end(), older);
+            }
+        }
+        if (!live)
+            break;
+        fflush(out);
+
+        // Live sources with lines in the heap are not read meanwhile
+        fds.clear();
+        fds_src.clear();
+        for (size_t i=0; i<src.size(); i++)
+        {
+            Source& s = src[i];
+            if (!s.ep  ||  s.done  ||  !s.lines.empty())
+                continue;
+            pollfd p;
+            p.fd = s.ep->connected() ? s.ep->fd() : s.ep->listen_fd();
+            p.events = POLLIN;
+            p.revents = 0;
+            const Dgram *d = s.ep->dgram();
+            if (d  &&  d->pending())
+                p.revents = POLLIN;
+            fds.push_back(p);
+            fds_src.push_back(i);
+        }
+        int wait = -1;
+        if (!heap.empty())
+            wait = (src[heap.front()].lines.front().ts - now) / 1000 + 1;
+        for (size_t k=0; k<fds.size(); k++)
+            if (fds[k].revents)
+                wait = 0;
+        if (poll(&fds[0], fds.size(), wait) < 0  &&  errno != EINTR)
+        {
+            fprintf(stderr, "poll failure: %s\n", strerror(errno));
+            return 1;
+        }
+        for (size_t k=0; k<fds.size(); k++)
+        {
+            Source& s = src[fds_src[k]];
+            const Dgram *d = s.ep->dgram();
+            if (!fds[k].revents  &&  !(d  &&  d->pending()))
+                continue;
+            receive(s);
+            if (!s.lines.empty())
+            {
+                heap.push_back(fds_src[k]);
+                std::push_heap(heap.begin(), heap.end(), older);
+            }
+        }
+    }
+
+    if (fclose(out) != 0)
+    {
+        fprintf(stderr, "Write error: %s\n", strerror(errno));
+        return 1;
+    }
+    return 0;
+}
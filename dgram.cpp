@@ -0,0 +1,162 @@
+/*********************
+ * Datagram sockets
+ *********************
+ *
+ */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dgram.h"
+
+Dgram::Dgram()
+    : fd(-1)
+    , slots(0)
+    , cnt(0)
+    , cur(0)
+    , off(0)
+    , rx(0)
+{
+    memset(&dest, 0, sizeof(dest));
+}
+
+Dgram::~Dgram()
+{
+    close();
+    free(slots);
+}
+
+void Dgram::open(const int d, const Opts& o)
+{
+    close();
+    fd = d;
+    opts = o;
+    if (opts.size <= 0  ||  opts.size > MAXSIZE)
+        opts.size = MAXSIZE;
+}
+
+void Dgram::close()
+{
+    fd = -1;
+    cnt = cur = off = 0;
+    rx = 0;
+}
+
+int Dgram::receive()
+{
+    if (!slots)
+    {
+        if (!(slots = (unsigned char *)malloc((size_t)BATCH * MAXSIZE)))
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        for (int i=0; i<BATCH; i++)
+        {
+            iovs[i].iov_base = slots + (size_t)i * MAXSIZE;
+            iovs[i].iov_len = MAXSIZE;
+        }
+    }
+    for (int i=0; i<BATCH; i++)
+    {
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    // Waits for the first one only
+    int n;
+    do
+        n = recvmmsg(fd, msgs, BATCH, MSG_WAITFORONE, 0);
+    while (n < 0  &&  errno == EINTR);
+    if (n < 0)
+        return -1;
+    cnt = n;
+    cur = off = 0;
+    rx += n;
+    return n;
+}
+
+int Dgram::read(void *buf, const int size)
+{
+    if (!pending()  &&  receive() < 0)
+        return -1;
+
+    unsigned char *p = (unsigned char *)buf;
+    int           done = 0;
+    while (cur < cnt  &&  done < size)
+    {
+        int len = msgs[cur].msg_len;
+        if (!len)
+        {
+            // End of data, after the data before it
+            if (done)
+                break;
+            cur++;
+            return 0;
+        }
+        int k = len - off < size - done ? len - off : size - done;
+        memcpy(p + done, slots + (size_t)cur * MAXSIZE + off, k);
+        done += k;
+        off += k;
+        if (off == len)
+        {
+            cur++;
+            off = 0;
+        }
+    }
+    return done;
+}
+
+int Dgram::write(const void *buf, const int n)
+{
+    const unsigned char *p = (const unsigned char *)buf;
+    int                 done = 0;
+
+    while (done < n)
+    {
+        mmsghdr m[BATCH];
+        iovec   v[BATCH];
+        int     k = 0;
+
+        for (int at = done; k < BATCH  &&  at < n; k++)
+        {
+            int len = n - at < opts.size ? n - at : opts.size;
+            const void *nl;
+            if (opts.line  &&  (nl = memchr(p + at, '\n', len)))
+                len = (const unsigned char *)nl - (p + at) + 1;
+            v[k].iov_base = (void *)(p + at);
+            v[k].iov_len = len;
+            memset(&m[k], 0, sizeof(m[k]));
+            m[k].msg_hdr.msg_name = &dest;
+            m[k].msg_hdr.msg_namelen = sizeof(dest);
+            m[k].msg_hdr.msg_iov = &v[k];
+            m[k].msg_hdr.msg_iovlen = 1;
+            at += len;
+        }
+
+        int s = sendmmsg(fd, m, k, 0);
+        if (s < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            // No route now, the datagrams are lost
+            if (errno == ENETUNREACH  ||  errno == EHOSTUNREACH)
+                s = k;
+            else
+                return done  &&  errno == EAGAIN ? done : -1;
+        }
+        for (int i=0; i<s; i++)
+            done += v[i].iov_len;
+    }
+    return done;
+}
+
+bool Dgram::end()
+{
+    int n;
+    do
+        n = sendto(fd, "", 0, 0, (const sockaddr *)&dest, sizeof(dest));
+    while (n < 0  &&  errno == EINTR);
+    return n == 0;
+}
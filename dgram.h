@@ -0,0 +1,97 @@
+/*********************
+ * Datagram sockets
+ *********************
+ *
+ */
+#ifndef DGRAM_H
+#define DGRAM_H
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+/*!
+  \class Dgram
+  \brief UDP socket relayed as a byte stream
+
+  Datagrams are read in batches, up to BATCH of them by one recvmmsg(),
+  and handed out as a stream. What doesn't fit the reader's buffer stays
+  pending(), the socket is not readable for it. An empty datagram is the
+  end of data.
+
+  Data written is cut to datagrams: at every line end if \e line is set
+  and at \e size bytes, all of them go by one sendmmsg(). The socket is
+  not connected, datagrams of any sender are read and the data goes to
+  the destination set by to(), so a multicast group may be tapped too.
+  A datagram that is not delivered is lost, as UDP data is, it's not an
+  error of the relay.
+*/
+class Dgram
+{
+public:
+    static const int MAXSIZE = 65507;   // UDP payload over IPv4
+    static const int BATCH = 16;        // datagrams per system call
+
+    //! Cutting of the data written to datagrams
+    struct Opts
+    {
+        bool line;      // datagram ends at line end
+        int  size;      // max datagram size
+
+        Opts() : line(false), size(MAXSIZE) {}
+    };
+
+    Dgram();
+
+    /*! Destructor
+      The descriptor is not closed, it's not owned
+     */
+    ~Dgram();
+
+    //! Serve socket "fd", the buffers are allocated at first use
+    void open(const int fd, const Opts& o);
+    void close();
+    bool enabled() const { return fd >= 0; }
+
+    //! Destination of the data written
+    void to(const sockaddr_in& a) { dest = a; }
+
+    /*! Read datagrams, a part of one may be returned
+      \return bytes read, 0 - end of data, -1 - error (errno is set,
+      EAGAIN on non-blocking socket with no data)
+     */
+    int  read(void *buf, const int size);
+
+    //! Data received and not read yet
+    bool pending() const { return cur < cnt; }
+
+    /*! Write data as datagrams
+      \return bytes written, -1 - error, errno is set. On non-blocking
+      socket less may be written, at datagram boundary
+     */
+    int  write(const void *p, const int n);
+
+    //! Send the end of data, an empty datagram
+    bool end();
+
+    uint64_t datagrams() const { return rx; }    // received
+
+private:
+    int            fd;
+    Opts           opts;
+    sockaddr_in    dest;
+    unsigned char  *slots;     // BATCH datagrams of MAXSIZE, only used pages take memory
+    mmsghdr        msgs[BATCH];
+    iovec          iovs[BATCH];
+    int            cnt;        // datagrams received
+    int            cur;        // the one being read
+    int            off;        // read part of it
+    uint64_t       rx;
+
+    Dgram(const Dgram&);
+    Dgram& operator=(const Dgram&);
+
+    int            receive();
+};
+
+#endif
@@ -0,0 +1,210 @@
+/*********************
+ * Screen output under overload
+ *********************
+ *
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "display.h"
+
+static uint64_t now_ms()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+Display::Display()
+    : fd(-1)
+    , nb(-1)
+    , sock(false)
+    , mode(NONE)
+    , over(false)
+    , lost(0)
+    , skip(0)
+    , since(0)
+    , next_ms(0)
+{
+}
+
+Display::~Display()
+{
+    if (nb >= 0)
+        ::close(nb);
+}
+
+bool Display::parse(const char *s, Mode& m)
+{
+    if (!strcmp(s, "skip"))
+        m = SKIP;
+    else if (!strcmp(s, "lines"))
+        m = LINES;
+    else if (!strcmp(s, "screen"))
+        m = SCREEN;
+    else
+        return false;
+    return true;
+}
+
+bool Display::open(const int f, const Mode m)
+{
+    struct stat st;
+
+    close();
+    if (fstat(f, &st) < 0)
+        return false;
+    sock = S_ISSOCK(st.st_mode);
+    if (!sock  &&  !S_ISREG(st.st_mode))
+    {
+        // A description of its own, O_NONBLOCK of "f" is shared with stdin
+        char path[32];
+        snprintf(path, sizeof(path), "/proc/self/fd/%d", f);
+        if ((nb = ::open(path, O_WRONLY | O_NONBLOCK | O_NOCTTY)) < 0)
+            return false;
+    }
+    fd = f;
+    mode = m;
+    over = false;
+    lost = skip = since = 0;
+    tail.clear();
+    return true;
+}
+
+// Write what the terminal takes now, -1 - error
+int Display::put(const char *p, const int n)
+{
+    int done = 0;
+
+    while (done < n)
+    {
+        ssize_t k = sock ? send(fd, p + done, n - done, MSG_DONTWAIT | MSG_NOSIGNAL) :
+            ::write(nb >= 0 ? nb : fd, p + done, n - done);
+        if (k < 0  &&  errno == EINTR)
+            continue;
+        if (k < 0  &&  (errno == EAGAIN  ||  errno == EWOULDBLOCK))
+            break;
+        if (k < 0)
+            return -1;
+        done += k;
+    }
+    return done;
+}
+
+void Display::keep(const unsigned char *p, const int n)
+{
+    lost += n;
+    skip += n;
+    since += n;
+    if ((size_t)n >= TAIL)
+        tail.assign((const char *)p + n - TAIL, TAIL);
+    else
+    {
+        tail.append((const char *)p, n);
+        if (tail.size() > 2 * TAIL)
+            tail.erase(0, tail.size() - TAIL);
+    }
+}
+
+bool Display::write(const unsigned char *p, const int n)
+{
+    int off = 0;
+
+    if (!over)
+    {
+        if ((off = put((const char *)p, n)) < 0)
+            return false;
+        if (off == n)
+            return true;
+        over = true;
+        skip = since = 0;
+        tail.clear();
+        next_ms = now_ms() + REFRESH_MS;
+    }
+    keep(p + off, n - off);
+    return now_ms() < next_ms  ||  refresh();
+}
+
+int Display::rows() const
+{
+    winsize ws;
+    return ioctl(fd, TIOCGWINSZ, &ws) == 0  &&  ws.ws_row > 2 ? ws.ws_row : 24;
+}
+
+// Marker and the latest data, up to the line being received
+bool Display::refresh()
+{
+    next_ms = now_ms() + REFRESH_MS;
+
+    pollfd pf;
+    pf.fd = nb >= 0 ? nb : fd;
+    pf.events = POLLOUT;
+    if (poll(&pf, 1, 0) <= 0  ||  !(pf.revents & POLLOUT))
+    {
+        since = 0;
+        return true;
+    }
+
+    // Complete lines shown: "from" - "to", then the line being received
+    size_t last = tail.rfind('\n');
+    size_t to = last == std::string::npos ? 0 : last + 1;
+    size_t from = to;
+    int    lines = mode == LINES ? 1 : mode == SCREEN ? rows() - 2 : 0;
+    for (int i=0; i<lines  &&  from; i++)
+    {
+        size_t nl = from > 1 ? tail.rfind('\n', from - 2) : std::string::npos;
+        from = nl == std::string::npos ? 0 : nl + 1;
+    }
+
+    char marker[64];
+    snprintf(marker, sizeof(marker), "[%llu KB skipped]", (unsigned long long)(skip + 1023) / 1024);
+    std::string v = mode == SCREEN ? "\033[0m\033[H\033[2J\033[7m" : "\r\n\033[0m";
+    v += marker;
+    v += mode == SCREEN ? "\033[0m\r\n" : "\r\n";
+    v.append(tail, from, to - from);
+    if (tail.size() - to <= PARTIAL)
+        v.append(tail, to, std::string::npos);
+
+    int k = put(v.data(), v.size());
+    if (k < 0)
+        return false;
+    skip = 0;
+    if (k == (int)v.size()  &&  since < CALM)
+    {
+        over = false;
+        tail.clear();
+    }
+    since = 0;
+    return true;
+}
+
+int Display::wait() const
+{
+    if (!over)
+        return -1;
+    uint64_t now = now_ms();
+    return next_ms > now ? (next_ms - now) * 1000 : 0;
+}
+
+bool Display::tick()
+{
+    return !over  ||  now_ms() < next_ms  ||  refresh();
+}
+
+void Display::close()
+{
+    if (over)
+        refresh();
+    if (nb >= 0)
+        ::close(nb);
+    nb = fd = -1;
+    over = false;
+}
@@ -0,0 +1,98 @@
+/*********************
+ * Screen output under overload
+ *********************
+ *
+ */
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#include <stdint.h>
+
+#include <string>
+
+/*!
+  \class Display
+  \brief Target data for the screen, decimated when it can't keep up
+
+  The data is written without blocking. When the terminal doesn't take
+  all of it, the screen is overloaded: nothing more is written, the
+  data is only counted and its tail kept, the view is refreshed every
+  REFRESH_MS instead, by mode:
+
+      SKIP   - "[N KB skipped]" marker
+      LINES  - the marker and the last line received, a sample
+      SCREEN - the marker on top of the last screen of lines
+
+  A view ends with the line being received, the data goes on after it
+  when a view is written whole and less than CALM bytes came since the
+  previous one, the overload is over then. The reader of the target
+  (log, capture and the rest) is never held by the screen.
+
+  The descriptor is reopened non-blocking, so the one shared with the
+  keyboard keeps its mode. Regular files are written as is.
+*/
+class Display
+{
+public:
+    enum Mode { NONE, SKIP, LINES, SCREEN };
+
+    static const int    REFRESH_MS = 100;
+    static const size_t CALM = 16 * 1024;     // bytes between refreshes to end the overload
+    static const size_t TAIL = 64 * 1024;     // latest data kept for the view
+    static const size_t PARTIAL = 1024;       // line being received shown up to it
+
+    Display();
+
+    /*! Destructor
+      The descriptor reopened is closed
+     */
+    ~Display();
+
+    //! "skip", "lines" or "screen"
+    static bool parse(const char *s, Mode& m);
+
+    /*! Serve screen output "fd"
+      \return false on failure, errno is set
+     */
+    bool open(const int fd, const Mode m);
+    bool enabled() const    { return fd >= 0;   }
+    bool overloaded() const { return over;      }
+
+    /*! Data for the screen, written or decimated
+      \return false on write error, errno is set
+     */
+    bool write(const unsigned char *p, const int n);
+
+    //! Microseconds until the next refresh, -1 - none is due
+    int  wait() const;
+
+    //! Refresh the view if it's time, false on write error
+    bool tick();
+
+    //! Show the last view if overloaded and close
+    void close();
+
+    uint64_t skipped() const { return lost; }
+
+private:
+    int         fd;
+    int         nb;          // reopened non-blocking, -1 - "fd" is written
+    bool        sock;
+    Mode        mode;
+    bool        over;
+    uint64_t    lost;        // bytes not shown, total
+    uint64_t    skip;        // since the last marker
+    uint64_t    since;       // since the last refresh
+    uint64_t    next_ms;     // refresh due
+    std::string tail;
+
+    Display(const Display&);
+    Display& operator=(const Display&);
+
+    int  put(const char *p, const int n);
+    void keep(const unsigned char *p, const int n);
+    bool refresh();
+    int  rows() const;
+};
+
+#endif
@@ -0,0 +1,524 @@
+/*********************
+ * Connection endpoints
+ *********************
+ *
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/serial.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "endpoint.h"
+#include "str_utils.h"
+#include "tty.h"
+
+Endpoint::Endpoint()
+    : t(TTY)
+    , baud(0)
+    , conn(-1)
+    , lsn(-1)
+    , tty(0)
+    , wh("")
+    , linked(false)
+{
+}
+
+Endpoint::~Endpoint()
+{
+    close();
+}
+
+bool Endpoint::parse(const char *spec)
+{
+    static const struct { const char *prefix; Type type; } types[] =
+    {
+        { "tty:",         TTY         },
+        { "tcp:",         TCP         },
+        { "tcp-listen:",  TCP_LISTEN  },
+        { "unix:",        UNIX        },
+        { "unix-listen:", UNIX_LISTEN },
+        { "pty:",         PTY         },
+        { "udp:",         UDP         },
+        { "udp-listen:",  UDP_LISTEN  },
+    };
+
+    if (!strcmp(spec, "pty"))
+    {
+        set(PTY, "");
+        return true;
+    }
+    for (unsigned i=0; i<sizeof(types)/sizeof(types[0]); i++)
+    {
+        size_t n = strlen(types[i].prefix);
+        if (strncmp(spec, types[i].prefix, n)  ||  !spec[n])
+            continue;
+
+        std::string a = spec + n;
+        int         b = 0;
+        switch (types[i].type)
+        {
+        case TTY:
+        {
+            size_t comma = a.rfind(',');
+            if (comma != std::string::npos)
+            {
+                char *end;
+                b = (int)strtol(a.c_str() + comma + 1, &end, 0);
+                if (*end || b <= 0)
+                    return false;
+                a.erase(comma);
+            }
+            break;
+        }
+        case TCP:
+            if (a.find(':') == std::string::npos)
+                return false;
+            break;
+        case TCP_LISTEN:
+            if (a[0] != ':')
+                a.insert(0, ":");
+            break;
+        case UDP:
+        case UDP_LISTEN:
+        {
+            dopts = Dgram::Opts();
+            for (size_t comma; (comma = a.rfind(',')) != std::string::npos; a.erase(comma))
+            {
+                std::string o = a.substr(comma + 1);
+                char        *end;
+                if (o == "line")
+                    dopts.line = true;
+                else if (!o.compare(0, 5, "size="))
+                {
+                    dopts.size = (int)strtol(o.c_str() + 5, &end, 0);
+                    if (*end  ||  dopts.size <= 0  ||  dopts.size > Dgram::MAXSIZE)
+                        return false;
+                }
+                else
+                    return false;
+            }
+            if (a.find(':') == std::string::npos)
+            {
+                if (types[i].type == UDP)
+                    return false;
+                a.insert(0, ":");
+            }
+            break;
+        }
+        default:
+            break;
+        }
+        set(types[i].type, a.c_str(), b);
+        return true;
+    }
+    return false;
+}
+
+void Endpoint::set(const Type type, const char *a, const int b)
+{
+    close();
+    t = type;
+    addr = a;
+    baud = b;
+}
+
+bool Endpoint::fail(const char *call)
+{
+    int e = errno;
+    wh = call;
+    close();
+    errno = e;
+    return false;
+}
+
+// Set socket options, "wh" names the failed one
+bool Endpoint::apply(const int fd, const bool tcp)
+{
+    const struct { int level; int opt; const char *name; int val; bool use; } o[] =
+    {
+        { SOL_SOCKET,  SO_SNDBUF,         "setsockopt (SO_SNDBUF)",         opts.sndbuf,        opts.sndbuf > 0            },
+        { SOL_SOCKET,  SO_RCVBUF,         "setsockopt (SO_RCVBUF)",         opts.rcvbuf,        opts.rcvbuf > 0            },
+        { IPPROTO_TCP, TCP_NODELAY,       "setsockopt (TCP_NODELAY)",       1,                  tcp && opts.nodelay        },
+        { IPPROTO_TCP, TCP_QUICKACK,      "setsockopt (TCP_QUICKACK)",      1,                  tcp && opts.quickack       },
+        { SOL_SOCKET,  SO_KEEPALIVE,      "setsockopt (SO_KEEPALIVE)",      1,                  tcp && opts.keepidle >= 0  },
+        { IPPROTO_TCP, TCP_KEEPIDLE,      "setsockopt (TCP_KEEPIDLE)",      opts.keepidle,      tcp && opts.keepidle > 0   },
+        { IPPROTO_TCP, TCP_KEEPINTVL,     "setsockopt (TCP_KEEPINTVL)",     opts.keepintvl,     tcp && opts.keepidle >= 0 && opts.keepintvl > 0 },
+        { IPPROTO_TCP, TCP_KEEPCNT,       "setsockopt (TCP_KEEPCNT)",       opts.keepcnt,       tcp && opts.keepidle >= 0 && opts.keepcnt > 0   },
+        { IPPROTO_TCP, TCP_USER_TIMEOUT,  "setsockopt (TCP_USER_TIMEOUT)",  (int)opts.user_timeout, tcp && opts.user_timeout > 0 },
+    };
+
+    for (unsigned i=0; i<sizeof(o)/sizeof(o[0]); i++)
+        if (o[i].use  &&  setsockopt(fd, o[i].level, o[i].opt, &o[i].val, sizeof(o[i].val)) < 0)
+        {
+            wh = o[i].name;
+            return false;
+        }
+    return true;
+}
+
+// IPv4 address of "host", any for empty one. getaddrinfo() is thread
+// safe, sessions of a library user may connect in parallel
+bool Endpoint::resolve(const std::string& host, const int socktype, sockaddr_in& sa)
+{
+    if (host.empty())
+    {
+        sa.sin_addr.s_addr = htonl(INADDR_ANY);
+        return true;
+    }
+
+    addrinfo hints, *ai;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = socktype;
+    if (getaddrinfo(host.c_str(), 0, &hints, &ai))
+    {
+        errno = EHOSTUNREACH;
+        return fail("getaddrinfo");
+    }
+    sa.sin_addr = ((sockaddr_in *)ai->ai_addr)->sin_addr;
+    freeaddrinfo(ai);
+    return true;
+}
+
+bool Endpoint::open(Tty& tt)
+{
+    int one = 1;
+
+    nm.clear();
+    switch (t)
+    {
+    case TTY:
+    {
+        nm = addr;
+        if ((conn = tt.open(addr.c_str(), baud)) < 0)
+            return fail("open");
+        tty = &tt;
+
+        // Serial drivers deliver the received data at once rather than on
+        // their timer. Not every driver supports it, that's fine
+        serial_struct ss;
+        if (ioctl(conn, TIOCGSERIAL, &ss) == 0  &&  !(ss.flags & ASYNC_LOW_LATENCY))
+        {
+            ss.flags |= ASYNC_LOW_LATENCY;
+            ioctl(conn, TIOCSSERIAL, &ss);
+        }
+        return true;
+    }
+
+    case UNIX:
+    case UNIX_LISTEN:
+    {
+        sockaddr_un sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sun_family = AF_UNIX;
+        strncpy(sa.sun_path, addr.c_str(), sizeof(sa.sun_path)-1);
+        int salen = strlen(sa.sun_path) + sizeof(sa.sun_family);
+
+        if (t == UNIX)
+        {
+            if ((conn = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+                return fail("socket (AF_UNIX)");
+            if (!apply(conn, false))
+                return fail(wh);
+            if (connect(conn, (sockaddr *)&sa, salen) < 0)
+                return fail("connect");
+            nm = addr;
+            return true;
+        }
+
+        if ((lsn = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+            return fail("socket (AF_UNIX)");
+        if (setsockopt(lsn, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0)
+            return fail("setsockopt (SO_REUSEADDR)");
+        if (!apply(lsn, false))
+            return fail(wh);
+        unlink(sa.sun_path);
+        if (bind(lsn, (sockaddr *)&sa, salen) < 0)
+            return fail("bind");
+        if (listen(lsn, 1) < 0)
+            return fail("listen");
+        str::sappend(nm, "Unix domain server %s", addr.c_str());
+        return true;
+    }
+
+    case TCP:
+    case TCP_LISTEN:
+    {
+        size_t      colon = addr.rfind(':');
+        std::string host = addr.substr(0, colon);
+        char        *end;
+        int         port = (int)strtol(addr.c_str() + colon + 1, &end, 0);
+        if (*end)
+        {
+            errno = EINVAL;
+            return fail("port");
+        }
+
+        sockaddr_in sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sin_family = AF_INET;
+        sa.sin_port = htons(port);
+
+        if (t == TCP)
+        {
+            if (!resolve(host, SOCK_STREAM, sa))
+                return false;
+            if ((conn = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+                return fail("socket (AF_INET)");
+            if (!apply(conn, true))
+                return fail(wh);
+            if (connect(conn, (sockaddr *)&sa, sizeof(sa)) < 0)
+                return fail("connect");
+            str::sappend(nm, "%s:%d", host.c_str(), port);
+            return true;
+        }
+
+        sa.sin_addr.s_addr = htonl(INADDR_ANY);
+        if ((lsn = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+            return fail("socket (AF_INET)");
+        if (setsockopt(lsn, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0)
+            return fail("setsockopt (SO_REUSEADDR)");
+        // Buffer sizes set before listen() give the window scale of accepted sockets
+        if (!apply(lsn, false))
+            return fail(wh);
+        if (bind(lsn, (sockaddr *)&sa, sizeof(sa)) < 0)
+            return fail("bind");
+        if (listen(lsn, 1) < 0)
+            return fail("listen");
+        str::sappend(nm, "TCP server :%d", port);
+        return true;
+    }
+
+    case UDP:
+    case UDP_LISTEN:
+    {
+        size_t      colon = addr.rfind(':');
+        std::string host = addr.substr(0, colon);
+        char        *end;
+        int         port = (int)strtol(addr.c_str() + colon + 1, &end, 0);
+        if (*end)
+        {
+            errno = EINVAL;
+            return fail("port");
+        }
+
+        sockaddr_in sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sin_family = AF_INET;
+        sa.sin_port = htons(port);
+        if (!resolve(host, SOCK_DGRAM, sa))
+            return false;
+
+        if (t == UDP)
+        {
+            // Not connected: no ICMP errors from a device not up yet,
+            // replies from another port are read too
+            sockaddr_in any;
+            memset(&any, 0, sizeof(any));
+            any.sin_family = AF_INET;
+            if ((conn = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+                return fail("socket (AF_INET)");
+            if (!apply(conn, false))
+                return fail(wh);
+            if (bind(conn, (sockaddr *)&any, sizeof(any)) < 0)
+                return fail("bind");
+            dg.open(conn, dopts);
+            dg.to(sa);
+            str::sappend(nm, "UDP %s:%d", host.c_str(), port);
+            return true;
+        }
+
+        // Group members on one host share the port
+        if ((lsn = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+            return fail("socket (AF_INET)");
+        if (setsockopt(lsn, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0)
+            return fail("setsockopt (SO_REUSEADDR)");
+        if (!apply(lsn, false))
+            return fail(wh);
+        if (bind(lsn, (sockaddr *)&sa, sizeof(sa)) < 0)
+            return fail("bind");
+        if (IN_MULTICAST(ntohl(sa.sin_addr.s_addr)))
+        {
+            ip_mreq m;
+            m.imr_multiaddr = sa.sin_addr;
+            m.imr_interface.s_addr = htonl(INADDR_ANY);
+            if (setsockopt(lsn, IPPROTO_IP, IP_ADD_MEMBERSHIP, &m, sizeof(m)) < 0)
+                return fail("setsockopt (IP_ADD_MEMBERSHIP)");
+            str::sappend(nm, "UDP group %s:%d", host.c_str(), port);
+        }
+        else
+            str::sappend(nm, "UDP server %s:%d", host.c_str(), port);
+        return true;
+    }
+
+    case PTY:
+    {
+        if ((lsn = posix_openpt(O_RDWR | O_NOCTTY)) < 0)
+            return fail("posix_openpt");
+        if (grantpt(lsn) < 0  ||  unlockpt(lsn) < 0)
+            return fail("unlockpt");
+        const char *slave = ptsname(lsn);
+
+        // Raw, as a serial port is
+        termios ts;
+        if (tcgetattr(lsn, &ts) == 0)
+        {
+            cfmakeraw(&ts);
+            tcsetattr(lsn, TCSANOW, &ts);
+        }
+
+        if (addr.empty())
+        {
+            str::sappend(nm, "pty %s", slave);
+            return true;
+        }
+        // Link left by previous run is replaced, anything else is not
+        struct stat st;
+        if (lstat(addr.c_str(), &st) == 0  &&  S_ISLNK(st.st_mode))
+            unlink(addr.c_str());
+        if (symlink(slave, addr.c_str()) < 0)
+            return fail("symlink");
+        linked = true;
+        str::sappend(nm, "pty %s (%s)", addr.c_str(), slave);
+        return true;
+    }
+    }
+    return false;
+}
+
+bool Endpoint::accept()
+{
+    pr.clear();
+    if (t == PTY)
+    {
+        while (!pending())
+            usleep(10000);
+        if ((conn = dup(lsn)) < 0)
+        {
+            wh = "dup";
+            return false;
+        }
+        pr = "pty slave";
+        return true;
+    }
+    if (t == UDP_LISTEN)
+    {
+        // The first datagram is left for the relay, its sender is the peer
+        sockaddr_in sa;
+        socklen_t   salen = sizeof(sa);
+        char        c;
+        pollfd      p;
+        p.fd = lsn;
+        p.events = POLLIN;
+        while (poll(&p, 1, -1) < 0  ||  recvfrom(lsn, &c, 1, MSG_PEEK, (sockaddr *)&sa, &salen) < 0)
+            if (errno != EINTR  &&  errno != EAGAIN)
+            {
+                wh = "recvfrom";
+                return false;
+            }
+        if ((conn = dup(lsn)) < 0)
+        {
+            wh = "dup";
+            return false;
+        }
+        char ip[INET_ADDRSTRLEN];
+        if (!inet_ntop(AF_INET, &sa.sin_addr, ip, sizeof(ip)))
+            strcpy(ip, "?");
+        str::sappend(pr, "%s:%d", ip, ntohs(sa.sin_port));
+        dg.open(conn, dopts);
+        dg.to(sa);
+        return true;
+    }
+    if (t == UNIX_LISTEN)
+    {
+        sockaddr_un sa;
+        socklen_t   salen = sizeof(sa);
+
+        sa.sun_path[0] = 0;
+        if ((conn = ::accept(lsn, (sockaddr *)&sa, &salen)) < 0)
+        {
+            wh = "accept";
+            return false;
+        }
+        if (salen > sizeof(sa.sun_family)  &&  sa.sun_path[0])
+            pr.assign(sa.sun_path, strnlen(sa.sun_path, salen - sizeof(sa.sun_family)));
+        else
+            pr = "unkonown client";
+        if (!apply(conn, false))
+        {
+            disconnect();
+            return false;
+        }
+        return true;
+    }
+
+    sockaddr_in sa;
+    socklen_t   salen = sizeof(sa);
+    if ((conn = ::accept(lsn, (sockaddr *)&sa, &salen)) < 0)
+    {
+        wh = "accept";
+        return false;
+    }
+
+    // Determine the client host name
+    char host[NI_MAXHOST], ip[INET_ADDRSTRLEN];
+    if (getnameinfo((sockaddr *)&sa, salen, host, sizeof(host), 0, 0, NI_NAMEREQD))
+        strcpy(host, "???");
+    if (!inet_ntop(AF_INET, &sa.sin_addr, ip, sizeof(ip)))
+        strcpy(ip, "?");
+    str::sappend(pr, "%s (%s)", host, ip);
+    if (!apply(conn, true))
+    {
+        disconnect();
+        return false;
+    }
+    return true;
+}
+
+// Slave closed by its last user reports hangup until opened again.
+// Never opened one doesn't, data written meanwhile waits for the user
+bool Endpoint::pending() const
+{
+    pollfd p;
+    p.fd = lsn;
+    p.events = POLLIN;
+    p.revents = 0;
+    return poll(&p, 1, 0) >= 0  &&  !(p.revents & POLLHUP);
+}
+
+void Endpoint::disconnect()
+{
+    if (conn < 0)
+        return;
+    dg.close();
+    if (tty)
+        tty->close(conn);
+    else
+        ::close(conn);
+    conn = -1;
+    tty = 0;
+}
+
+void Endpoint::close()
+{
+    disconnect();
+    if (lsn >= 0)
+        ::close(lsn);
+    lsn = -1;
+    if (linked)
+        unlink(addr.c_str());
+    linked = false;
+}
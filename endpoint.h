@@ -0,0 +1,131 @@
+/*********************
+ * Connection endpoints
+ *********************
+ *
+ */
+#ifndef ENDPOINT_H
+#define ENDPOINT_H
+
+#include <string>
+
+#include "dgram.h"
+
+class Tty;
+
+/*!
+  \class Endpoint
+  \brief One side of a relayed connection
+
+  tty device or TCP or UNIX socket, connecting or accepting connections,
+  or a pseudo-terminal created for programs which need a tty device.
+  A listening endpoint keeps its listening socket between connections,
+  a tty stays open for the whole run. A pty is listening too: its
+  "connection" is the time the slave is open by some program.
+
+  UDP endpoints are served by dgram(). A UDP listener is "connected" by
+  the first datagram, the data goes to its sender then. A listener on a
+  multicast group address joins the group.
+*/
+class Endpoint
+{
+public:
+    enum Type { TTY, TCP, TCP_LISTEN, UNIX, UNIX_LISTEN, PTY, UDP, UDP_LISTEN };
+
+    /*! Options of connected and accepted sockets. Buffer sizes apply to
+      UNIX sockets too, the rest is TCP only. Zero is the system default
+     */
+    struct SockOpts
+    {
+        bool     nodelay;       // TCP_NODELAY, no Nagle delay of small writes
+        bool     quickack;      // TCP_QUICKACK, no delayed ACK
+        int      sndbuf;        // SO_SNDBUF
+        int      rcvbuf;        // SO_RCVBUF
+        int      keepidle;      // seconds of silence before keepalive probes, -1 - no keepalive
+        int      keepintvl;     // seconds between probes
+        int      keepcnt;       // unanswered probes to drop the connection
+        unsigned user_timeout;  // ms, TCP_USER_TIMEOUT: unacknowledged data drops the connection
+
+        SockOpts() : nodelay(true), quickack(false), sndbuf(0), rcvbuf(0),
+                     keepidle(30), keepintvl(5), keepcnt(3), user_timeout(0) {}
+    };
+
+    Endpoint();
+
+    /*! Destructor
+      Everything is closed
+     */
+    ~Endpoint();
+
+    /*! Parse endpoint specification: "tty:DEVICE[,BAUD]",
+      "tcp:HOST:PORT", "tcp-listen:PORT", "unix:PATH", "unix-listen:PATH",
+      "pty[:LINK]", "udp:HOST:PORT[,OPTS]" or "udp-listen:[ADDR:]PORT[,OPTS]".
+      UDP OPTS are "line" (a datagram per line) and "size=N" (max datagram
+      size), comma separated
+      \return false if \e spec is not a valid specification
+     */
+    bool parse(const char *spec);
+
+    /*! Set endpoint up
+      \param addr tty device, "HOST:PORT", ":PORT", socket path or
+      symbolic link to pty slave (may be empty)
+      \param baud tty speed, 0 - don't change
+     */
+    void set(const Type t, const char *addr, const int baud = 0);
+
+    //! Set socket options, used by following open() and accept()
+    void tune(const SockOpts& o) { opts = o; }
+
+    /*! Open tty, connect socket, bind and listen or create pty
+      \return false on failure, errno is set and what() names the failed call
+     */
+    bool open(Tty& tty);
+
+    /*! Wait for connection on listening endpoint, for pty - until the
+      slave is open
+      \return false on failure, errno is set
+     */
+    bool accept();
+
+    /*! pty slave is open, accept() doesn't wait. Listening sockets are
+      waited for with select() on listen_fd() instead
+     */
+    bool pending() const;
+
+    //! Close the connection, listening socket stays open
+    void disconnect();
+
+    //! Close everything
+    void close();
+
+    Type        type() const      { return t;                                    }
+    bool        listener() const  { return t == TCP_LISTEN || t == UNIX_LISTEN || t == PTY || t == UDP_LISTEN; }
+    bool        connected() const { return conn >= 0;                            }
+    int         fd() const        { return conn;                                 }
+    int         listen_fd() const { return lsn;                                  }   // pty master
+    const char  *name() const     { return nm.c_str();                           }
+    const char  *peer() const     { return pr.c_str();                           }
+    const char  *what() const     { return wh;                                   }
+    Dgram       *dgram()          { return dg.enabled() ? &dg : 0;               }   // UDP socket
+    const Dgram *dgram() const    { return dg.enabled() ? &dg : 0;               }
+
+private:
+    Type        t;
+    std::string addr;
+    int         baud;
+    int         conn;        // connection
+    int         lsn;         // listening socket or pty master
+    Tty         *tty;        // tty is open by it
+    std::string nm;
+    std::string pr;
+    const char  *wh;
+    bool        linked;      // pty link is created
+    SockOpts    opts;
+    Dgram       dg;
+    Dgram::Opts dopts;
+
+    bool        fail(const char *call);
+    bool        apply(const int fd, const bool tcp);
+    bool        resolve(const std::string& host, const int socktype, sockaddr_in& sa);
+};
+
+#endif
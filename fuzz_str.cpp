@@ -0,0 +1,239 @@
+/*********************
+ * str_utils fuzz target
+ *********************
+ *
+ * Checks invariants of str_utils on arbitrary input, aborts on a
+ * violation. Built for libFuzzer it's the LLVMFuzzerTestOneInput()
+ * only. Standalone (FUZZ_MAIN defined) it runs the inputs given as
+ * files or on stdin, as AFL does, or N random inputs with "-n N".
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "str_utils.h"
+
+static void fail(const char *what, const std::string& in, const std::string& got, const std::string& want)
+{
+    fprintf(stderr, "%s\n  input: \"%s\"\n  got:   \"%s\"\n  want:  \"%s\"\n", what,
+            str::escape(in).c_str(), str::escape(got).c_str(), str::escape(want).c_str());
+    abort();
+}
+
+static bool hexdigit(const char c)
+{
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+// Reference of unescape(): \\ \r \n \t and \xHH with exactly two hexa
+// digits are decoded, anything else is kept as is
+static std::string ref_unescape(const std::string& s)
+{
+    std::string r;
+    size_t      n = strlen(s.c_str());
+
+    for (size_t i=0; i<n; i++)
+    {
+        if (s[i] != '\\'  ||  i + 1 >= n)
+        {
+            r += s[i];
+            continue;
+        }
+        char c = s[i+1];
+        if (c == '\\' || c == 'r' || c == 'n' || c == 't')
+        {
+            r += c == '\\' ? '\\' : c == 'r' ? '\r' : c == 'n' ? '\n' : '\t';
+            i++;
+        }
+        else if (c == 'x'  &&  i + 3 < n  &&  hexdigit(s[i+2])  &&  hexdigit(s[i+3]))
+        {
+            r += (char)strtol(s.substr(i+2, 2).c_str(), 0, 16);
+            i += 3;
+        }
+        else if (c == 'x')
+        {
+            // Not a hexa escape, up to two following chars are kept as is
+            size_t k = i + 4 < n ? i + 4 : n;
+            r.append(s, i, k - i);
+            i = k - 1;
+        }
+        else
+        {
+            r.append(s, i, 2);
+            i++;
+        }
+    }
+    return r;
+}
+
+static void check_escape(const std::string& in)
+{
+    // escape() stops at NUL as every C string does
+    std::string x(in.c_str());
+    std::string e = str::escape(x);
+
+    for (size_t i=0; i<e.size(); i++)
+        if (e[i] < ' '  ||  e[i] > '~')
+            fail("escape: unprintable output", x, e, "");
+    std::string u = str::unescape(e);
+    if (u != x)
+        fail("unescape(escape(x)) != x", x, u, x);
+
+    u = str::unescape(in);
+    std::string r = ref_unescape(in);
+    if (u != r)
+        fail("unescape", in, u, r);
+    if (u.size() > x.size())
+        fail("unescape: output longer than input", in, u, "");
+}
+
+static void check_trim(const std::string& in)
+{
+    std::string t = str::trim(in);
+    std::string lr = str::trim_left(str::trim_right(in));
+    if (t != lr)
+        fail("trim(s) != trim_left(trim_right(s))", in, t, lr);
+    if (!t.empty()  &&  (memchr(" \t\r\n", t[0], 4)  ||  memchr(" \t\r\n", t[t.size()-1], 4)))
+        fail("trim: delimiter left", in, t, "");
+    if (in.find(t) == std::string::npos)
+        fail("trim: not a substring", in, t, "");
+}
+
+static void check_filters(const std::string& in)
+{
+    std::string c, t;
+    for (size_t i=0; i<in.size(); i++)
+    {
+        char ch = str::filter_colors(in[i]);
+        if (ch)
+            c += ch;
+        if ((ch = str::filter_telnet(in[i])))
+            t += ch;
+    }
+    if (c.find('\033') != std::string::npos)
+        fail("filter_colors: ESC passed", in, c, "");
+
+    // Back to the normal state from any: "m" ends a color sequence, SE
+    // ends subnegotiation or is an option, "a" ends the option. Then
+    // the data with no ESC and no IAC passes as is
+    static const char reset[] = "m\xf0" "a";
+    for (const char *p = reset; *p; p++)
+    {
+        str::filter_colors(*p);
+        str::filter_telnet(*p);
+    }
+    std::string plain;
+    for (size_t i=0; i<in.size(); i++)
+        if (in[i] != '\033'  &&  in[i] != '\xff'  &&  in[i])
+            plain += in[i];
+    for (size_t i=0; i<plain.size(); i++)
+        if (str::filter_colors(plain[i]) != plain[i]  ||  str::filter_telnet(plain[i]) != plain[i])
+            fail("filter: plain data changed", plain, "", plain);
+}
+
+static void check_split(const std::string& in)
+{
+    static str::regexp comma(",");
+    static str::regexp blanks("[ \t]*");
+
+    // Pieces are the text between separators, empty ones are dropped
+    std::string x(in.c_str());
+    std::vector<std::string> v = comma.split_v(x);
+    std::string joined, want;
+    for (size_t i=0; i<v.size(); i++)
+    {
+        if (v[i].find(',') != std::string::npos)
+            fail("split: separator in piece", x, v[i], "");
+        joined += v[i];
+    }
+    for (size_t i=0; i<x.size(); i++)
+        if (x[i] != ',')
+            want += x[i];
+    if (joined != want)
+        fail("split: pieces lost data", x, joined, want);
+
+    // Pattern matching empty string must terminate
+    v = blanks.split_v(x);
+    joined.clear();
+    want.clear();
+    for (size_t i=0; i<v.size(); i++)
+        joined += v[i];
+    for (size_t i=0; i<x.size(); i++)
+        if (x[i] != ' '  &&  x[i] != '\t')
+            want += x[i];
+    if (joined != want)
+        fail("split (empty match): pieces lost data", x, joined, want);
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    std::string in((const char *)data, size);
+
+    check_escape(in);
+    check_trim(in);
+    check_filters(in);
+    check_split(in);
+    return 0;
+}
+
+#ifdef FUZZ_MAIN
+// Random input biased to the interesting characters
+static std::string random_input()
+{
+    static const char alphabet[] = "\\xrnt0aF9g ,\t\r\n\033[m\xff\xfa\xf0\x01~";
+    std::string s;
+    size_t      n = rand() % 48;
+
+    for (size_t i=0; i<n; i++)
+        s += rand() % 4 ? alphabet[rand() % (sizeof(alphabet) - 1)] : (char)(rand() & 0xff);
+    return s;
+}
+
+static void run_file(FILE *f)
+{
+    std::string in;
+    char        buf[4096];
+    size_t      n;
+
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        in.append(buf, n);
+    LLVMFuzzerTestOneInput((const uint8_t *)in.data(), in.size());
+}
+
+int main(int ac, char *av[])
+{
+    if (ac == 3  &&  !strcmp(av[1], "-n"))
+    {
+        long n = atol(av[2]);
+        srand(1);
+        for (long i=0; i<n; i++)
+        {
+            std::string in = random_input();
+            LLVMFuzzerTestOneInput((const uint8_t *)in.data(), in.size());
+        }
+        printf("%ld inputs OK\n", n);
+        return 0;
+    }
+    if (ac == 1)
+    {
+        run_file(stdin);
+        return 0;
+    }
+    for (int i=1; i<ac; i++)
+    {
+        FILE *f = fopen(av[i], "rb");
+        if (!f)
+        {
+            perror(av[i]);
+            return 1;
+        }
+        run_file(f);
+        fclose(f);
+    }
+    return 0;
+}
+#endif
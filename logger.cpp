@@ -0,0 +1,117 @@
+/*********************
+ * Session log
+ *********************
+ *
+ */
+#include <string.h>
+#include <time.h>
+
+#include "logger.h"
+
+Logger::Logger()
+    : f(0)
+    , st(REGULAR)
+    , cr_count(0)
+{
+}
+
+Logger::~Logger()
+{
+    close();
+}
+
+bool Logger::open(const char *path, const bool append)
+{
+    close();
+    if (!(f = fopen(path, append ? "a" : "w")))
+        return false;
+    if (!append)
+        return true;
+
+    time_t    t = time(NULL);
+    struct tm tm;
+    char      outstr[200];
+
+    fprintf(f, "\n\n\n*****     New CON session");
+    if (localtime_r(&t, &tm)  &&  strftime(outstr, sizeof(outstr)-1, "%a, %d %b %y %T %z", &tm))
+        fprintf(f, ", started at %s     *****\n\n\n", outstr);
+    else
+        fprintf(f, "     *****\n\n\n");
+    return true;
+}
+
+void Logger::write(const unsigned char *buf, const int cnt, const bool filter_colors)
+{
+    if (!f)
+        return;
+    if (!filter_colors)
+    {
+        fwrite(buf, cnt, 1, f);
+        return;
+    }
+
+    // Runs of regular bytes are written at once
+    int i = 0;
+    while (i < cnt)
+    {
+        switch (st)
+        {
+        case REGULAR:
+        {
+            int j = i;
+            while (j < cnt  &&  buf[j] != '\033'  &&  buf[j] != '\r')
+                j++;
+            if (j > i)
+                fwrite(&buf[i], j - i, 1, f);
+            if (j == cnt)
+                return;
+            if (buf[j] == '\033')
+                st = COLOR;
+            else
+            {
+                st = CRNL;
+                cr_count++;
+            }
+            i = j + 1;
+            break;
+        }
+        case COLOR:
+        {
+            const void *m = memchr(&buf[i], 'm', cnt - i);
+            if (!m)
+                return;
+            st = REGULAR;
+            i = (const unsigned char *)m - buf + 1;
+            break;
+        }
+        case CRNL:
+            if (buf[i] == '\r')
+                cr_count++;
+            else if (buf[i] == '\n')
+            {
+                fwrite(&buf[i], 1, 1, f);
+                cr_count = 0;
+            }
+            else
+            {
+                for (int j=0; j<cr_count; j++)
+                    fwrite("\r", 1, 1, f);
+                fwrite(&buf[i], 1, 1, f);
+                cr_count = 0;
+            }
+            if (buf[i] != '\r')
+                st = REGULAR;
+            i++;
+            break;
+        }
+    }
+}
+
+void Logger::close()
+{
+    if (f)
+        fclose(f);
+    f = 0;
+    st = REGULAR;
+    cr_count = 0;
+}
@@ -0,0 +1,53 @@
+/*********************
+ * Session log
+ *********************
+ *
+ */
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stdio.h>
+
+/*!
+  \class Logger
+  \brief Log file of the session data
+
+  The data is written as is or with color sequences filtered out. The
+  filter also drops carriage returns before a line feed, so a log of a
+  console reads well in an editor. The filter state is kept between
+  writes, a sequence may be split by reads.
+*/
+class Logger
+{
+public:
+    Logger();
+
+    /*! Destructor
+      The file is closed
+     */
+    ~Logger();
+
+    /*! Open log file
+      \param append add to the existing file after a "New CON session"
+      header instead of overwriting it
+      \return false on failure, errno is set
+     */
+    bool open(const char *path, const bool append = false);
+    bool enabled() const { return f != 0; }
+
+    /*! Write data
+      \param filter_colors drop color sequences and CRs before LF
+     */
+    void write(const unsigned char *buf, const int cnt, const bool filter_colors);
+
+    void close();
+
+private:
+    enum State { REGULAR, COLOR, CRNL };
+
+    FILE  *f;
+    State st;
+    int   cr_count;
+};
+
+#endif
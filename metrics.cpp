@@ -0,0 +1,375 @@
+/*********************
+ * Metrics endpoint
+ *********************
+ *
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/serial.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "metrics.h"
+#include "str_utils.h"
+
+static uint64_t now_s()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+// Label value: backslash, quote and new line are escaped
+static std::string label(const std::string& s)
+{
+    std::string r;
+    for (size_t i=0; i<s.size(); i++)
+    {
+        if (s[i] == '\\' || s[i] == '"')
+            r += '\\';
+        if (s[i] == '\n')
+            r += "\\n";
+        else
+            r += s[i];
+    }
+    return r;
+}
+
+Metrics::Metrics()
+    : sessions(0)
+    , failures(0)
+    , active(0)
+    , started(now_s())
+    , running(false)
+    , lsn(-1)
+    , quit(-1)
+{
+    memset(dirs, 0, sizeof(dirs));
+    fds[0] = fds[1] = -1;
+    pthread_mutex_init(&lock, 0);
+}
+
+Metrics::~Metrics()
+{
+    stop();
+    pthread_mutex_destroy(&lock);
+}
+
+bool Metrics::serve(const char *spec)
+{
+    if (!strncmp(spec, "unix:", 5)  &&  spec[5])
+    {
+        sockaddr_un sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sun_family = AF_UNIX;
+        strncpy(sa.sun_path, spec + 5, sizeof(sa.sun_path)-1);
+        if ((lsn = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+            return false;
+        unlink(sa.sun_path);
+        if (bind(lsn, (sockaddr *)&sa, sizeof(sa)) < 0)
+            goto fail;
+        path = sa.sun_path;
+    }
+    else if (!strncmp(spec, "tcp:", 4))
+    {
+        char *end;
+        long port = strtol(spec + 4, &end, 0);
+        int  one = 1;
+        if (*end  ||  end == spec + 4  ||  port <= 0  ||  port > 65535)
+        {
+            errno = EINVAL;
+            return false;
+        }
+
+        sockaddr_in sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sin_family = AF_INET;
+        sa.sin_port = htons(port);
+        sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if ((lsn = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+            return false;
+        setsockopt(lsn, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(lsn, (sockaddr *)&sa, sizeof(sa)) < 0)
+            goto fail;
+    }
+    else
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    if (listen(lsn, 8) < 0  ||  (quit = eventfd(0, EFD_CLOEXEC)) < 0)
+        goto fail;
+    {
+        int rc = pthread_create(&thread, 0, run, this);
+        if (rc)
+        {
+            errno = rc;
+            goto fail;
+        }
+    }
+    running = true;
+    return true;
+
+fail:
+    int e = errno;
+    stop();
+    errno = e;
+    return false;
+}
+
+void Metrics::stop()
+{
+    if (running)
+    {
+        eventfd_write(quit, 1);
+        pthread_join(thread, 0);
+        running = false;
+    }
+    if (lsn >= 0)
+        close(lsn);
+    if (quit >= 0)
+        close(quit);
+    lsn = quit = -1;
+    if (!path.empty())
+        unlink(path.c_str());
+    path.clear();
+}
+
+void Metrics::session_start(const char *target, const char *other, const int target_fd, const int other_fd)
+{
+    pthread_mutex_lock(&lock);
+    names[IN] = target;
+    names[OUT] = other;
+    fds[IN] = target_fd;
+    fds[OUT] = other_fd;
+    pthread_mutex_unlock(&lock);
+    set(sessions, sessions + 1);
+    set(active, 1);
+}
+
+void Metrics::session_end(const bool ok)
+{
+    // The descriptors may be closed after return
+    pthread_mutex_lock(&lock);
+    fds[IN] = fds[OUT] = -1;
+    pthread_mutex_unlock(&lock);
+    if (!ok)
+        set(failures, failures + 1);
+    set(active, 0);
+    for (int i=0; i<2; i++)
+        set(dirs[i].queue, 0);
+}
+
+void Metrics::written(const int dir, const uint64_t latency_us, const uint64_t write_us)
+{
+    Dir& d = dirs[dir];
+    int  b = 0;
+
+    while (b < NBUCKETS - 1  &&  latency_us >> (b + 1))
+        b++;
+    set(d.writes, d.writes + 1);
+    set(d.lat[b], d.lat[b] + 1);
+    set(d.lat_sum, d.lat_sum + latency_us);
+    if (write_us >= STALL_US)
+    {
+        set(d.stalls, d.stalls + 1);
+        set(d.stall_us, d.stall_us + write_us);
+    }
+}
+
+void *Metrics::run(void *arg)
+{
+    Metrics *m = (Metrics *)arg;
+    pollfd  fds[2];
+
+    fds[0].fd = m->lsn;
+    fds[0].events = POLLIN;
+    fds[1].fd = m->quit;
+    fds[1].events = POLLIN;
+    for (;;)
+    {
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return 0;
+        }
+        if (fds[1].revents)
+            return 0;
+        int c = accept4(m->lsn, 0, 0, SOCK_CLOEXEC);
+        if (c >= 0)
+        {
+            m->answer(c);
+            close(c);
+        }
+    }
+}
+
+// Plain text, or HTTP response to a GET request sent in 100 ms
+void Metrics::answer(const int fd)
+{
+    char   req[1024];
+    size_t got = 0;
+    pollfd p;
+
+    p.fd = fd;
+    p.events = POLLIN;
+    while (got < sizeof(req) - 1  &&  poll(&p, 1, 100) > 0)
+    {
+        ssize_t n = ::read(fd, req + got, sizeof(req) - 1 - got);
+        if (n <= 0)
+            break;
+        got += n;
+        req[got] = 0;
+        if (strstr(req, "\r\n\r\n")  ||  strstr(req, "\n\n"))
+            break;
+    }
+
+    std::string body = render();
+    std::string out;
+    if (got >= 4  &&  !memcmp(req, "GET ", 4))
+        str::sappend(out, "HTTP/1.0 200 OK\r\n"
+                          "Content-Type: text/plain; version=0.0.4\r\n"
+                          "Content-Length: %lu\r\n"
+                          "Connection: close\r\n\r\n", (unsigned long)body.size());
+    out += body;
+
+    for (size_t off=0; off<out.size(); )
+    {
+        ssize_t n = send(fd, out.data() + off, out.size() - off, MSG_NOSIGNAL);
+        if (n <= 0)
+            break;
+        off += n;
+    }
+}
+
+std::string Metrics::render()
+{
+    static const char *dname[2] = { "in", "out" };
+    static const double qs[] = { 0.5, 0.9, 0.99, 0.999 };
+    std::string r;
+    Dir         d[2];
+
+    // Snapshot
+    for (int i=0; i<2; i++)
+    {
+        d[i].bytes = get(dirs[i].bytes);
+        d[i].reads = get(dirs[i].reads);
+        d[i].writes = get(dirs[i].writes);
+        d[i].stalls = get(dirs[i].stalls);
+        d[i].stall_us = get(dirs[i].stall_us);
+        d[i].queue = get(dirs[i].queue);
+        d[i].dropped = get(dirs[i].dropped);
+        d[i].lat_sum = get(dirs[i].lat_sum);
+        for (int b=0; b<NBUCKETS; b++)
+            d[i].lat[b] = get(dirs[i].lat[b]);
+    }
+
+    pthread_mutex_lock(&lock);
+    str::sappend(r, "# HELP con_info Relayed endpoints, \"in\" is data from the target\n"
+                    "# TYPE con_info gauge\n"
+                    "con_info{target=\"%s\",peer=\"%s\"} 1\n",
+                 label(names[IN]).c_str(), label(names[OUT]).c_str());
+
+    // UART counters of ttys, the driver may not support them
+    bool head = false;
+    for (int i=0; i<2; i++)
+    {
+        serial_icounter_struct ic;
+        if (fds[i] < 0  ||  ioctl(fds[i], TIOCGICOUNT, &ic) < 0)
+            continue;
+        if (!head)
+            r += "# HELP con_uart_events_total UART driver counters (TIOCGICOUNT)\n"
+                 "# TYPE con_uart_events_total counter\n";
+        head = true;
+
+        const struct { const char *name; int v; } c[] =
+        {
+            { "rx", ic.rx }, { "tx", ic.tx }, { "frame", ic.frame }, { "overrun", ic.overrun },
+            { "parity", ic.parity }, { "break", ic.brk }, { "buf_overrun", ic.buf_overrun },
+        };
+        for (unsigned k=0; k<sizeof(c)/sizeof(c[0]); k++)
+            str::sappend(r, "con_uart_events_total{port=\"%s\",type=\"%s\"} %u\n",
+                         label(names[i]).c_str(), c[k].name, (unsigned)c[k].v);
+    }
+    pthread_mutex_unlock(&lock);
+
+    str::sappend(r, "# HELP con_uptime_seconds Time since start\n"
+                    "# TYPE con_uptime_seconds gauge\n"
+                    "con_uptime_seconds %llu\n"
+                    "# HELP con_sessions_total Sessions (connections) relayed\n"
+                    "# TYPE con_sessions_total counter\n"
+                    "con_sessions_total %llu\n"
+                    "# HELP con_session_failures_total Sessions ended by an error\n"
+                    "# TYPE con_session_failures_total counter\n"
+                    "con_session_failures_total %llu\n"
+                    "# HELP con_session_active 1 while a session is relayed\n"
+                    "# TYPE con_session_active gauge\n"
+                    "con_session_active %llu\n",
+                 (unsigned long long)(now_s() - started), (unsigned long long)get(sessions),
+                 (unsigned long long)get(failures), (unsigned long long)get(active));
+
+    const struct { const char *name; const char *type; const char *help; size_t off; double scale; } m[] =
+    {
+        { "con_bytes_total",              "counter", "Bytes read",                               offsetof(Dir, bytes),    1 },
+        { "con_reads_total",              "counter", "Reads",                                    offsetof(Dir, reads),    1 },
+        { "con_writes_total",             "counter", "Writes",                                   offsetof(Dir, writes),   1 },
+        { "con_write_stalls_total",       "counter", "Writes which blocked for 10 ms or more",   offsetof(Dir, stalls),   1 },
+        { "con_write_stall_seconds_total","counter", "Time spent in stalled writes",             offsetof(Dir, stall_us), 1e-6 },
+        { "con_queue_bytes",              "gauge",   "Data read and not written yet",            offsetof(Dir, queue),    1 },
+        { "con_dropped_bytes_total",      "counter", "Data dropped by a full receive ring",      offsetof(Dir, dropped),  1 },
+    };
+    for (unsigned k=0; k<sizeof(m)/sizeof(m[0]); k++)
+    {
+        str::sappend(r, "# HELP %s %s\n# TYPE %s %s\n", m[k].name, m[k].help, m[k].name, m[k].type);
+        for (int i=0; i<2; i++)
+        {
+            uint64_t v = *(const uint64_t *)((const char *)&d[i] + m[k].off);
+            if (m[k].scale == 1)
+                str::sappend(r, "%s{dir=\"%s\"} %llu\n", m[k].name, dname[i], (unsigned long long)v);
+            else
+                str::sappend(r, "%s{dir=\"%s\"} %.6f\n", m[k].name, dname[i], v * m[k].scale);
+        }
+    }
+
+    // Quantiles are interpolated inside the log2 buckets
+    r += "# HELP con_relay_latency_seconds Time from read to the end of write\n"
+         "# TYPE con_relay_latency_seconds summary\n";
+    for (int i=0; i<2; i++)
+    {
+        for (unsigned q=0; q<sizeof(qs)/sizeof(qs[0]); q++)
+        {
+            double v = 0;
+            if (d[i].writes)
+            {
+                double   want = qs[q] * d[i].writes;
+                uint64_t below = 0;
+                for (int b=0; b<NBUCKETS; b++)
+                {
+                    if (below + d[i].lat[b] >= want  &&  d[i].lat[b])
+                    {
+                        double lo = b ? (double)(1ULL << b) : 0;
+                        double hi = (double)(1ULL << (b + 1));
+                        v = lo + (hi - lo) * (want - below) / d[i].lat[b];
+                        break;
+                    }
+                    below += d[i].lat[b];
+                }
+            }
+            str::sappend(r, "con_relay_latency_seconds{dir=\"%s\",quantile=\"%g\"} %.6f\n", dname[i], qs[q], v * 1e-6);
+        }
+        str::sappend(r, "con_relay_latency_seconds_sum{dir=\"%s\"} %.6f\n"
+                        "con_relay_latency_seconds_count{dir=\"%s\"} %llu\n",
+                     dname[i], d[i].lat_sum * 1e-6, dname[i], (unsigned long long)d[i].writes);
+    }
+    return r;
+}
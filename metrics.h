@@ -0,0 +1,115 @@
+/*********************
+ * Metrics endpoint
+ *********************
+ *
+ */
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+/*!
+  \class Metrics
+  \brief Live counters of the relay in Prometheus text format
+
+  The relay thread is the only writer of every counter, it updates them
+  with plain relaxed atomic stores, no locks and no read-modify-write.
+  A server thread answers every connection to a UNIX socket or to a
+  localhost TCP port with a snapshot of the counters: as plain text, or
+  as an HTTP response if the client sends a GET request (Prometheus,
+  curl). UART error counters are read from the driver (TIOCGICOUNT) by
+  the server thread at that time.
+
+  Directions: IN - from the target, OUT - to the target.
+*/
+class Metrics
+{
+public:
+    enum { IN, OUT };
+
+    Metrics();
+    ~Metrics();
+
+    /*! Start serving on "unix:PATH" or "tcp:PORT" (127.0.0.1)
+      \return false on failure, errno is set
+     */
+    bool serve(const char *spec);
+    bool enabled() const { return running; }
+
+    //! Stop the server, remove the socket
+    void stop();
+
+    /*! Relay session starts. Session info is the only thing shared under
+      a lock, it changes rarely
+      \param target_fd, other_fd descriptors for UART counters, if ttys
+     */
+    void session_start(const char *target, const char *other, const int target_fd, const int other_fd);
+    void session_end(const bool ok);
+
+    //! \e n bytes read in direction \e dir
+    void read(const int dir, const size_t n)
+    {
+        Dir& d = dirs[dir];
+        set(d.bytes, d.bytes + n);
+        set(d.reads, d.reads + 1);
+    }
+
+    /*! Data written in direction \e dir
+      \param latency_us time since the data was read
+      \param write_us time the write took, long ones are counted as stalls
+     */
+    void written(const int dir, const uint64_t latency_us, const uint64_t write_us);
+
+    //! Data read but not written yet and data dropped in direction \e dir
+    void queue(const int dir, const size_t n, const uint64_t dropped)
+    {
+        set(dirs[dir].queue, n);
+        set(dirs[dir].dropped, dropped);
+    }
+
+private:
+    static const int      NBUCKETS = 32;     // log2 of microseconds
+    static const uint64_t STALL_US = 10000;
+
+    struct Dir
+    {
+        uint64_t bytes;
+        uint64_t reads;
+        uint64_t writes;
+        uint64_t stalls;
+        uint64_t stall_us;
+        uint64_t queue;
+        uint64_t dropped;
+        uint64_t lat_sum;                 // us
+        uint64_t lat[NBUCKETS];
+    } __attribute__((aligned(64)));
+
+    Dir             dirs[2];
+    uint64_t        sessions;
+    uint64_t        failures;
+    uint64_t        active;
+    uint64_t        started;              // s, CLOCK_MONOTONIC
+
+    pthread_mutex_t lock;                 // session info
+    std::string     names[2];
+    int             fds[2];
+
+    bool            running;
+    pthread_t       thread;
+    int             lsn;
+    int             quit;                 // eventfd
+    std::string     path;                 // UNIX socket to remove
+
+    static void set(uint64_t& c, const uint64_t v) { __atomic_store_n(&c, v, __ATOMIC_RELAXED); }
+    static uint64_t get(const uint64_t& c)         { return __atomic_load_n(&c, __ATOMIC_RELAXED); }
+
+    static void *run(void *arg);
+    void        answer(const int fd);
+    std::string render();
+};
+
+#endif
@@ -0,0 +1,361 @@
+/*********************
+ * Paced text send
+ *********************
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <deque>
+
+#include "pace.h"
+#include "str_utils.h"
+
+static uint64_t now_ms()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static uint64_t now_us()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static bool parse_num(const char *s, long& v, const long min, const long max)
+{
+    char *end;
+    v = strtol(s, &end, 0);
+    return end != s  &&  !*end  &&  v >= min  &&  v <= max;
+}
+
+bool pace::parse(const char *s, Config& c)
+{
+    const char *arg = strchr(s, ':');
+    std::string name = arg ? std::string(s, arg - s) : s;
+    long        v;
+
+    c = Config();
+    if (arg)
+        arg++;
+    if (name == "none")
+        c.mode = NONE;
+    else if (name == "chunk")
+    {
+        c.mode = CHUNK;
+        if (arg)
+        {
+            const char *d = strchr(arg, ':');
+            std::string size = d ? std::string(arg, d - arg) : arg;
+            if (!parse_num(size.c_str(), v, 1, 65536))
+                return false;
+            c.chunk = v;
+            if (d)
+            {
+                if (!parse_num(d + 1, v, 0, 60000))
+                    return false;
+                c.delay_ms = v;
+            }
+        }
+    }
+    else if (name == "line")
+    {
+        c.mode = LINE;
+        if (arg)
+        {
+            if (!parse_num(arg, v, 1, 600000))
+                return false;
+            c.timeout_ms = v;
+        }
+    }
+    else if (name == "prompt")
+    {
+        c.mode = PROMPT;
+        c.timeout_ms = 5000;
+        if (!arg || !*arg)
+            return false;
+        std::string p = arg;
+        size_t      d = p.rfind(':');
+        if (d != std::string::npos  &&  d + 1 < p.size()  &&  parse_num(p.c_str() + d + 1, v, 1, 600000))
+        {
+            c.timeout_ms = v;
+            p.erase(d);
+        }
+        c.prompt = str::unescape(p);
+        if (c.prompt.empty())
+            return false;
+    }
+    else if (name == "adaptive")
+        c.mode = ADAPTIVE;
+    else
+        return false;
+    return true;
+}
+
+void pace::as_typed(std::string& s)
+{
+    size_t o = 0;
+
+    for (size_t i=0; i<s.size(); i++)
+    {
+        if (s[i] == '\r'  &&  i + 1 < s.size()  &&  s[i+1] == '\n')
+            continue;
+        s[o++] = s[i] == '\n' ? '\r' : s[i];
+    }
+    s.resize(o);
+}
+
+namespace
+{
+    class Pacer
+    {
+    public:
+        Pacer(XferIo& io, const pace::Config& c, pace::Stats& st) : io(io), c(c), st(st) {}
+
+        bool chunks(const std::string& t, size_t off);
+        bool lines(const std::string& t);
+        bool adaptive(const std::string& t);
+
+    private:
+        XferIo&             io;
+        const pace::Config& c;
+        pace::Stats&        st;
+        unsigned char       buf[4096];
+
+        int  pump(const int timeout_ms);
+        bool wait(const int ms);
+        bool wait_for(const std::string& what, const int timeout_ms);
+    };
+};
+
+// Receive and show whatever comes in timeout_ms, returns bytes read or -1
+int Pacer::pump(const int timeout_ms)
+{
+    int n = io.read(buf, sizeof(buf), timeout_ms);
+    if (n > 0)
+        io.pass(buf, n);
+    return n;
+}
+
+// Pause, the received data is shown meanwhile
+bool Pacer::wait(const int ms)
+{
+    uint64_t deadline = now_ms() + ms;
+
+    for (;;)
+    {
+        uint64_t now = now_ms();
+        int      n = pump(now < deadline ? deadline - now : 0);
+        if (n < 0)
+            return false;
+        if (!n  &&  now_ms() >= deadline)
+            return true;
+    }
+}
+
+// Wait until any of the characters "what" (one char) or the string "what" arrives
+bool Pacer::wait_for(const std::string& what, const int timeout_ms)
+{
+    uint64_t    deadline = now_ms() + timeout_ms;
+    std::string tail;
+
+    for (;;)
+    {
+        uint64_t now = now_ms();
+        if (now >= deadline)
+        {
+            st.timeouts++;
+            return true;
+        }
+        int n = pump(deadline - now);
+        if (n < 0)
+            return false;
+        if (c.mode == pace::LINE)
+        {
+            if (memchr(buf, '\r', n) || memchr(buf, '\n', n))
+                return true;
+            continue;
+        }
+        tail.append((const char *)buf, n);
+        if (tail.find(what) != std::string::npos)
+            return true;
+        if (tail.size() >= what.size())
+            tail.erase(0, tail.size() - what.size() + 1);
+    }
+}
+
+bool Pacer::chunks(const std::string& t, size_t off)
+{
+    while (off < t.size())
+    {
+        size_t n = t.size() - off < c.chunk ? t.size() - off : c.chunk;
+        if (!io.write(t.data() + off, n)  ||  !io.drain())
+            return false;
+        off += n;
+        st.sent += n;
+        if (!wait(c.delay_ms))
+            return false;
+    }
+    return true;
+}
+
+bool Pacer::lines(const std::string& t)
+{
+    size_t off = 0;
+
+    while (off < t.size())
+    {
+        size_t e = t.find('\r', off);
+        size_t n = e == std::string::npos ? t.size() - off : e - off + 1;
+
+        // Output of the previous line shouldn't be taken for the echo
+        if (!wait(0))
+            return false;
+        if (!io.write(t.data() + off, n))
+            return false;
+        off += n;
+        st.sent += n;
+        if (e != std::string::npos  &&  !wait_for(c.prompt, c.timeout_ms))
+            return false;
+    }
+    return true;
+}
+
+/* Sliding window of unechoed bytes. The window grows while the echoed
+   throughput grows with it: once the device is the bottleneck a bigger
+   window only fills its input buffer, so it's kept. Echo not received
+   in a few smoothed echo lags halves the window, if it doesn't come
+   at all the characters are taken as lost.
+*/
+bool Pacer::adaptive(const std::string& t)
+{
+    const size_t   MAXWIN = 4096;
+    const uint64_t STALL_MAX = 500000;
+    size_t         window = 4;
+    size_t         sent = 0;
+    size_t         echoed = 0;        // echo is matched up to here
+    bool           any_echo = false;
+    uint64_t       lag = 0;           // smoothed echo lag, us
+    double         best = 0;          // best echoed throughput, bytes/us
+    size_t         ck_pos = 0;        // throughput checkpoint
+    uint64_t       ck_time = now_us();
+    uint64_t       stall = 0;         // echo is waited for since
+    std::deque<std::pair<size_t, uint64_t> > marks;   // end of every write and its time
+
+    while (echoed < t.size())
+    {
+        if (sent < t.size()  &&  sent - echoed < window)
+        {
+            size_t n = window - (sent - echoed);
+            if (n > t.size() - sent)
+                n = t.size() - sent;
+            if (!io.write(t.data() + sent, n))
+                return false;
+            sent += n;
+            st.sent += n;
+            marks.push_back(std::make_pair(sent, now_us()));
+        }
+
+        int timeout = lag ? (int)(lag * 4 / 1000) : 200;
+        if (timeout < 10)
+            timeout = 10;
+        if (timeout > 500)
+            timeout = 500;
+        int n = pump(timeout);
+        if (n < 0)
+            return false;
+        if (n == 0)
+        {
+            if (!any_echo  &&  st.timeouts >= 3)
+            {
+                io.message("no echo from the device, using chunk pacing");
+                st.window = window;
+                return chunks(t, sent);
+            }
+            // The device is busy or the echo is lost: slow down once per
+            // stall and probe the window again, resync if echo doesn't come
+            if (!stall)
+            {
+                st.timeouts++;
+                window = window > 1 ? window / 2 : 1;
+                best = 0;
+                stall = now_us();
+                continue;
+            }
+            if (now_us() - stall < STALL_MAX)
+                continue;
+            echoed = sent;
+            marks.clear();
+            stall = 0;
+            ck_pos = echoed;
+            ck_time = now_us();
+            continue;
+        }
+        stall = 0;
+
+        // Match the echo, everything else is device output
+        for (int i=0; i<n  &&  echoed < sent; i++)
+            if (buf[i] == (unsigned char)t[echoed])
+            {
+                echoed++;
+                any_echo = true;
+            }
+
+        uint64_t now = now_us();
+        while (!marks.empty()  &&  marks.front().first <= echoed)
+        {
+            uint64_t sample = now - marks.front().second;
+            lag = lag ? (lag * 7 + sample) / 8 : sample + 1;
+            marks.pop_front();
+        }
+        if (echoed - ck_pos >= window)
+        {
+            double rate = (double)(echoed - ck_pos) / (now > ck_time ? now - ck_time : 1);
+            if (rate > best * 1.1)
+            {
+                best = rate;
+                window += window / 4 + 1;
+                if (window > MAXWIN)
+                    window = MAXWIN;
+            }
+            else if (rate > best)
+                best = rate;
+            ck_pos = echoed;
+            ck_time = now;
+        }
+    }
+    st.window = window;
+    return true;
+}
+
+bool pace::send(XferIo& io, const Config& c, const std::string& text, Stats& st)
+{
+    Pacer    p(io, c, st);
+    uint64_t start = now_ms();
+    bool     ok;
+
+    switch (c.mode)
+    {
+    case CHUNK:
+        ok = p.chunks(text, 0);
+        break;
+    case LINE:
+    case PROMPT:
+        ok = p.lines(text);
+        break;
+    case ADAPTIVE:
+        ok = p.adaptive(text);
+        break;
+    default:
+        ok = io.write(text.data(), text.size());
+        if (ok)
+            st.sent = text.size();
+        break;
+    }
+    st.elapsed_ms = now_ms() - start;
+    return ok;
+}
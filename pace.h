@@ -0,0 +1,71 @@
+/*********************
+ * Paced text send
+ *********************
+ *
+ */
+#ifndef PACE_H
+#define PACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "xfer.h"
+
+/*
+  Sending text to devices without flow control. Strategies:
+
+    NONE     - full speed
+    CHUNK    - chunks of "chunk" bytes, every chunk is drained (tcdrain)
+               and followed by "delay_ms" pause
+    LINE     - line by line, the next line goes when the echo of the
+               line end is received or after "timeout_ms"
+    PROMPT   - line by line, the next line goes when "prompt" is received
+               or after "timeout_ms"
+    ADAPTIVE - window of unechoed bytes, grows while the echoed
+               throughput grows with it and is halved when echo doesn't
+               arrive in time. The time is derived from observed echo
+               lag. Falls back to CHUNK if the device doesn't echo at all
+*/
+namespace pace
+{
+    enum Mode { NONE, CHUNK, LINE, PROMPT, ADAPTIVE };
+
+    struct Config
+    {
+        Mode        mode;
+        size_t      chunk;
+        int         delay_ms;
+        int         timeout_ms;
+        std::string prompt;
+
+        Config() : mode(NONE), chunk(16), delay_ms(5), timeout_ms(1000) {}
+    };
+
+    struct Stats
+    {
+        uint64_t sent;
+        uint64_t elapsed_ms;
+        unsigned timeouts;     // waits for echo or prompt which timed out
+        size_t   window;       // final window of ADAPTIVE
+
+        Stats() : sent(0), elapsed_ms(0), timeouts(0), window(0) {}
+    };
+
+    /*! Parse pacing: "none", "chunk[:SIZE[:MS]]", "line[:MS]",
+      "prompt:STRING[:MS]" or "adaptive". STRING may contain C escapes
+     */
+    bool parse(const char *s, Config& c);
+
+    //! Convert text to what is typed on keyboard: "\r\n" and "\n" become "\r"
+    void as_typed(std::string& s);
+
+    /*! Send the text. Everything received meanwhile is passed to
+      XferIo::pass()
+      \return false on failure or abort
+     */
+    bool send(XferIo& io, const Config& c, const std::string& text, Stats& st);
+};
+
+#endif
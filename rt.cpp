@@ -0,0 +1,225 @@
+/*********************
+ * Real-time support
+ *********************
+ *
+ */
+#include <errno.h>
+#include <malloc.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "rt.h"
+
+////////////////////////////////////////////////////////////////////////
+bool rt::parse_cpus(const char *s, std::vector<int>& cpus)
+{
+    const char *p = s;
+
+    cpus.clear();
+    while (*p)
+    {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0 || first >= CPU_SETSIZE)
+            return false;
+        long last = first;
+        p = end;
+        if (*p == '-')
+        {
+            last = strtol(++p, &end, 10);
+            if (end == p || last < first || last >= CPU_SETSIZE)
+                return false;
+            p = end;
+        }
+        for (long c = first; c <= last; c++)
+            cpus.push_back((int)c);
+        if (*p == ',')
+            p++;
+        else if (*p)
+            return false;
+    }
+    return !cpus.empty();
+}
+
+////////////////////////////////////////////////////////////////////////
+bool rt::set_thread(pthread_t t, const int prio, const int cpu)
+{
+    if (cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        int rc = pthread_setaffinity_np(t, sizeof(set), &set);
+        if (rc)
+        {
+            errno = rc;
+            return false;
+        }
+    }
+    if (prio > 0)
+    {
+        sched_param sp;
+        memset(&sp, 0, sizeof(sp));
+        sp.sched_priority = prio;
+        int rc = pthread_setschedparam(t, SCHED_FIFO, &sp);
+        if (rc)
+        {
+            errno = rc;
+            return false;
+        }
+    }
+    return true;
+}
+
+int rt::spare_cpu(const std::vector<int>& used)
+{
+    cpu_set_t set;
+
+    if (used.empty()  ||  sched_getaffinity(0, sizeof(set), &set) < 0)
+        return -1;
+    for (size_t i=0; i<used.size(); i++)
+        if (used[i] >= 0  &&  used[i] < CPU_SETSIZE)
+            CPU_CLR(used[i], &set);
+    for (int cpu=0; cpu<CPU_SETSIZE; cpu++)
+        if (CPU_ISSET(cpu, &set))
+            return cpu;
+    return -1;
+}
+
+////////////////////////////////////////////////////////////////////////
+static void prefault_stack()
+{
+    const size_t  STACK_PREFAULT = 512 * 1024;
+    unsigned char dummy[STACK_PREFAULT];
+
+    memset(dummy, 0, sizeof(dummy));
+    __asm__ __volatile__("" : : "r"(dummy) : "memory");
+}
+
+bool rt::lock_memory()
+{
+    // Freed memory stays in the process, no mmap() for big blocks
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+
+    // MCL_CURRENT populates all the mappings, static buffers included
+    if (mlockall(MCL_CURRENT | MCL_FUTURE))
+        return false;
+    prefault_stack();
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+rt::Probe::Probe()
+    : running(false)
+    , quit(0)
+    , prio(0)
+    , cpu(-1)
+    , period(1000)
+    , count(0)
+    , sum(0)
+    , min(0)
+    , max(0)
+{
+    memset(hist, 0, sizeof(hist));
+}
+
+rt::Probe::~Probe()
+{
+    stop();
+}
+
+bool rt::Probe::start(const int p, const int c, const unsigned period_us)
+{
+    prio = p;
+    cpu = c;
+    period = period_us;
+    __atomic_store_n(&quit, 0, __ATOMIC_RELAXED);
+    int rc = pthread_create(&thread, 0, run, this);
+    if (rc)
+    {
+        errno = rc;
+        return false;
+    }
+    running = true;
+    return true;
+}
+
+void rt::Probe::stop()
+{
+    if (!running)
+        return;
+    __atomic_store_n(&quit, 1, __ATOMIC_RELAXED);
+    pthread_join(thread, 0);
+    running = false;
+}
+
+void *rt::Probe::run(void *arg)
+{
+    Probe    *pr = (Probe *)arg;
+    timespec next, now;
+
+    set_thread(pthread_self(), pr->prio, pr->cpu);
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (!__atomic_load_n(&pr->quit, __ATOMIC_RELAXED))
+    {
+        next.tv_nsec += pr->period * 1000L;
+        while (next.tv_nsec >= 1000000000L)
+        {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, 0))
+            continue;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        int64_t lat = (now.tv_sec - next.tv_sec) * 1000000000LL + (now.tv_nsec - next.tv_nsec);
+        if (lat < 0)
+            lat = 0;
+        uint64_t us = lat / 1000;
+        pr->hist[us < MAXUS ? us : MAXUS]++;
+        if (!pr->count || (uint64_t)lat < pr->min)
+            pr->min = lat;
+        if ((uint64_t)lat > pr->max)
+            pr->max = lat;
+        pr->sum += lat;
+        pr->count++;
+
+        // Overrun: don't try to catch up
+        if (lat > (int64_t)pr->period * 1000)
+            next = now;
+    }
+    return 0;
+}
+
+uint64_t rt::Probe::percentile(const double p) const
+{
+    uint64_t need = (uint64_t)(count * p);
+    uint64_t seen = 0;
+
+    for (unsigned i=0; i<=MAXUS; i++)
+    {
+        seen += hist[i];
+        if (seen > need)
+            return i;
+    }
+    return MAXUS;
+}
+
+void rt::Probe::report(FILE *f) const
+{
+    if (!count)
+        return;
+    fprintf(f, "Scheduling latency: %llu samples, min %llu us, avg %llu us, max %llu us, "
+            "99%% < %llu us, 99.9%% < %llu us%s\r\n",
+            (unsigned long long)count,
+            (unsigned long long)(min / 1000),
+            (unsigned long long)(sum / count / 1000),
+            (unsigned long long)(max / 1000),
+            (unsigned long long)percentile(0.99) + 1,
+            (unsigned long long)percentile(0.999) + 1,
+            hist[MAXUS] ? " (overflows present)" : "");
+}
@@ -0,0 +1,88 @@
+/*********************
+ * Real-time support
+ *********************
+ *
+ */
+#ifndef RT_H
+#define RT_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+namespace rt
+{
+    /*! Parse CPU list like "2", "1,3" or "0-3"
+      \return false on syntax error
+     */
+    bool parse_cpus(const char *s, std::vector<int>& cpus);
+
+    /*! Set scheduling of thread \e t
+      \param prio SCHED_FIFO priority, 0 - don't change
+      \param cpu CPU to pin to, -1 - don't change
+      \return false on failure, errno is set
+     */
+    bool set_thread(pthread_t t, const int prio, const int cpu);
+
+    /*! First CPU of the process affinity not in \e used
+      \return the CPU, -1 if \e used is empty or has them all
+     */
+    int spare_cpu(const std::vector<int>& used);
+
+    /*! Lock all current and future memory, disable heap trimming
+      and prefault the stack
+      \return false on failure, errno is set
+     */
+    bool lock_memory();
+
+    /*!
+      \class Probe
+      \brief Scheduling latency probe
+
+      A thread wakes up periodically on absolute deadlines (like
+      cyclictest) with the priority of the relay and records how late
+      it was woken up. Give it a CPU the relay doesn't use, see
+      spare_cpu(), or it competes with the relay it measures.
+    */
+    class Probe
+    {
+    public:
+        Probe();
+        ~Probe();
+
+        /*! Start the probe thread
+          \param prio SCHED_FIFO priority, 0 - SCHED_OTHER
+          \param cpu CPU to pin to, -1 - any
+          \param period_us wake up period in microseconds
+         */
+        bool start(const int prio, const int cpu, const unsigned period_us = 1000);
+
+        //! Stop the probe thread
+        void stop();
+
+        //! Print the statistics
+        void report(FILE *f) const;
+
+    private:
+        static const unsigned MAXUS = 10000;
+
+        pthread_t   thread;
+        bool        running;
+        int         quit;
+        int         prio;
+        int         cpu;
+        unsigned    period;
+        uint64_t    count;
+        uint64_t    sum;
+        uint64_t    min;
+        uint64_t    max;
+        uint32_t    hist[MAXUS + 1];   // 1us buckets, the last is overflow
+
+        static void *run(void *arg);
+        uint64_t    percentile(const double p) const;
+    };
+};
+
+#endif
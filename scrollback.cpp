@@ -0,0 +1,215 @@
+/*********************
+ * Scrollback buffer
+ *********************
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "scrollback.h"
+
+Scrollback::Scrollback()
+    : nsegs(0)
+    , count(0)
+    , cur(0)
+    , total(0)
+    , nlines(0)
+{
+}
+
+Scrollback::~Scrollback()
+{
+    for (size_t i=0; i<segs.size(); i++)
+        free(segs[i].data);
+}
+
+void Scrollback::init(const size_t size)
+{
+    nsegs = (size + SEG_SIZE - 1) / SEG_SIZE;
+    if (nsegs < 2)
+        nsegs = 2;
+    segs.resize(nsegs);
+    for (size_t i=0; i<nsegs; i++)
+    {
+        segs[i].data = 0;
+        segs[i].used = 0;
+        segs[i].base = 0;
+        segs[i].first_line = 0;
+    }
+}
+
+void Scrollback::append(const unsigned char *p, size_t n)
+{
+    if (!nsegs)
+        return;
+
+    while (n)
+    {
+        Seg *s = &segs[cur];
+        if (!count || s->used == SEG_SIZE)
+        {
+            // Next segment, the oldest one is reused when all are in use
+            if (count)
+                cur = (cur + 1) % nsegs;
+            else
+                cur = 0;
+            if (count < nsegs)
+                count++;
+            s = &segs[cur];
+            if (!s->data)
+                s->data = (unsigned char *)malloc(SEG_SIZE);
+            if (!s->data)
+            {
+                // No memory - keep what we have
+                count--;
+                cur = (cur + nsegs - 1) % nsegs;
+                return;
+            }
+            s->used = 0;
+            s->base = total;
+            s->first_line = nlines;
+            s->lines.clear();
+        }
+
+        size_t chunk = std::min(n, SEG_SIZE - s->used);
+        memcpy(s->data + s->used, p, chunk);
+
+        const unsigned char *q = s->data + s->used;
+        const unsigned char *e = q + chunk;
+        while ((q = (const unsigned char *)memchr(q, '\n', e - q)))
+        {
+            q++;
+            s->lines.push_back(q - s->data);
+            nlines++;
+        }
+
+        s->used += chunk;
+        total += chunk;
+        p += chunk;
+        n -= chunk;
+    }
+}
+
+const Scrollback::Seg *Scrollback::seg_n(const size_t age) const
+{
+    if (age >= count)
+        return 0;
+    return &segs[(cur + nsegs - age) % nsegs];
+}
+
+uint64_t Scrollback::begin() const
+{
+    const Seg *s = seg_n(count ? count - 1 : 0);
+    return s ? s->base : total;
+}
+
+const Scrollback::Seg *Scrollback::seg_at(const uint64_t pos) const
+{
+    for (size_t age=0; age<count; age++)
+    {
+        const Seg *s = seg_n(age);
+        if (pos >= s->base && pos < s->base + s->used)
+            return s;
+    }
+    return 0;
+}
+
+uint64_t Scrollback::line_at(const uint64_t pos) const
+{
+    const Seg *s = seg_at(pos);
+
+    if (!s)
+        return pos >= total ? nlines : 0;
+    uint32_t off = pos - s->base;
+    return s->first_line + (std::upper_bound(s->lines.begin(), s->lines.end(), off) - s->lines.begin());
+}
+
+uint64_t Scrollback::line_start(const uint64_t line) const
+{
+    if (line > nlines)
+        return total;
+    if (line == 0)
+        return begin();
+    for (size_t age=0; age<count; age++)
+    {
+        const Seg *s = seg_n(age);
+        if (line > s->first_line  &&  line <= s->first_line + s->lines.size())
+            return s->base + s->lines[line - s->first_line - 1];
+    }
+    return begin();
+}
+
+void Scrollback::copy(uint64_t from, const uint64_t to, std::string& out) const
+{
+    if (from < begin())
+        from = begin();
+    while (from < to)
+    {
+        const Seg *s = seg_at(from);
+        if (!s)
+            break;
+        size_t off = from - s->base;
+        size_t n = std::min((uint64_t)(s->used - off), to - from);
+        out.append((const char *)s->data + off, n);
+        from += n;
+    }
+}
+
+// Last occurrence of pat in p[0..n)
+int64_t Scrollback::rfind_in(const unsigned char *p, const size_t n, const std::string& pat) const
+{
+    const unsigned char *q = p;
+    const unsigned char *e = p + n;
+    int64_t             last = -1;
+
+    while (q < e)
+    {
+        const unsigned char *m = (const unsigned char *)memmem(q, e - q, pat.data(), pat.size());
+        if (!m)
+            break;
+        last = m - p;
+        q = m + 1;
+    }
+    return last;
+}
+
+int64_t Scrollback::rfind(const std::string& pat, const uint64_t before) const
+{
+    const size_t m = pat.size();
+
+    if (!m || m > MAXPAT)
+        return -1;
+
+    for (size_t age=0; age<count; age++)
+    {
+        const Seg *s = seg_n(age);
+        if (s->base >= before)
+            continue;
+
+        // Matches inside the segment, must start before "before"
+        size_t  lim = std::min((uint64_t)s->used, before - s->base + m - 1);
+        int64_t r = rfind_in(s->data, lim, pat);
+        if (r >= 0  &&  s->base + r < before)
+            return s->base + r;
+
+        // Matches crossing the boundary with the previous segment
+        const Seg *prev = seg_n(age + 1);
+        if (!prev || m < 2 || prev->used < m - 1)
+            continue;
+        unsigned char joint[2 * MAXPAT];
+        size_t        tail = m - 1;
+        size_t        head = std::min(m - 1, s->used);
+        memcpy(joint, prev->data + prev->used - tail, tail);
+        memcpy(joint + tail, s->data, head);
+        r = rfind_in(joint, tail + head, pat);
+        if (r >= 0  &&  (size_t)r < tail)
+        {
+            uint64_t pos = prev->base + prev->used - tail + r;
+            if (pos < before)
+                return pos;
+        }
+    }
+    return -1;
+}
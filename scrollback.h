@@ -0,0 +1,88 @@
+/*********************
+ * Scrollback buffer
+ *********************
+ *
+ */
+#ifndef SCROLLBACK_H
+#define SCROLLBACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+/*!
+  \class Scrollback
+  \brief Bounded in-memory history of the session
+
+  The history is kept in a ring of fixed size segments, the oldest
+  segment is reused when the ring is full. Every segment has an index
+  of line starts, so lines can be found without scanning. Positions are
+  absolute byte offsets since the start of the session.
+*/
+class Scrollback
+{
+public:
+    static const size_t SEG_SIZE = 1024 * 1024;
+    static const size_t MAXPAT = 256;
+
+    Scrollback();
+    ~Scrollback();
+
+    /*! Enable the scrollback
+      \param size maximal memory to use, rounded up to segment size.
+      Segments are allocated on demand
+     */
+    void init(const size_t size);
+    bool enabled() const   { return nsegs != 0; }
+
+    //! Append data to the history
+    void append(const unsigned char *p, size_t n);
+
+    //! Absolute offset of the oldest byte still kept
+    uint64_t begin() const;
+    //! Absolute offset of the end of history
+    uint64_t end() const   { return total;      }
+    //! Number of the current (last) line, counting from 0
+    uint64_t lines() const { return nlines;     }
+
+    /*! Find the last occurrence of \e pat which starts before \e before
+      \return absolute offset of the match or -1 if not found
+     */
+    int64_t  rfind(const std::string& pat, const uint64_t before) const;
+
+    //! Number of the line containing absolute offset \e pos
+    uint64_t line_at(const uint64_t pos) const;
+
+    /*! Absolute offset of the start of line \e line. If the line is not
+      kept anymore begin() is returned, end() if it doesn't exist yet
+     */
+    uint64_t line_start(const uint64_t line) const;
+
+    //! Copy the history between absolute offsets \e from and \e to
+    void     copy(uint64_t from, const uint64_t to, std::string& out) const;
+
+private:
+    struct Seg
+    {
+        unsigned char         *data;
+        size_t                used;
+        uint64_t              base;        // absolute offset of data[0]
+        uint64_t              first_line;  // line containing data[0]
+        std::vector<uint32_t> lines;       // offsets of line starts
+    };
+
+    std::vector<Seg> segs;
+    size_t           nsegs;   // maximal number of segments
+    size_t           count;   // segments in use
+    size_t           cur;     // the newest segment
+    uint64_t         total;
+    uint64_t         nlines;
+
+    const Seg *seg_at(const uint64_t pos) const;
+    const Seg *seg_n(const size_t age) const;      // 0 - the newest
+    int64_t    rfind_in(const unsigned char *p, const size_t n, const std::string& pat) const;
+};
+
+#endif
@@ -0,0 +1,431 @@
+/*********************
+ * Relay session for embedding
+ *********************
+ *
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "session.h"
+#include "str_utils.h"
+
+static const int BUFSIZE = 4096;
+static const int PTY_POLL_MS = 10;       // pty slave open is not signalled by poll()
+
+static void nonblock(const int fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+Session::Handler::~Handler()
+{
+}
+
+void Session::Handler::message(Session&, const char *)
+{
+}
+
+Session::Session()
+    : handler(0)
+    , started(false)
+    , done(true)
+{
+    for (int s=0; s<2; s++)
+    {
+        side[s].used = false;
+        side[s].eof = false;
+        side[s].shut = false;
+        side[s].off = 0;
+        side[s].rx = 0;
+    }
+}
+
+Session::~Session()
+{
+    close();
+}
+
+bool Session::open(const char *target, const char *other, Handler *h, const Options& o)
+{
+    const char *spec[2] = { target, other };
+
+    close();
+    err.clear();
+    opts = o;
+    handler = h;
+    tstamp = Tstamp();
+    done = false;
+
+    for (int s=0; s<2; s++)
+    {
+        Part& a = side[s];
+        a.used = spec[s] != 0;
+        a.rx = 0;
+        if (!a.used)
+            continue;
+        if (!a.ep.parse(spec[s]))
+        {
+            errno = EINVAL;
+            err = str::sprintf("Invalid endpoint \"%s\"", spec[s]);
+            close();
+            return false;
+        }
+        a.ep.tune(o.sock);
+        if (!a.ep.open(tty))
+        {
+            err = str::sprintf("\"%s\" %s: %s", spec[s], a.ep.what(), strerror(errno));
+            close();
+            return false;
+        }
+        if (a.ep.connected())
+            nonblock(a.ep.fd());
+    }
+
+    const char *what = 0;
+    if (o.log  &&  !logger.open(o.log, o.log_append))
+        what = o.log;
+    else if (o.timestamp  &&  !tstamp.set_mode(o.timestamp))
+    {
+        errno = EINVAL;
+        what = o.timestamp;
+    }
+    else if (o.capture  &&  !capture.open(o.capture))
+        what = o.capture;
+    if (what)
+    {
+        err = str::sprintf("\"%s\": %s", what, strerror(errno));
+        close();
+        return false;
+    }
+
+    if (connected())
+        start();
+    return true;
+}
+
+void Session::close()
+{
+    for (int s=0; s<2; s++)
+    {
+        side[s].ep.close();
+        side[s].out.clear();
+        side[s].off = 0;
+        side[s].eof = false;
+        side[s].shut = false;
+    }
+    capture.close();
+    logger.close();
+    started = false;
+    done = true;
+}
+
+bool Session::connected() const
+{
+    for (int s=0; s<2; s++)
+        if (side[s].used  &&  !side[s].ep.connected())
+            return false;
+    return side[TARGET].used;
+}
+
+// Listening endpoint with no connection yet
+bool Session::waiting(const int s) const
+{
+    return side[s].used  &&  !side[s].ep.connected()  &&  side[s].ep.listener();
+}
+
+bool Session::pending(const int s) const
+{
+    const Dgram *d = side[s].ep.dgram();
+    return d  &&  d->pending();
+}
+
+bool Session::fail(const int s, const char *what)
+{
+    err = str::sprintf("\"%s\" %s: %s", side[s].ep.name(), what, strerror(errno));
+    done = true;
+    return false;
+}
+
+void Session::message(const char *format, ...)
+{
+    if (!handler)
+        return;
+
+    va_list args;
+    va_start(args, format);
+    std::string msg = str::vsprintf(format, args);
+    va_end(args);
+    handler->message(*this, msg.c_str());
+}
+
+int Session::fds(pollfd *p) const
+{
+    int n = 0;
+
+    if (done)
+        return 0;
+    for (int s=0; s<2; s++)
+    {
+        const Part& a = side[s];
+        if (!a.used)
+            continue;
+        if (waiting(s))
+        {
+            if (a.ep.type() == Endpoint::PTY)
+                continue;
+            p[n].fd = a.ep.listen_fd();
+            p[n].events = POLLIN;
+            p[n].revents = 0;
+            n++;
+            continue;
+        }
+
+        // Hangup is reported regardless of the events, a side is polled
+        // when there is something to do with it
+        if (!started  ||  (a.eof  &&  !queued(s)))
+            continue;
+
+        // Read while the other side takes the data
+        const int o = 1 - s;
+        p[n].fd = a.ep.fd();
+        p[n].events = 0;
+        p[n].revents = 0;
+        if (!a.eof  &&  (!side[o].used  ||  queued(o) < opts.max_queue))
+            p[n].events |= POLLIN;
+        if (queued(s))
+            p[n].events |= POLLOUT;
+        n++;
+    }
+    return n;
+}
+
+int Session::timeout() const
+{
+    // Datagrams read already are not signalled by poll()
+    for (int s=0; s<2; s++)
+        if (!done  &&  started  &&  !side[s].eof  &&  pending(s))
+            return 0;
+    for (int s=0; s<2; s++)
+        if (!done  &&  waiting(s)  &&  side[s].ep.type() == Endpoint::PTY)
+            return PTY_POLL_MS;
+    return -1;
+}
+
+bool Session::accept(const int s)
+{
+    Endpoint& ep = side[s].ep;
+
+    if (!ep.accept())
+        return fail(s, ep.what());
+    nonblock(ep.fd());
+    message("%s: connection accepted from %s", ep.name(), ep.peer());
+    return true;
+}
+
+void Session::start()
+{
+    timespec ts;
+
+    started = true;
+    tstamp.start();
+    tstamp.now(ts);
+    capture.start(name(TARGET), side[OTHER].used ? name(OTHER) : "caller", ts);
+}
+
+bool Session::handle(const pollfd *p, const int n)
+{
+    if (done)
+        return false;
+
+    for (int s=0; s<2; s++)
+    {
+        if (!waiting(s))
+            continue;
+        bool ready = false;
+        if (side[s].ep.type() == Endpoint::PTY)
+            ready = side[s].ep.pending();
+        else
+            for (int i=0; i<n; i++)
+                if (p[i].fd == side[s].ep.listen_fd()  &&  (p[i].revents & POLLIN))
+                    ready = true;
+        if (ready  &&  !accept(s))
+            return false;
+    }
+    if (!started)
+    {
+        if (connected())
+            start();
+        return true;
+    }
+
+    for (int i=0; i<n; i++)
+        for (int s=0; s<2; s++)
+        {
+            if (!side[s].used  ||  p[i].fd != side[s].ep.fd()  ||  !p[i].revents)
+                continue;
+            if ((p[i].revents & POLLOUT)  &&  !flush(s))
+                return false;
+            if ((p[i].revents & (POLLIN | POLLHUP | POLLERR))  &&  !side[s].eof  &&  !receive(s))
+                return false;
+        }
+    for (int s=0; s<2; s++)
+        if (pending(s)  &&  !side[s].eof  &&  (!side[1 - s].used  ||  queued(1 - s) < opts.max_queue)  &&  !receive(s))
+            return false;
+
+    // After end of data the rest of the queue goes out. A socket gets
+    // the end of data then and the other direction goes on until it
+    // ends too, anything else ends the session
+    for (int s=0; s<2; s++)
+    {
+        const int o = 1 - s;
+        if (!side[s].eof  ||  (side[o].used  &&  queued(o)))
+            continue;
+        if (side[o].used  &&  !side[o].eof  &&  socket(o))
+        {
+            Dgram *d = side[o].ep.dgram();
+            if (!side[o].shut  &&  d)
+                d->end();
+            else if (!side[o].shut)
+                shutdown(side[o].ep.fd(), SHUT_WR);
+            side[o].shut = true;
+            continue;
+        }
+        capture.flush();
+        done = true;
+    }
+    return !done;
+}
+
+bool Session::receive(const int s)
+{
+    Part&         a = side[s];
+    unsigned char buf[BUFSIZE];
+    Dgram         *d = a.ep.dgram();
+    int           n = d ? d->read(buf, sizeof(buf)) : read(a.ep.fd(), buf, sizeof(buf));
+
+    if (n < 0  &&  (errno == EAGAIN  ||  errno == EINTR))
+        return true;
+    // pty master reads EIO when the slave is closed
+    if (n == 0  ||  (n < 0  &&  errno == EIO  &&  a.ep.type() == Endpoint::PTY))
+    {
+        message("%s: EOF", a.ep.name());
+        a.eof = true;
+        return true;
+    }
+    if (n < 0)
+        return fail(s, "read");
+
+    timespec ts;
+    a.rx += n;
+    if (capture.enabled()  ||  tstamp.enabled())
+        tstamp.now(ts);
+    capture.record(s == TARGET ? 0 : 1, ts, buf, n);
+    if (s == TARGET  &&  tstamp.enabled()  &&  logger.enabled())
+    {
+        stamped.resize(n * (Tstamp::MAXLEN + 1) + Tstamp::MAXLEN);
+        int k = tstamp.stamp(buf, n, ts, (unsigned char *)&stamped[0]);
+        logger.write((const unsigned char *)stamped.data(), k, opts.filter_colors);
+    }
+    else
+        logger.write(buf, n, opts.filter_colors);
+
+    if (s == OTHER)
+        return queue(TARGET, buf, n);
+    if (side[OTHER].used  &&  !queue(OTHER, buf, n))
+        return false;
+    if (handler)
+        handler->data(*this, buf, n);
+    return true;
+}
+
+bool Session::send(const void *p, const int n)
+{
+    if (done  ||  !side[TARGET].ep.connected())
+    {
+        errno = ENOTCONN;
+        return false;
+    }
+
+    timespec ts;
+    if (capture.enabled())
+        tstamp.now(ts);
+    capture.record(1, ts, (const unsigned char *)p, n);
+    logger.write((const unsigned char *)p, n, opts.filter_colors);
+    return queue(TARGET, p, n);
+}
+
+bool Session::queue(const int s, const void *p, const int n)
+{
+    Part& a = side[s];
+
+    if (!queued(s))
+    {
+        a.out.clear();
+        a.off = 0;
+    }
+    a.out.append((const char *)p, n);
+    return flush(s);
+}
+
+bool Session::flush(const int s)
+{
+    Part& a = side[s];
+
+    // Socket closed by the peer is a write error, not SIGPIPE to the
+    // whole process
+    Dgram *d = a.ep.dgram();
+    while (queued(s))
+    {
+        int n = d ? d->write(a.out.data() + a.off, queued(s)) :
+            socket(s) ? ::send(a.ep.fd(), a.out.data() + a.off, queued(s), MSG_NOSIGNAL) :
+                       write(a.ep.fd(), a.out.data() + a.off, queued(s));
+        if (n < 0  &&  errno == EINTR)
+            continue;
+        if (n < 0  &&  errno == EAGAIN)
+            break;
+        if (n < 0)
+            return fail(s, "write");
+        a.off += n;
+    }
+
+    // Written part is dropped when it's the most of the buffer
+    if (a.off > BUFSIZE  &&  a.off * 2 > a.out.size())
+    {
+        a.out.erase(0, a.off);
+        a.off = 0;
+    }
+    return true;
+}
+
+bool Session::run(const int timeout_ms)
+{
+    timespec start, now;
+    pollfd   p[MAXFDS];
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (!done)
+    {
+        int t = timeout();
+        if (timeout_ms >= 0)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            int left = timeout_ms - ((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000);
+            if (left <= 0)
+                return true;
+            if (t < 0  ||  left < t)
+                t = left;
+        }
+
+        int n = fds(p);
+        if (poll(p, n, t) < 0  &&  errno != EINTR)
+            return fail(TARGET, "poll");
+        if (!handle(p, n))
+            return false;
+    }
+    return false;
+}
@@ -0,0 +1,169 @@
+/*********************
+ * Relay session for embedding
+ *********************
+ *
+ */
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <poll.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "capture.h"
+#include "endpoint.h"
+#include "logger.h"
+#include "tstamp.h"
+#include "tty.h"
+
+/*!
+  \class Session
+  \brief Relay of a target endpoint, the public interface of libcon
+
+  A session relays the target (tty, socket, pty) to another endpoint, as
+  "con -B" does, or to the caller: the target data goes to a Handler and
+  send() writes to the target. It logs and captures like con.
+
+  Everything a session uses is its own: endpoints, tty modes, log,
+  capture, so any number of sessions may run in one process. They are
+  never blocked, a session may be served on the caller's event loop:
+
+      pollfd p[Session::MAXFDS];
+      int    n = s.fds(p);
+      poll(p, n, s.timeout());
+      if (!s.handle(p, n))
+          ... the session is over, s.error() tells why if it failed
+
+  or on its own thread with run(). A session object is used by one
+  thread at a time.
+
+  A listening endpoint accepts one connection, the session starts when
+  both sides are connected. When a side ends, the data queued for the
+  other one is written out. A socket gets the end of data then (UDP - an
+  empty datagram) and the session lasts until it ends too, a tty or pty
+  or the caller ends the session at once.
+*/
+class Session
+{
+public:
+    enum Side { TARGET, OTHER };
+    static const int MAXFDS = 2;
+
+    //! Receiver of the target data and of the session events
+    class Handler
+    {
+    public:
+        virtual ~Handler();
+
+        //! Data from the target, raw, before log stamps
+        virtual void data(Session& s, const unsigned char *p, const int n) = 0;
+
+        //! Connection accepted, end of data and such
+        virtual void message(Session& s, const char *msg);
+    };
+
+    struct Options
+    {
+        const char         *log;            // log file, 0 - none
+        bool               log_append;      // add to the log instead of overwriting it
+        bool               filter_colors;   // drop color sequences from the log
+        const char         *timestamp;      // "wall", "mono" or "delta" line stamps of the target data in the log
+        const char         *capture;        // merged capture of both directions
+        Endpoint::SockOpts sock;
+        size_t             max_queue;       // bytes queued for a side before the other one isn't read
+
+        Options() : log(0), log_append(false), filter_colors(false), timestamp(0), capture(0),
+                    max_queue(256 * 1024) {}
+    };
+
+    Session();
+
+    /*! Destructor
+      Everything is closed, tty modes are restored
+     */
+    ~Session();
+
+    /*! Open the endpoints, see Endpoint::parse() for the forms
+      \param other the other endpoint, 0 - the caller is the other side
+      \param h receiver of the target data (may be 0 if \e other is given)
+      \return false on failure, error() tells why
+     */
+    bool open(const char *target, const char *other, Handler *h, const Options& o = Options());
+
+    /*! Queue data for the target, it's written as fast as the target
+      takes it
+      \return false if the target is not connected or the session is over
+     */
+    bool send(const void *p, const int n);
+
+    /*! Descriptors and events to wait for
+      \param p room for MAXFDS entries
+      \return number of entries filled
+     */
+    int  fds(pollfd *p) const;
+
+    //! poll() timeout, ms: -1, or a short one while a pty slave is awaited
+    int  timeout() const;
+
+    /*! Serve the descriptors polled
+      \return false when the session is over
+     */
+    bool handle(const pollfd *p, const int n);
+
+    /*! Serve the session on the caller's thread
+      \param timeout_ms return after this time, -1 - at the end only
+      \return false when the session is over
+     */
+    bool run(const int timeout_ms = -1);
+
+    //! Close everything
+    void close();
+
+    bool        connected() const;                   // both sides, the data flows
+    bool        over() const                         { return done;              }
+    const char  *error() const                       { return err.c_str();       }
+    const char  *name(const Side s) const            { return side[s].ep.name(); }
+    uint64_t    received(const Side s) const         { return side[s].rx;        }
+
+private:
+    struct Part
+    {
+        Endpoint    ep;
+        bool        used;
+        bool        eof;
+        bool        shut;    // end of data is sent to it
+        std::string out;     // queued for it, written from "off"
+        size_t      off;
+        uint64_t    rx;
+    };
+
+    Part        side[2];
+    Handler     *handler;
+    Options     opts;
+    Tty         tty;
+    Logger      logger;
+    Tstamp      tstamp;
+    Capture     capture;
+    std::string stamped;
+    std::string err;
+    bool        started;
+    bool        done;
+
+    Session(const Session&);
+    Session& operator=(const Session&);
+
+    bool        waiting(const int s) const;
+    bool        socket(const int s) const { return side[s].ep.type() != Endpoint::TTY  &&  side[s].ep.type() != Endpoint::PTY; }
+    size_t      queued(const int s) const { return side[s].out.size() - side[s].off; }
+    bool        pending(const int s) const;
+    bool        fail(const int s, const char *what);
+    bool        accept(const int s);
+    void        start();
+    bool        receive(const int s);
+    bool        queue(const int s, const void *p, const int n);
+    bool        flush(const int s);
+    void        message(const char *format, ...) __attribute__ ((format (printf, 2, 3)));
+};
+
+#endif
@@ -0,0 +1,310 @@
+/*********************
+ * Session sharing
+ *********************
+ *
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "share.h"
+
+Share::Share()
+    : trimmed(false)
+    , running(false)
+    , quit(-1)
+    , wake(-1)
+{
+    pthread_mutex_init(&lock, 0);
+    lsn[0] = lsn[1] = -1;
+    in[0] = in[1] = -1;
+}
+
+Share::~Share()
+{
+    stop();
+    pthread_mutex_destroy(&lock);
+}
+
+bool Share::listen_on(const int i, const char *path)
+{
+    sockaddr_un sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    strncpy(sa.sun_path, path, sizeof(sa.sun_path)-1);
+    if ((lsn[i] = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0)) < 0)
+        return false;
+    unlink(sa.sun_path);
+    if (bind(lsn[i], (sockaddr *)&sa, sizeof(sa)) < 0)
+        return false;
+    paths[i] = sa.sun_path;
+    return listen(lsn[i], 8) == 0;
+}
+
+bool Share::serve(const char *path, const char *copilot_path)
+{
+    if ((path  &&  !listen_on(0, path))  ||  (copilot_path  &&  !listen_on(1, copilot_path)))
+        goto fail;
+    if (copilot_path  &&  pipe2(in, O_NONBLOCK | O_CLOEXEC) < 0)
+        goto fail;
+    if ((quit = eventfd(0, EFD_CLOEXEC)) < 0  ||  (wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0)
+        goto fail;
+    {
+        int rc = pthread_create(&thread, 0, run, this);
+        if (rc)
+        {
+            errno = rc;
+            goto fail;
+        }
+    }
+    running = true;
+    return true;
+
+fail:
+    int e = errno;
+    stop();
+    errno = e;
+    return false;
+}
+
+void Share::stop()
+{
+    if (running)
+    {
+        eventfd_write(quit, 1);
+        pthread_join(thread, 0);
+        running = false;
+    }
+    while (!obs.empty())
+        leave(obs.back());
+    for (int i=0; i<2; i++)
+    {
+        if (lsn[i] >= 0)
+            close(lsn[i]);
+        if (in[i] >= 0)
+            close(in[i]);
+        lsn[i] = in[i] = -1;
+        if (!paths[i].empty())
+            unlink(paths[i].c_str());
+        paths[i].clear();
+    }
+    if (quit >= 0)
+        close(quit);
+    if (wake >= 0)
+        close(wake);
+    quit = wake = -1;
+}
+
+void Share::write(const unsigned char *p, const int n)
+{
+    bool signal = false;
+
+    if (n <= 0)
+        return;
+    pthread_mutex_lock(&lock);
+    replay.append((const char *)p, n);
+    if (replay.size() > 2 * REPLAY)
+    {
+        replay.erase(0, replay.size() - REPLAY);
+        trimmed = true;
+    }
+    for (size_t i=0; i<obs.size(); i++)
+    {
+        Observer *o = obs[i];
+        if (o->dropped)
+            continue;
+        if (o->queue.size() + n > QMAX)
+        {
+            o->dropped = true;
+            o->queue.clear();
+            signal = true;
+            continue;
+        }
+        signal |= o->queue.empty();
+        o->queue.append((const char *)p, n);
+    }
+    pthread_mutex_unlock(&lock);
+    if (signal)
+        eventfd_write(wake, 1);
+}
+
+void *Share::run(void *arg)
+{
+    ((Share *)arg)->loop();
+    return 0;
+}
+
+// New observer gets the replay from the start of a line
+void Share::join(const int fd, const bool copilot)
+{
+    Observer *o = new Observer;
+    o->fd = fd;
+    o->copilot = copilot;
+    o->dropped = false;
+
+    pthread_mutex_lock(&lock);
+    size_t from = replay.size() > REPLAY ? replay.size() - REPLAY : 0;
+    if (from  ||  trimmed)
+    {
+        size_t nl = replay.find('\n', from);
+        from = nl == std::string::npos ? replay.size() : nl + 1;
+    }
+    o->out.assign(replay, from, std::string::npos);
+    obs.push_back(o);
+    pthread_mutex_unlock(&lock);
+}
+
+void Share::leave(Observer *o)
+{
+    pthread_mutex_lock(&lock);
+    for (size_t i=0; i<obs.size(); i++)
+        if (obs[i] == o)
+        {
+            obs.erase(obs.begin() + i);
+            break;
+        }
+    pthread_mutex_unlock(&lock);
+    if (o->copilot)
+        input.clear();
+    close(o->fd);
+    delete o;
+}
+
+// Co-pilot input to the relay, as much as the pipe takes
+void Share::pass_input()
+{
+    while (!input.empty())
+    {
+        ssize_t n = ::write(in[1], input.data(), input.size());
+        if (n < 0  &&  errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        input.erase(0, n);
+    }
+}
+
+// Read and write observer "o", false if it's gone
+bool Share::handle(Observer *o, const short events)
+{
+    if (events & (POLLIN | POLLHUP | POLLERR))
+    {
+        char    buf[4096];
+        ssize_t n = read(o->fd, buf, sizeof(buf));
+        if (n == 0  ||  (n < 0  &&  errno != EAGAIN  &&  errno != EINTR))
+            return false;
+        if (n > 0  &&  o->copilot)
+        {
+            input.append(buf, n);
+            pass_input();
+        }
+    }
+
+    pthread_mutex_lock(&lock);
+    bool dropped = o->dropped;
+    if (o->out.empty())
+        o->out.swap(o->queue);
+    pthread_mutex_unlock(&lock);
+
+    if (dropped)
+    {
+        static const char bye[] = "\r\n[dropped: too slow]\r\n";
+        send(o->fd, bye, sizeof(bye) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+        return false;
+    }
+    while (!o->out.empty())
+    {
+        ssize_t n = send(o->fd, o->out.data(), o->out.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0  &&  errno == EINTR)
+            continue;
+        if (n < 0)
+            return errno == EAGAIN;
+        o->out.erase(0, n);
+    }
+    return true;
+}
+
+void Share::loop()
+{
+    std::vector<pollfd>     fds;
+    std::vector<Observer *> list;
+    std::vector<char>       drop;
+
+    for (;;)
+    {
+        enum { QUIT, WAKE, LSN, COPILOT_LSN, INPUT, OBS };
+        fds.assign(OBS, pollfd());
+        fds[QUIT].fd = quit;
+        fds[WAKE].fd = wake;
+        fds[LSN].fd = lsn[0];
+        fds[COPILOT_LSN].fd = lsn[1];
+        fds[INPUT].fd = input.empty() ? -1 : in[1];
+        fds[INPUT].events = POLLOUT;
+        for (int i=QUIT; i<INPUT; i++)
+            fds[i].events = POLLIN;
+
+        // Co-pilot isn't read while the relay hasn't taken its input
+        pthread_mutex_lock(&lock);
+        list = obs;
+        drop.assign(list.size(), 0);
+        for (size_t i=0; i<list.size(); i++)
+        {
+            pollfd p;
+            p.fd = list[i]->fd;
+            p.events = list[i]->copilot  &&  !input.empty() ? 0 : POLLIN;
+            if (!list[i]->out.empty()  ||  !list[i]->queue.empty())
+                p.events |= POLLOUT;
+            drop[i] = list[i]->dropped;
+            p.revents = 0;
+            fds.push_back(p);
+        }
+        pthread_mutex_unlock(&lock);
+
+        if (poll(&fds[0], fds.size(), std::count(drop.begin(), drop.end(), 1) ? 0 : -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        if (fds[QUIT].revents)
+            return;
+        if (fds[WAKE].revents)
+        {
+            eventfd_t v;
+            eventfd_read(wake, &v);
+        }
+        if (fds[INPUT].revents)
+            pass_input();
+
+        for (int i=0; i<2; i++)
+            if (fds[LSN + i].revents)
+            {
+                int c = accept4(lsn[i], 0, 0, SOCK_CLOEXEC | SOCK_NONBLOCK);
+                if (c < 0)
+                    continue;
+                bool busy = false;
+                for (size_t k=0; i  &&  k<list.size(); k++)
+                    busy |= list[k]->copilot;
+                if (busy)
+                {
+                    static const char msg[] = "co-pilot is attached already\r\n";
+                    send(c, msg, sizeof(msg) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+                    close(c);
+                }
+                else
+                    join(c, i == 1);
+            }
+
+        // Observers which joined now are served on the next pass
+        for (size_t i=0; i<list.size(); i++)
+            if ((fds[OBS + i].revents  ||  drop[i])  &&  !handle(list[i], fds[OBS + i].revents))
+                leave(list[i]);
+    }
+}
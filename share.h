@@ -0,0 +1,91 @@
+/*********************
+ * Session sharing
+ *********************
+ *
+ */
+#ifndef SHARE_H
+#define SHARE_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+/*!
+  \class Share
+  \brief The console for observers on UNIX sockets
+
+  Any number of read-only observers connect to one socket, a co-pilot
+  who may type too connects to another one, only one at a time. Every
+  one of them gets the last REPLAY bytes of the session first, from
+  the start of a line, and then the target data as the screen does.
+
+  The relay thread only appends the data to a queue per observer under
+  a short lock. A server thread writes the queues without blocking.
+  An observer whose queue grows over QMAX is dropped, the session is
+  never held by observers. The co-pilot input goes to a pipe the relay
+  reads as the keyboard, see input_fd().
+*/
+class Share
+{
+public:
+    static const size_t QMAX = 1024 * 1024;
+    static const size_t REPLAY = 64 * 1024;
+
+    Share();
+    ~Share();
+
+    /*! Serve observers on socket "path" and a co-pilot on "copilot_path",
+      either may be 0
+      \return false on failure, errno is set
+     */
+    bool serve(const char *path, const char *copilot_path);
+    bool enabled() const { return running; }
+
+    //! Drop everybody, remove the sockets
+    void stop();
+
+    //! Target data as shown, for every observer
+    void write(const unsigned char *p, const int n);
+
+    //! Co-pilot keystrokes, non-blocking. -1 - no co-pilot socket
+    int input_fd() const { return in[0]; }
+
+private:
+    struct Observer
+    {
+        int         fd;
+        bool        copilot;
+        bool        dropped;     // queue overflow, under the lock
+        std::string queue;       // under the lock
+        std::string out;         // being sent, server thread only
+    };
+
+    pthread_mutex_t         lock;
+    std::vector<Observer *> obs;
+    std::string             replay;
+    bool                    trimmed;    // replay starts in the middle of a line
+
+    bool                    running;
+    pthread_t               thread;
+    int                     lsn[2];     // observers, co-pilot
+    std::string             paths[2];
+    int                     quit;       // eventfd
+    int                     wake;       // eventfd, data queued
+    int                     in[2];      // co-pilot input pipe
+    std::string             input;      // co-pilot input the pipe didn't take
+
+    Share(const Share&);
+    Share& operator=(const Share&);
+
+    bool        listen_on(const int i, const char *path);
+    static void *run(void *arg);
+    void        loop();
+    void        join(const int fd, const bool copilot);
+    void        leave(Observer *o);
+    bool        handle(Observer *o, const short events);
+    void        pass_input();
+};
+
+#endif
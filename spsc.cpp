@@ -0,0 +1,127 @@
+/*********************
+ * Lock-free SPSC ring
+ *********************
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "spsc.h"
+
+// Records are 8 bytes aligned
+static inline size_t rec_align(const size_t n)
+{
+    return (n + 7) & ~(size_t)7;
+}
+
+Spsc::Spsc()
+    : buf(0)
+    , size(0)
+    , mask(0)
+    , tail(0)
+    , skip(0)
+    , maxd(0)
+    , dropb(0)
+    , dropc(0)
+    , head(0)
+    , next(0)
+{
+}
+
+Spsc::~Spsc()
+{
+    if (buf)
+        free(buf);
+    buf = 0;
+}
+
+bool Spsc::init(size_t sz)
+{
+    size = 4096;
+    while (size < sz)
+        size <<= 1;
+    mask = size - 1;
+    if (posix_memalign((void **)&buf, 64, size))
+    {
+        buf = 0;
+        return false;
+    }
+    // Prefault, the ring is written from the receive path
+    memset(buf, 0, size);
+    return true;
+}
+
+unsigned char *Spsc::reserve(const size_t max)
+{
+    const size_t need = sizeof(Rec) + rec_align(max);
+    size_t       h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    size_t       free_sz = size - (tail - h);
+    size_t       pos = tail & mask;
+
+    skip = 0;
+    if (size - pos < need)
+    {
+        // Not enough contiguous room till the end - wrap
+        skip = size - pos;
+        pos = 0;
+    }
+    if (free_sz < skip + need)
+        return 0;
+    return buf + pos + sizeof(Rec);
+}
+
+bool Spsc::commit(const size_t cnt, const timespec& ts)
+{
+    if (skip)
+        ((Rec *)(buf + (tail & mask)))->len = WRAP;
+
+    Rec *r = (Rec *)(buf + ((tail + skip) & mask));
+    r->len = cnt;
+    r->ts = ts;
+
+    size_t t = tail + skip + sizeof(Rec) + rec_align(cnt);
+    __atomic_store_n(&tail, t, __ATOMIC_SEQ_CST);
+
+    // Head is loaded after the tail is published, so if the consumer
+    // has seen the old tail and is going to sleep we see it empty
+    size_t h = __atomic_load_n(&head, __ATOMIC_SEQ_CST);
+    if (t - h > maxd)
+        __atomic_store_n(&maxd, t - h, __ATOMIC_RELAXED);
+    return t - h == skip + sizeof(Rec) + rec_align(cnt);
+}
+
+void Spsc::drop(const size_t cnt)
+{
+    __atomic_store_n(&dropb, dropb + cnt, __ATOMIC_RELAXED);
+    __atomic_store_n(&dropc, dropc + 1, __ATOMIC_RELAXED);
+}
+
+const unsigned char *Spsc::front(size_t& cnt, timespec& ts)
+{
+    size_t h = head;
+    size_t t = __atomic_load_n(&tail, __ATOMIC_SEQ_CST);
+
+    if (h == t)
+        return 0;
+
+    Rec *r = (Rec *)(buf + (h & mask));
+    if (r->len == WRAP)
+    {
+        h += size - (h & mask);
+        r = (Rec *)buf;
+    }
+    cnt = r->len;
+    ts = r->ts;
+    next = h + sizeof(Rec) + rec_align(cnt);
+    return (const unsigned char *)(r + 1);
+}
+
+void Spsc::pop()
+{
+    __atomic_store_n(&head, next, __ATOMIC_SEQ_CST);
+}
+
+size_t Spsc::depth() const
+{
+    return __atomic_load_n(&tail, __ATOMIC_ACQUIRE) - __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+}
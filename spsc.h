@@ -0,0 +1,89 @@
+/*********************
+ * Lock-free SPSC ring
+ *********************
+ *
+ */
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/*!
+  \class Spsc
+  \brief Single producer, single consumer ring of timestamped chunks
+
+  The producer reads straight into the ring: reserve() gives a contiguous
+  room, commit() publishes the chunk. The consumer gets chunks in order by
+  front() and releases them by pop(). No locks, only acquire/release
+  ordering on head and tail.
+*/
+class Spsc
+{
+public:
+    Spsc();
+    ~Spsc();
+
+    /*! Allocate the ring
+      \param size ring size in bytes, rounded up to power of 2
+      \return false if memory can't be allocated
+     */
+    bool init(size_t size);
+
+    /*! Producer: get a room for a chunk of up to \e max bytes
+      \return pointer to the room or 0 if the ring is full
+     */
+    unsigned char *reserve(const size_t max);
+
+    /*! Producer: publish the chunk of \e cnt bytes written to reserved room
+      \return true if the ring was empty, i.e. consumer should be woken up
+     */
+    bool commit(const size_t cnt, const timespec& ts);
+
+    //! Producer: account \e cnt bytes which didn't fit into the ring
+    void drop(const size_t cnt);
+
+    /*! Consumer: oldest chunk
+      \return pointer to data or 0 if the ring is empty
+     */
+    const unsigned char *front(size_t& cnt, timespec& ts);
+
+    //! Consumer: release the chunk returned by front()
+    void pop();
+
+    //! Bytes used by the ring now
+    size_t depth() const;
+
+    // Statistics
+    size_t        capacity() const  { return size;                                        }
+    size_t        max_depth() const { return __atomic_load_n(&maxd, __ATOMIC_RELAXED);    }
+    unsigned long dropped() const   { return __atomic_load_n(&dropb, __ATOMIC_RELAXED);   }
+    unsigned long drops() const     { return __atomic_load_n(&dropc, __ATOMIC_RELAXED);   }
+
+private:
+    struct Rec
+    {
+        uint32_t len;
+        uint32_t pad;
+        timespec ts;
+    };
+    static const uint32_t WRAP = 0xffffffff;
+
+    unsigned char *buf;
+    size_t        size;
+    size_t        mask;
+
+    // Written by producer
+    size_t        tail  __attribute__((aligned(64)));
+    size_t        skip;
+    size_t        maxd;
+    unsigned long dropb;
+    unsigned long dropc;
+
+    // Written by consumer
+    size_t        head  __attribute__((aligned(64)));
+    size_t        next;
+};
+
+#endif
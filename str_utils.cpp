@@ -4,6 +4,7 @@
  *
  */
 
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <strings.h>
@@ -26,7 +27,12 @@ char *str::vprintf(const char *format, va_list args)
         out_buf = new char[max_buf];
         max_str = max_buf - 1;
 
-        if (::vsnprintf(out_buf, max_str, format, args) < (int)max_str)
+        // The list is consumed by each attempt
+        va_list a;
+        va_copy(a, args);
+        int n = ::vsnprintf(out_buf, max_str, format, a);
+        va_end(a);
+        if (n < (int)max_str)
             return out_buf;
         max_buf *= 2;
         if (max_buf > SIZE_LIMIT)
@@ -128,12 +134,24 @@ std::string str::escape(const std::string& str)
     return rc;
 } // escape
 
+////////////////////////////////////////////////////////////////////////
+// "\xHH" with two hexa digits is a character, anything else is kept as is
+static void unhexa(std::string& rc, const std::string& h)
+{
+    if (h.length() == 2  &&  isxdigit((unsigned char)h[0])  &&  isxdigit((unsigned char)h[1]))
+        rc += (char)strtol(h.c_str(), 0, 16);
+    else
+    {
+        rc += "\\x";
+        rc += h;
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////
 std::string str::unescape(const std::string& str)
 {
     enum Mode { NORMAL, ESCAPE, HEXA};
     const char   *p = str.c_str();
-    char         c, *endp;
     std::string  rc;
     std::string  h;
     Mode         m = NORMAL;
@@ -181,40 +199,21 @@ std::string str::unescape(const std::string& str)
             }
             break;
         case HEXA:
-            switch (h.length())
+            h += *p;
+            if (h.length() == 2)
             {
-            case 0:
-            case 1:
-                h += *p;
-                break;
-            default:
-                c = strtol(h.c_str(), &endp, 16) & 0xff;
-                if (*endp)
-                {
-                    rc += "\\x";
-                    rc += h;
-                }
-                else
-                    rc += c;
-                h.clear();
-                p--;
+                unhexa(rc, h);
                 m = NORMAL;
             }
             break;
         }
     }
 
-    if (h.length() > 1)
-    {
-        c = strtol(h.c_str(), &endp, 16) & 0xff;
-        if (*endp)
-        {
-            rc += "\\x";
-            rc += h;
-        }
-        else
-            rc += c;
-    }
+    // Escape cut by the end of string
+    if (m == ESCAPE)
+        rc += "\\";
+    else if (m == HEXA)
+        unhexa(rc, h);
 
     return rc;
 } // unescape
@@ -294,7 +293,7 @@ char str::filter_colors(const char c)
 std::string str::trim_right(const std::string &s, const char *delimiters)
 {
     std::string::size_type st = s.find_last_not_of(delimiters);
-    if (!st || st == std::string::npos)
+    if (st == std::string::npos)
         return std::string();
     return s.substr(0, st + 1 >= s.length() ? std::string::npos : st + 1);
 }
@@ -466,16 +465,30 @@ Container str::regexp::split(const std::string &s)
         return container;
     }
 
-    std::string str = s;
-    while (!regexec(&_re, str.c_str(), 1, match, 0))
+    // The piece starts at "from", the search at "off"
+    const char             *p = s.c_str();
+    std::string::size_type from = 0, off = 0;
+    while (!regexec(&_re, p + off, 1, match, 0))
     {
-        if (match[0].rm_so != -1  &&  match[0].rm_so > 0)
-            container.push_back(str.substr(0, match[0].rm_so));
-        str = str.substr(match[0].rm_eo);
-        if (str.empty())
+        // Empty match is no separator, the search moves on
+        if (match[0].rm_eo == 0)
+        {
+            if (!p[off])
+                break;
+            off++;
+            continue;
+        }
+        if (off + match[0].rm_so > from)
+            container.push_back(s.substr(from, off + match[0].rm_so - from));
+        from = off += match[0].rm_eo;
+        if (!p[from])
             return container;
     }
 
-    container.push_back(str);
+    container.push_back(s.substr(from));
     return container;
 }
+
+// split_l() and split_v()
+template std::list<std::string> str::regexp::split<std::list<std::string> >(const std::string &s);
+template std::vector<std::string> str::regexp::split<std::vector<std::string> >(const std::string &s);
@@ -0,0 +1,305 @@
+/*********************
+ * Triggered capture
+ *********************
+ *
+ */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <deque>
+
+#include "trigger.h"
+
+Trigger::Trigger()
+    : nstarts(0)
+    , start(0)
+    , npairs(0)
+    , state(0)
+    , ring(0)
+    , pre(0)
+    , post(0)
+    , head(0)
+    , total(0)
+    , saved(0)
+    , f(0)
+    , left(0)
+    , last(0)
+    , files(0)
+    , err(0)
+{
+    memset(starts, 0, sizeof(starts));
+}
+
+Trigger::~Trigger()
+{
+    close();
+    free(ring);
+}
+
+bool Trigger::add(const char *pattern)
+{
+    size_t n = strlen(pattern);
+    if (!n  ||  n > MAXPAT)
+        return false;
+    pats.push_back(pattern);
+    next.clear();
+    return true;
+}
+
+void Trigger::init(const char *pfx, const size_t pre_size, const size_t post_size)
+{
+    prefix = pfx;
+    pre = pre_size;
+    post = post_size;
+}
+
+// Goto function completed with the failure links, a DFA
+void Trigger::build()
+{
+    next.assign(256, 0);
+    match.assign(1, 0);
+    for (size_t i=0; i<pats.size(); i++)
+    {
+        int32_t s = 0;
+        for (size_t k=0; k<pats[i].size(); k++)
+        {
+            unsigned char c = pats[i][k];
+            if (!next[s * 256 + c])
+            {
+                next[s * 256 + c] = match.size();
+                match.push_back(0);
+                next.resize(next.size() + 256, 0);
+            }
+            s = next[s * 256 + c];
+        }
+        if (!match[s])
+            match[s] = i + 1;
+        if (npairs < MAXPAIRS)
+        {
+            pairs[npairs][0] = pats[i][0];
+            pairs[npairs][1] = pats[i].size() > 1 ? pats[i][1] : 0;
+            any[npairs++] = pats[i].size() == 1;
+        }
+        else
+            npairs = MAXPAIRS + 1;
+        if (!starts[(unsigned char)pats[i][0]])
+        {
+            starts[(unsigned char)pats[i][0]] = true;
+            start = pats[i][0];
+            nstarts++;
+        }
+    }
+
+    if (npairs > MAXPAIRS)
+        npairs = 0;
+
+    // Breadth first, a state gets the transitions of its failure state
+    // for the bytes it has none for
+    std::vector<int32_t> fail(match.size(), 0);
+    std::deque<int32_t>  q;
+    for (int c=0; c<256; c++)
+        if (next[c])
+            q.push_back(next[c]);
+    while (!q.empty())
+    {
+        int32_t s = q.front();
+        q.pop_front();
+        if (!match[s])
+            match[s] = match[fail[s]];
+        for (int c=0; c<256; c++)
+        {
+            int32_t t = next[s * 256 + c];
+            if (t)
+            {
+                fail[t] = next[fail[s] * 256 + c];
+                q.push_back(t);
+            }
+            else
+                next[s * 256 + c] = next[fail[s] * 256 + c];
+        }
+    }
+}
+
+// Bytes up to the end of the first match in "p", all of them if there is
+// none. "hit" is the pattern matched + 1, 0 - none
+size_t Trigger::scan(const unsigned char *p, const size_t n, int& hit)
+{
+    int32_t s = state;
+    size_t  i = 0;
+
+    hit = 0;
+    while (i < n)
+    {
+        if (!s)
+        {
+            if (nstarts == 1)
+            {
+                const unsigned char *q = (const unsigned char *)memchr(p + i, start, n - i);
+                if (!q)
+                {
+                    i = n;
+                    break;
+                }
+                i = q - p;
+            }
+            else
+            {
+#ifdef __SSE2__
+                // 16 places at once: pairs of bytes patterns start with
+                if (npairs)
+                    for (; i + 17 <= n; i += 16)
+                    {
+                        __m128i  a = _mm_loadu_si128((const __m128i *)(p + i));
+                        __m128i  b = _mm_loadu_si128((const __m128i *)(p + i + 1));
+                        __m128i  m = _mm_setzero_si128();
+                        for (int k=0; k<npairs; k++)
+                            m = _mm_or_si128(m, _mm_and_si128(_mm_cmpeq_epi8(a, _mm_set1_epi8(pairs[k][0])),
+                                                              _mm_or_si128(_mm_cmpeq_epi8(b, _mm_set1_epi8(pairs[k][1])),
+                                                                           any[k] ? _mm_cmpeq_epi8(b, b) : _mm_setzero_si128())));
+                        if (int bits = _mm_movemask_epi8(m))
+                        {
+                            i += __builtin_ctz(bits);
+                            break;
+                        }
+                    }
+#endif
+                while (i < n  &&  !starts[p[i]])
+                    i++;
+                if (i == n)
+                    break;
+            }
+        }
+        s = next[s * 256 + p[i++]];
+        if (match[s])
+        {
+            hit = match[s];
+            break;
+        }
+    }
+    state = s;
+    return i;
+}
+
+bool Trigger::open()
+{
+    timeval   tv;
+    struct tm tm;
+    char      when[32] = "";
+
+    err = 0;
+    gettimeofday(&tv, 0);
+    if (localtime_r(&tv.tv_sec, &tm))
+        strftime(when, sizeof(when), "%Y%m%d-%H%M%S", &tm);
+    char ms[24];
+    snprintf(ms, sizeof(ms), ".%03ld", (long)tv.tv_usec / 1000);
+    name = prefix + "-" + when + ms + ".log";
+    if (!(f = fopen(name.c_str(), "w")))
+    {
+        err = errno;
+        return false;
+    }
+    setvbuf(f, 0, _IOFBF, 256 * 1024);
+    files++;
+    return true;
+}
+
+void Trigger::save(const unsigned char *p, const size_t n)
+{
+    if (f  &&  n  &&  fwrite(p, n, 1, f) != 1  &&  !err)
+        err = errno;
+}
+
+// Into the ring, only the last "pre" bytes matter
+void Trigger::keep(const unsigned char *p, size_t n)
+{
+    if (!pre)
+        return;
+    if (!ring  &&  !(ring = (unsigned char *)malloc(pre)))
+    {
+        pre = 0;
+        return;
+    }
+    if (n > pre)
+    {
+        p += n - pre;
+        n = pre;
+    }
+    size_t k = n < pre - head ? n : pre - head;
+    memcpy(ring + head, p, k);
+    memcpy(ring, p + k, n - k);
+    head = (head + n) % pre;
+}
+
+bool Trigger::write(const unsigned char *p, size_t n)
+{
+    bool started = false;
+
+    if (next.empty())
+        build();
+    while (n)
+    {
+        int    hit;
+        size_t m = scan(p, n, hit);
+
+        if (f)
+        {
+            // The match extends the window, the data up to it goes in any case
+            size_t k = hit  ||  m < left ? m : left;
+            save(p, k);
+            saved = total + k;
+            left = hit ? post : left - k;
+        }
+        else if (hit  &&  !open())
+        {
+            last = hit - 1;
+            started = true;
+        }
+        else if (hit)
+        {
+            // Ring data not saved yet by the previous trigger
+            uint64_t kept = total < pre ? total : pre;
+            uint64_t k = total - saved < kept ? total - saved : kept;
+            if (k)
+            {
+                size_t from = (head + pre - k) % pre;
+                size_t a = k < pre - from ? k : pre - from;
+                save(ring + from, a);
+                save(ring, k - a);
+            }
+            save(p, m);
+            saved = total + m;
+            left = post;
+            last = hit - 1;
+            started = true;
+        }
+        if (f  &&  !left)
+            close();
+
+        keep(p, m);
+        total += m;
+        p += m;
+        n -= m;
+    }
+    return started;
+}
+
+void Trigger::close()
+{
+    if (f  &&  fclose(f)  &&  !err)
+        err = errno;
+    f = 0;
+    left = 0;
+}
+
+void Trigger::flush()
+{
+    if (f)
+        fflush(f);
+}
@@ -0,0 +1,107 @@
+/*********************
+ * Triggered capture
+ *********************
+ *
+ */
+#ifndef TRIGGER_H
+#define TRIGGER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+/*!
+  \class Trigger
+  \brief Save of the stream around trigger patterns, as a scope does
+
+  The last \e pre bytes of the stream are kept in a memory ring. When a
+  pattern is found, a new file is written: the ring, the data up to the
+  match and \e post bytes after it. A match in the post-trigger part
+  extends it, data saved already isn't saved again by the next trigger.
+
+  The patterns are found by an Aho-Corasick automaton, a state per byte
+  and no look back, so a match may span any number of writes. Out of a
+  match the bytes that can't start a pattern are skipped at once: by
+  memchr() for one first byte, for a few patterns 16 places are tested
+  at once for their first two bytes.
+*/
+class Trigger
+{
+public:
+    static const size_t MAXPAT = 256;
+
+    Trigger();
+
+    /*! Destructor
+      The file being written is closed
+     */
+    ~Trigger();
+
+    //! Add a pattern, false if it's empty or longer than MAXPAT
+    bool add(const char *pattern);
+    bool enabled() const { return !pats.empty(); }
+
+    /*! Files and sizes
+      \param prefix files are "PREFIX-YYYYMMDD-HHMMSS.mmm.log"
+      \param pre ring size, bytes saved before a trigger
+      \param post bytes saved after it
+     */
+    void init(const char *prefix, const size_t pre, const size_t post);
+
+    /*! Pass the stream data
+      \return true if a trigger started a new file, file() and pattern()
+      tell which one and why, failed() - if it couldn't be written
+     */
+    bool write(const unsigned char *p, size_t n);
+
+    const char *file() const    { return name.c_str();              }
+    const char *pattern() const { return pats[last].c_str();       }
+    uint64_t   fired() const    { return files;                     }
+    bool       failed() const   { return err != 0;                  }
+    int        error() const    { return err;                       }
+
+    //! Finish the file being written
+    void close();
+
+    //! Write out the file data buffered
+    void flush();
+
+private:
+    std::vector<std::string> pats;
+    std::vector<int32_t>     next;       // 256 transitions per state
+    std::vector<int32_t>     match;      // pattern ending at a state + 1, 0 - none
+    bool                     starts[256];
+    int                      nstarts;
+    unsigned char            start;      // the only first byte, if nstarts == 1
+    static const int         MAXPAIRS = 8;
+    char                     pairs[MAXPAIRS][2];    // first two bytes of every pattern
+    bool                     any[MAXPAIRS];         // one byte pattern, any second one
+    int                      npairs;                // 0 - too many patterns to test so
+    int32_t                  state;
+
+    std::string              prefix;
+    unsigned char            *ring;
+    size_t                   pre, post;
+    size_t                   head;       // next byte of the ring written
+    uint64_t                 total;      // bytes passed
+    uint64_t                 saved;      // stream offset saved up to
+    FILE                     *f;
+    size_t                   left;       // post-trigger bytes to save
+    std::string              name;
+    int                      last;       // pattern of the last trigger
+    uint64_t                 files;
+    int                      err;
+
+    Trigger(const Trigger&);
+    Trigger& operator=(const Trigger&);
+
+    void   build();
+    size_t scan(const unsigned char *p, const size_t n, int& hit);
+    bool   open();
+    void   save(const unsigned char *p, const size_t n);
+    void   keep(const unsigned char *p, size_t n);
+};
+
+#endif
@@ -0,0 +1,157 @@
+/*********************
+ * Line timestamps
+ *********************
+ *
+ */
+#include <string.h>
+#include <time.h>
+
+#include "tstamp.h"
+
+// Write unsigned value right aligned in at least "width" positions
+static char *put_num(char *p, unsigned long v, int width, const char pad)
+{
+    int n = 1;
+    for (unsigned long t = v / 10; t; t /= 10)
+        n++;
+    if (n > width)
+        width = n;
+
+    char *e = p + width;
+    char *q = e;
+    do
+    {
+        *--q = '0' + v % 10;
+        v /= 10;
+    }
+    while (v);
+    while (q > p)
+        *--q = pad;
+    return e;
+}
+
+// a - b, normalized
+static timespec ts_sub(const timespec& a, const timespec& b)
+{
+    timespec r;
+
+    r.tv_sec  = a.tv_sec - b.tv_sec;
+    r.tv_nsec = a.tv_nsec - b.tv_nsec;
+    if (r.tv_nsec < 0)
+    {
+        r.tv_nsec += 1000000000L;
+        r.tv_sec--;
+    }
+    if (r.tv_sec < 0)
+    {
+        r.tv_sec = 0;
+        r.tv_nsec = 0;
+    }
+    return r;
+}
+
+Tstamp::Tstamp()
+    : _mode(NONE)
+    , clk(CLOCK_MONOTONIC)
+    , bol(true)
+    , cached_sec(-1)
+    , cached_len(0)
+{
+    base.tv_sec = base.tv_nsec = 0;
+    prev = base;
+    cached[0] = 0;
+}
+
+bool Tstamp::set_mode(const char *name)
+{
+    if (!strcmp(name, "wall"))
+        _mode = WALL;
+    else if (!strcmp(name, "mono"))
+        _mode = MONO;
+    else if (!strcmp(name, "delta"))
+        _mode = DELTA;
+    else
+        return false;
+    return true;
+}
+
+void Tstamp::start(const bool realtime)
+{
+    clk = (realtime || _mode == WALL) ? CLOCK_REALTIME : CLOCK_MONOTONIC;
+    clock_gettime(clk, &base);
+    prev = base;
+    bol = true;
+}
+
+void Tstamp::now(timespec& ts) const
+{
+    clock_gettime(clk, &ts);
+}
+
+int Tstamp::format(const timespec& ts, char *out)
+{
+    char     *p = out;
+    timespec d;
+
+    *p++ = '[';
+    switch (_mode)
+    {
+    case WALL:
+        if (ts.tv_sec != cached_sec)
+        {
+            struct tm tm;
+            cached_sec = ts.tv_sec;
+            if (localtime_r(&cached_sec, &tm))
+                cached_len = strftime(cached, sizeof(cached), "%Y-%m-%d %H:%M:%S", &tm);
+            else
+                cached_len = 0;
+        }
+        memcpy(p, cached, cached_len);
+        p += cached_len;
+        *p++ = '.';
+        p = put_num(p, ts.tv_nsec / 1000, 6, '0');
+        break;
+    case MONO:
+        d = ts_sub(ts, base);
+        p = put_num(p, d.tv_sec, 5, ' ');
+        *p++ = '.';
+        p = put_num(p, d.tv_nsec / 1000, 6, '0');
+        break;
+    case DELTA:
+        d = ts_sub(ts, prev);
+        *p++ = '+';
+        p = put_num(p, d.tv_sec, 3, ' ');
+        *p++ = '.';
+        p = put_num(p, d.tv_nsec / 1000, 6, '0');
+        break;
+    case NONE:
+        return 0;
+    }
+    prev = ts;
+    *p++ = ']';
+    *p++ = ' ';
+    return p - out;
+}
+
+int Tstamp::stamp(const unsigned char *in, const int cnt, const timespec& ts, unsigned char *out)
+{
+    const unsigned char *end = in + cnt;
+    unsigned char       *o = out;
+
+    while (in < end)
+    {
+        if (bol)
+        {
+            o += format(ts, (char *)o);
+            bol = false;
+        }
+        const unsigned char *nl = (const unsigned char *)memchr(in, '\n', end - in);
+        const unsigned char *e = nl ? nl + 1 : end;
+        memcpy(o, in, e - in);
+        o += e - in;
+        in = e;
+        if (nl)
+            bol = true;
+    }
+    return o - out;
+}
@@ -0,0 +1,69 @@
+/*********************
+ * Line timestamps
+ *********************
+ *
+ */
+#ifndef TSTAMP_H
+#define TSTAMP_H
+
+#include <time.h>
+
+/*!
+  \class Tstamp
+  \brief Prefix every line of a byte stream with a timestamp
+
+  Three flavours are supported: wall clock time, monotonic time since
+  the start of the session and delta since the previous line. All the
+  formatting is done by hand, localtime()/strftime() are called once
+  per second only.
+*/
+class Tstamp
+{
+public:
+    enum Mode { NONE, WALL, MONO, DELTA };
+
+    //! Maximal length of the prefix produced by format()
+    static const int MAXLEN = 40;
+
+    Tstamp();
+
+    /*! Parse mode name ("wall", "mono" or "delta")
+      \return true on success
+     */
+    bool set_mode(const char *name);
+    Mode mode() const    { return _mode; }
+    bool enabled() const { return _mode != NONE; }
+
+    /*! Start new stream
+      \param realtime use CLOCK_REALTIME even for relative modes. That is
+      required when the stamps are supplied by the kernel (SO_TIMESTAMPNS)
+     */
+    void start(const bool realtime = false);
+
+    //! Current time in the clock used by this stream
+    void now(timespec& ts) const;
+
+    /*! Format the prefix for a line received at \e ts
+      \return prefix length
+     */
+    int  format(const timespec& ts, char *out);
+
+    /*! Copy \e cnt bytes from \e in to \e out inserting prefixes at the
+      beginning of every line. \e out should have a room for at least
+      cnt + (number_of_lines + 1) * MAXLEN bytes
+      \return number of bytes in \e out
+     */
+    int  stamp(const unsigned char *in, const int cnt, const timespec& ts, unsigned char *out);
+
+private:
+    Mode      _mode;
+    clockid_t clk;
+    timespec  base;
+    timespec  prev;
+    bool      bol;
+    time_t    cached_sec;
+    char      cached[32];
+    int       cached_len;
+};
+
+#endif
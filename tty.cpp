@@ -40,94 +40,155 @@ Tty::~Tty()
     maxterms = 0;
 }
 
-bool Tty::setraw(termios& t, int speed)
+// Speeds and their termios codes
+static const struct
 {
-    t.c_iflag |= (IGNBRK);
-    t.c_iflag &= ~(INPCK | ISTRIP | INLCR | ICRNL | IUCLC | IXON | IXOFF);
-
-    //t.c_oflag |= ();
-    t.c_oflag &= ~(OPOST | OLCUC | XTABS | OCRNL | ONLCR);
-
-    t.c_cflag &= ~(CSIZE | PARENB);
-    t.c_cflag |= CS8;
-    //t.c_cflag |= CRTSCTS; // Flow control - only if other side supports that
-
-    t.c_lflag &= ~(ISIG | ICANON | XCASE | ECHO);
-
-    t.c_cc[VMIN] = 1;
-    t.c_cc[VTIME] = 0;
-    if (speed)
-    {
-        switch(speed)
-        {
+    int     speed;
+    speed_t code;
+} speeds[] =
+{
+#ifdef B50
+    { 50, B50 },
+#endif
+#ifdef B75
+    { 75, B75 },
+#endif
+#ifdef B110
+    { 110, B110 },
+#endif
+#ifdef B134
+    { 134, B134 },
+#endif
+#ifdef B150
+    { 150, B150 },
+#endif
+#ifdef B200
+    { 200, B200 },
+#endif
+#ifdef B300
+    { 300, B300 },
+#endif
+#ifdef B600
+    { 600, B600 },
+#endif
 #ifdef B1200
-        case 1200:
-            speed = B1200;
-            break;
+    { 1200, B1200 },
 #endif
 #ifdef B1800
-        case 1800:
-            speed = B1800;
-            break;
+    { 1800, B1800 },
 #endif
 #ifdef B2400
-        case 2400:
-            speed = B2400;
-            break;
+    { 2400, B2400 },
 #endif
 #ifdef B4800
-        case 4800:
-            speed = B4800;
-            break;
+    { 4800, B4800 },
 #endif
 #ifdef B9600
-        case 9600:
-            speed = B9600;
-            break;
+    { 9600, B9600 },
 #endif
 #ifdef B19200
-        case 19200:
-            speed = B19200;
-            break;
+    { 19200, B19200 },
 #endif
 #ifdef B38400
-        case 38400:
-            speed = B38400;
-            break;
+    { 38400, B38400 },
 #endif
 #ifdef B57600
-        case 57600:
-            speed = B57600;
-            break;
+    { 57600, B57600 },
 #endif
 #ifdef B115200
-        case 115200:
-            speed = B115200;
-            break;
+    { 115200, B115200 },
 #endif
 #ifdef B230400
-        case 230400:
-            speed = B230400;
-            break;
+    { 230400, B230400 },
 #endif
 #ifdef B307200
-        case 307200:
-            speed = B307200;
-            break;
+    { 307200, B307200 },
 #endif
 #ifdef B460800
-        case 460800:
-            speed = B460800;
-            break;
+    { 460800, B460800 },
 #endif
-        default:
-            errno = EINVAL;
-            return false;
+#ifdef B500000
+    { 500000, B500000 },
+#endif
+#ifdef B576000
+    { 576000, B576000 },
+#endif
+#ifdef B921600
+    { 921600, B921600 },
+#endif
+#ifdef B1000000
+    { 1000000, B1000000 },
+#endif
+#ifdef B1152000
+    { 1152000, B1152000 },
+#endif
+#ifdef B1500000
+    { 1500000, B1500000 },
+#endif
+#ifdef B2000000
+    { 2000000, B2000000 },
+#endif
+#ifdef B2500000
+    { 2500000, B2500000 },
+#endif
+#ifdef B3000000
+    { 3000000, B3000000 },
+#endif
+#ifdef B3500000
+    { 3500000, B3500000 },
+#endif
+#ifdef B4000000
+    { 4000000, B4000000 },
+#endif
+};
+
+// termios code of "speed"
+static bool speed_code(const int speed, speed_t& code)
+{
+    for (unsigned i=0; i<sizeof(speeds)/sizeof(speeds[0]); i++)
+        if (speeds[i].speed == speed)
+        {
+            code = speeds[i].code;
+            return true;
         }
+    errno = EINVAL;
+    return false;
+}
+
+unsigned Tty::speed_value(const termios& t)
+{
+    speed_t code = cfgetospeed(&t);
+
+    for (unsigned i=0; i<sizeof(speeds)/sizeof(speeds[0]); i++)
+        if (speeds[i].code == code)
+            return speeds[i].speed;
+    return 0;
+}
 
-        if (cfsetospeed(&t, speed))
+bool Tty::setraw(termios& t, int speed)
+{
+    t.c_iflag |= (IGNBRK);
+    t.c_iflag &= ~(INPCK | ISTRIP | INLCR | ICRNL | IUCLC | IXON | IXOFF);
+
+    //t.c_oflag |= ();
+    t.c_oflag &= ~(OPOST | OLCUC | XTABS | OCRNL | ONLCR);
+
+    t.c_cflag &= ~(CSIZE | PARENB);
+    t.c_cflag |= CS8;
+    //t.c_cflag |= CRTSCTS; // Flow control - only if other side supports that
+
+    t.c_lflag &= ~(ISIG | ICANON | XCASE | ECHO);
+
+    t.c_cc[VMIN] = 1;
+    t.c_cc[VTIME] = 0;
+    if (speed)
+    {
+        speed_t code;
+        if (!speed_code(speed, code))
+            return false;
+        if (cfsetospeed(&t, code))
             return false;
-        if (cfsetispeed(&t, speed))
+        if (cfsetispeed(&t, code))
             return false;
     }
     return true;
@@ -195,3 +256,18 @@ void Tty::do_close(const int entry)
     ::close(tty_h[entry]);
     tty_h[entry] = -1;
 }
+
+bool Tty::set_speed(const int tid, const int speed)
+{
+    termios t;
+    speed_t code;
+
+    if (!speed_code(speed, code)  ||  tcgetattr(tid, &t) == -1)
+        return false;
+    if (cfsetospeed(&t, code)  ||  cfsetispeed(&t, code))
+        return false;
+    if (tcsetattr(tid, TCSANOW, &t) == -1)
+        return false;
+    tcflush(tid, TCIFLUSH);
+    return true;
+}
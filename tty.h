@@ -3,6 +3,9 @@
  *********************
  *
  */
+#ifndef TTY_H
+#define TTY_H
+
 class termios;
 
 /*!
@@ -48,6 +51,20 @@ public:
      */
     void close(const int tid);
 
+    /*! Change speed of an open connection
+
+      Data received and not read yet is dropped, it came at the old speed
+      \param tid file descriptor of the tty connection
+      \param speed connection speed (like 9600, 115200, etc)
+      \return false on failure, errno is set
+     */
+    bool set_speed(const int tid, const int speed);
+
+    /*! Output speed of line settings \e t, like 9600
+      \return 0 if the speed has no known value
+     */
+    static unsigned speed_value(const termios& t);
+
 private:
     static const int DEF_MAXTERMS;
 
@@ -57,3 +74,5 @@ private:
     bool     setraw(termios& t, int speed);
     void     do_close(const int entry);
 };
+
+#endif
@@ -0,0 +1,294 @@
+/*********************
+ * io_uring access
+ *********************
+ *
+ */
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+static int sys_setup(unsigned entries, io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags,
+                     const void *arg = 0, size_t argsz = 0)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+// user_data of internal timeouts, never returned by cqe()
+static const unsigned long long UD_TIMEOUT = ~0ULL;
+
+static int sys_register(int fd, unsigned opcode, const void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+Uring::Uring()
+    : fd(-1)
+    , pending(0)
+    , stail(0)
+    , ext_arg(false)
+    , sq_ptr(MAP_FAILED)
+    , sq_sz(0)
+    , sq_head(0)
+    , sq_tail(0)
+    , sq_mask(0)
+    , sq_array(0)
+    , sqes((io_uring_sqe *)MAP_FAILED)
+    , sqes_sz(0)
+    , cq_ptr(MAP_FAILED)
+    , cq_sz(0)
+    , cq_head(0)
+    , cq_tail(0)
+    , cq_mask(0)
+    , cqes(0)
+    , br((io_uring_buf *)MAP_FAILED)
+    , br_sz(0)
+    , br_mask(0)
+    , br_base(0)
+    , br_size(0)
+    , br_tail(0)
+{
+}
+
+Uring::~Uring()
+{
+    cleanup();
+}
+
+void Uring::cleanup()
+{
+    if (fd >= 0)
+        close(fd);
+    fd = -1;
+    if (br != MAP_FAILED)
+        munmap(br, br_sz);
+    br = (io_uring_buf *)MAP_FAILED;
+    if (sqes != MAP_FAILED)
+        munmap(sqes, sqes_sz);
+    sqes = (io_uring_sqe *)MAP_FAILED;
+    if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr)
+        munmap(cq_ptr, cq_sz);
+    cq_ptr = MAP_FAILED;
+    if (sq_ptr != MAP_FAILED)
+        munmap(sq_ptr, sq_sz);
+    sq_ptr = MAP_FAILED;
+}
+
+bool Uring::init(const unsigned entries)
+{
+    io_uring_params p;
+
+    memset(&p, 0, sizeof(p));
+    if ((fd = sys_setup(entries, &p)) < 0)
+        return false;
+
+    sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (cq_sz > sq_sz)
+            sq_sz = cq_sz;
+        cq_sz = sq_sz;
+    }
+    sq_ptr = mmap(0, sq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED)
+    {
+        int e = errno;
+        cleanup();
+        errno = e;
+        return false;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        cq_ptr = sq_ptr;
+    else
+    {
+        cq_ptr = mmap(0, cq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED)
+        {
+            int e = errno;
+            cleanup();
+            errno = e;
+            return false;
+        }
+    }
+    sqes_sz = p.sq_entries * sizeof(io_uring_sqe);
+    sqes = (io_uring_sqe *)mmap(0, sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        int e = errno;
+        cleanup();
+        errno = e;
+        return false;
+    }
+
+    char *sq = (char *)sq_ptr;
+    char *cq = (char *)cq_ptr;
+    sq_head  = (unsigned *)(sq + p.sq_off.head);
+    sq_tail  = (unsigned *)(sq + p.sq_off.tail);
+    sq_mask  = (unsigned *)(sq + p.sq_off.ring_mask);
+    sq_array = (unsigned *)(sq + p.sq_off.array);
+    cq_head  = (unsigned *)(cq + p.cq_off.head);
+    cq_tail  = (unsigned *)(cq + p.cq_off.tail);
+    cq_mask  = (unsigned *)(cq + p.cq_off.ring_mask);
+    cqes     = (io_uring_cqe *)(cq + p.cq_off.cqes);
+    stail    = *sq_tail;
+    ext_arg  = p.features & IORING_FEAT_EXT_ARG;
+    return true;
+}
+
+io_uring_sqe *Uring::sqe()
+{
+    unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+
+    if (stail - head > *sq_mask)
+        return 0;
+
+    // The entry is published to kernel by enter()
+    unsigned     idx = stail & *sq_mask;
+    io_uring_sqe *e = &sqes[idx];
+    memset(e, 0, sizeof(*e));
+    sq_array[idx] = idx;
+    stail++;
+    pending++;
+    return e;
+}
+
+int Uring::enter(const unsigned min_complete, const int timeout_us)
+{
+    io_uring_getevents_arg arg;
+    unsigned               flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+    int                    rc;
+
+    if (min_complete  &&  timeout_us >= 0)
+    {
+        timeout.tv_sec = timeout_us / 1000000;
+        timeout.tv_nsec = (timeout_us % 1000000) * 1000LL;
+        if (ext_arg)
+        {
+            memset(&arg, 0, sizeof(arg));
+            arg.ts = (unsigned long)&timeout;
+            flags |= IORING_ENTER_EXT_ARG;
+        }
+        else
+        {
+            // Kernels before 5.11: timeout request completes the wait
+            io_uring_sqe *e = sqe();
+            if (e)
+            {
+                e->opcode = IORING_OP_TIMEOUT;
+                e->fd = -1;
+                e->addr = (unsigned long)&timeout;
+                e->len = 1;
+                e->user_data = UD_TIMEOUT;
+            }
+        }
+    }
+
+    __atomic_store_n(sq_tail, stail, __ATOMIC_RELEASE);
+    do
+    {
+        if (flags & IORING_ENTER_EXT_ARG)
+            rc = sys_enter(fd, pending, min_complete, flags, &arg, sizeof(arg));
+        else
+            rc = sys_enter(fd, pending, min_complete, flags);
+    }
+    while (rc < 0 && errno == EINTR);
+    if (rc < 0  &&  errno == ETIME)
+        rc = 0;
+    if (rc >= 0)
+        pending -= rc;
+    return rc;
+}
+
+io_uring_cqe *Uring::cqe()
+{
+    for (;;)
+    {
+        unsigned head = *cq_head;
+
+        if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+            return 0;
+        if (cqes[head & *cq_mask].user_data != UD_TIMEOUT)
+            return &cqes[head & *cq_mask];
+        seen();
+    }
+}
+
+void Uring::seen()
+{
+    __atomic_store_n(cq_head, *cq_head + 1, __ATOMIC_RELEASE);
+}
+
+bool Uring::iowq_affinity(const std::vector<int>& cpus)
+{
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    for (unsigned i=0; i<cpus.size(); i++)
+        CPU_SET(cpus[i], &set);
+    return sys_register(fd, IORING_REGISTER_IOWQ_AFF, &set, sizeof(set)) == 0;
+}
+
+bool Uring::register_buffers(const iovec *iov, const unsigned n)
+{
+    return sys_register(fd, IORING_REGISTER_BUFFERS, iov, n) == 0;
+}
+
+bool Uring::provide_buffers(const unsigned short bgid, unsigned char *base,
+                            const unsigned n, const unsigned size)
+{
+    // Number of entries should be a power of 2
+    if (!n || (n & (n - 1)))
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    br_sz = n * sizeof(io_uring_buf);
+    br = (io_uring_buf *)mmap(0, br_sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (br == MAP_FAILED)
+        return false;
+
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)br;
+    reg.ring_entries = n;
+    reg.bgid = bgid;
+    if (sys_register(fd, IORING_REGISTER_PBUF_RING, &reg, 1))
+    {
+        int e = errno;
+        munmap(br, br_sz);
+        br = (io_uring_buf *)MAP_FAILED;
+        errno = e;
+        return false;
+    }
+
+    br_mask = n - 1;
+    br_base = base;
+    br_size = size;
+    br_tail = 0;
+    for (unsigned i=0; i<n; i++)
+        recycle(i);
+    return true;
+}
+
+void Uring::recycle(const unsigned short bid)
+{
+    io_uring_buf *b = &br[br_tail & br_mask];
+
+    b->addr = (unsigned long)(br_base + (size_t)bid * br_size);
+    b->len  = br_size;
+    b->bid  = bid;
+    br_tail++;
+    // Ring tail is overlaid with resv field of the first entry
+    __atomic_store_n(&br[0].resv, br_tail, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,110 @@
+/*********************
+ * io_uring access
+ *********************
+ *
+ */
+#ifndef URING_H
+#define URING_H
+
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include <vector>
+
+/*!
+  \class Uring
+  \brief Minimal io_uring wrapper on top of raw system calls
+
+  Only the things needed by the relay loop are here: submission and
+  completion rings, registered buffers and provided buffer rings
+  (for multishot receive). No liburing is required.
+*/
+class Uring
+{
+public:
+    Uring();
+
+    /*! Destructor
+      The ring is closed, all pending requests are cancelled by kernel
+     */
+    ~Uring();
+
+    /*! Create the ring
+      \param entries submission queue size
+      \return false if io_uring is not supported by kernel, errno is set
+     */
+    bool init(const unsigned entries);
+
+    /*! Get next free submission entry, cleared
+      \return pointer to entry or 0 if submission queue is full
+     */
+    io_uring_sqe *sqe();
+
+    /*! Submit prepared entries and wait for completions
+      \param min_complete number of completions to wait for
+      \param timeout_us don't wait longer than that (microseconds), -1 - no limit
+      \return number of submitted entries or -1 on failure
+     */
+    int  enter(const unsigned min_complete, const int timeout_us = -1);
+
+    /*! Next completion entry
+      \return pointer to entry or 0 if completion queue is empty.
+      The entry should be released by seen()
+     */
+    io_uring_cqe *cqe();
+    void seen();
+
+    //! Pin io-wq worker threads to \e cpus
+    bool iowq_affinity(const std::vector<int>& cpus);
+
+    //! Register fixed buffers (for IORING_OP_READ_FIXED/WRITE_FIXED)
+    bool register_buffers(const iovec *iov, const unsigned n);
+
+    /*! Create provided buffers ring for buffer group \e bgid and fill it
+      with \e n buffers of \e size bytes starting at \e base
+      \return false if not supported by kernel
+     */
+    bool provide_buffers(const unsigned short bgid, unsigned char *base,
+                         const unsigned n, const unsigned size);
+
+    //! Return buffer \e bid back to the provided buffers ring
+    void recycle(const unsigned short bid);
+
+private:
+    int            fd;
+    unsigned       pending;
+    unsigned       stail;
+    bool           ext_arg;     // io_uring_enter() takes timeout
+    __kernel_timespec timeout;
+
+    // Submission ring
+    void           *sq_ptr;
+    size_t         sq_sz;
+    unsigned       *sq_head;
+    unsigned       *sq_tail;
+    unsigned       *sq_mask;
+    unsigned       *sq_array;
+    io_uring_sqe   *sqes;
+    size_t         sqes_sz;
+
+    // Completion ring
+    void           *cq_ptr;
+    size_t         cq_sz;
+    unsigned       *cq_head;
+    unsigned       *cq_tail;
+    unsigned       *cq_mask;
+    io_uring_cqe   *cqes;
+
+    // Provided buffers ring. Accessed as plain array of io_uring_buf,
+    // io_uring_buf_ring layout differs in C++ (empty struct has size 1)
+    io_uring_buf      *br;
+    size_t            br_sz;
+    unsigned          br_mask;
+    unsigned char     *br_base;
+    unsigned          br_size;
+    unsigned short    br_tail;
+
+    void           cleanup();
+};
+
+#endif
@@ -0,0 +1,1641 @@
+/*********************
+ * File transfer
+ *********************
+ *
+ */
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "xfer.h"
+
+// XMODEM / YMODEM control characters
+static const unsigned char SOH = 0x01;
+static const unsigned char STX = 0x02;
+static const unsigned char EOT = 0x04;
+static const unsigned char ACK = 0x06;
+static const unsigned char NAK = 0x15;
+static const unsigned char CAN = 0x18;
+static const unsigned char SUB = 0x1a;
+static const unsigned char XON = 0x11;
+
+static const int RETRIES = 10;
+static const int FILE_BUF = 64 * 1024;
+
+////////////////////////////////////////////////////////////////////////
+// CRC
+////////////////////////////////////////////////////////////////////////
+static uint16_t crc16_tab[256];
+static uint32_t crc32_tab[256];
+static bool     crc_ready = false;
+
+static void crc_init()
+{
+    if (crc_ready)
+        return;
+    for (unsigned i=0; i<256; i++)
+    {
+        uint16_t c16 = i << 8;
+        uint32_t c32 = i;
+        for (int b=0; b<8; b++)
+        {
+            c16 = (c16 & 0x8000) ? (c16 << 1) ^ 0x1021 : c16 << 1;
+            c32 = (c32 & 1) ? (c32 >> 1) ^ 0xedb88320 : c32 >> 1;
+        }
+        crc16_tab[i] = c16;
+        crc32_tab[i] = c32;
+    }
+    crc_ready = true;
+}
+
+static inline uint16_t crc16_upd(const uint16_t crc, const unsigned char c)
+{
+    return (crc << 8) ^ crc16_tab[((crc >> 8) ^ c) & 0xff];
+}
+
+static inline uint32_t crc32_upd(const uint32_t crc, const unsigned char c)
+{
+    return crc32_tab[(crc ^ c) & 0xff] ^ (crc >> 8);
+}
+
+uint16_t xfer::crc16(const unsigned char *p, size_t n, uint16_t crc)
+{
+    crc_init();
+    while (n--)
+        crc = crc16_upd(crc, *p++);
+    return crc;
+}
+
+uint32_t xfer::crc32(const unsigned char *p, size_t n, uint32_t crc)
+{
+    crc_init();
+    while (n--)
+        crc = crc32_upd(crc, *p++);
+    return crc;
+}
+
+////////////////////////////////////////////////////////////////////////
+// XferIo
+////////////////////////////////////////////////////////////////////////
+XferIo::XferIo()
+    : rpos(0)
+    , rlen(0)
+{
+}
+
+XferIo::~XferIo()
+{
+}
+
+int XferIo::getc(const int timeout_ms)
+{
+    if (rpos == rlen)
+    {
+        int n = raw_read(rbuf, sizeof(rbuf), timeout_ms);
+        if (n == 0)
+            return TIMEOUT;
+        if (n < 0)
+            return FAIL;
+        rpos = 0;
+        rlen = n;
+    }
+    return rbuf[rpos++];
+}
+
+bool XferIo::write(const void *buf, const int cnt)
+{
+    const unsigned char *p = (const unsigned char *)buf;
+    int                 n = cnt;
+
+    while (n > 0)
+    {
+        int rc = raw_write(p, n);
+        if (rc <= 0)
+            return false;
+        p += rc;
+        n -= rc;
+    }
+    return true;
+}
+
+int XferIo::read(unsigned char *buf, const int max, const int timeout_ms)
+{
+    if (rpos < rlen)
+    {
+        int n = rlen - rpos < max ? rlen - rpos : max;
+        memcpy(buf, rbuf + rpos, n);
+        rpos += n;
+        return n;
+    }
+    return raw_read(buf, max, timeout_ms);
+}
+
+void XferIo::purge(const int quiet_ms)
+{
+    rpos = rlen = 0;
+    while (raw_read(rbuf, sizeof(rbuf), quiet_ms) > 0)
+        ;
+    rpos = rlen = 0;
+}
+
+bool XferIo::drain()
+{
+    return true;
+}
+
+void XferIo::pass(const unsigned char *, const int)
+{
+}
+
+void XferIo::progress(const char *, const uint64_t, const uint64_t)
+{
+}
+
+void XferIo::message(const char *)
+{
+}
+
+////////////////////////////////////////////////////////////////////////
+// Common helpers
+////////////////////////////////////////////////////////////////////////
+bool xfer::parse_proto(const char *s, Proto& p)
+{
+    static const struct
+    {
+        const char *name;
+        Proto      proto;
+    } names[] = {
+        { "x",        XMODEM   },
+        { "xmodem",   XMODEM   },
+        { "1k",       XMODEM1K },
+        { "xmodem1k", XMODEM1K },
+        { "y",        YMODEM   },
+        { "ymodem",   YMODEM   },
+        { "z",        ZMODEM   },
+        { "zmodem",   ZMODEM   },
+    };
+
+    for (size_t i=0; i<sizeof(names)/sizeof(names[0]); i++)
+        if (!strcasecmp(s, names[i].name))
+        {
+            p = names[i].proto;
+            return true;
+        }
+    return false;
+}
+
+const char *xfer::proto_name(const Proto p)
+{
+    switch (p)
+    {
+    case XMODEM:   return "xmodem";
+    case XMODEM1K: return "xmodem-1k";
+    case YMODEM:   return "ymodem";
+    case ZMODEM:   return "zmodem";
+    }
+    return "?";
+}
+
+static void msg(XferIo& io, const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
+static void msg(XferIo& io, const char *fmt, ...)
+{
+    char    buf[512];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    io.message(buf);
+}
+
+// Tell the other side to stop
+static void cancel(XferIo& io)
+{
+    static const unsigned char seq[] = { CAN, CAN, CAN, CAN, CAN, CAN, CAN, CAN,
+                                         8, 8, 8, 8, 8, 8, 8, 8 };
+    io.write(seq, sizeof(seq));
+}
+
+static const char *base_name(const std::string& path)
+{
+    const char *s = strrchr(path.c_str(), '/');
+    return s ? s + 1 : path.c_str();
+}
+
+static FILE *open_send(const std::string& name, uint64_t& size, time_t& mtime, unsigned& mode)
+{
+    struct stat st;
+    FILE        *f = fopen(name.c_str(), "rb");
+
+    if (!f)
+        return 0;
+    if (fstat(fileno(f), &st) || !S_ISREG(st.st_mode))
+    {
+        fclose(f);
+        errno = EINVAL;
+        return 0;
+    }
+    setvbuf(f, 0, _IOFBF, FILE_BUF);
+    size = st.st_size;
+    mtime = st.st_mtime;
+    mode = st.st_mode & 07777;
+    return f;
+}
+
+/* Create the received file in directory dir. Path components sent by
+   the other side are dropped, an existing file is never overwritten:
+   ".1", ".2", ... is appended to the name instead
+*/
+static FILE *open_recv(const char *dir, const char *sent, std::string& name)
+{
+    const char *s = strrchr(sent, '/');
+    std::string base = s ? s + 1 : sent;
+
+    if (base.empty() || base == "." || base == "..")
+        base = "received";
+    std::string path = dir && *dir ? std::string(dir) + "/" + base : base;
+
+    name = path;
+    for (int i=1; i<1000; i++)
+    {
+        if (access(name.c_str(), F_OK))
+            break;
+        char sfx[16];
+        snprintf(sfx, sizeof(sfx), ".%d", i);
+        name = path + sfx;
+    }
+
+    FILE *f = fopen(name.c_str(), "wb");
+    if (f)
+        setvbuf(f, 0, _IOFBF, FILE_BUF);
+    return f;
+}
+
+////////////////////////////////////////////////////////////////////////
+// XMODEM / YMODEM
+////////////////////////////////////////////////////////////////////////
+namespace
+{
+    class Xmodem
+    {
+    public:
+        Xmodem(XferIo& io, const bool k1) : io(io), k1(k1), crc(true), stream(false) {}
+
+        bool send_file(FILE *f, const char *name, const uint64_t size);
+        bool send_header(const char *name, const uint64_t size, const time_t mtime, const unsigned mode);
+        bool send_eot(const bool ymodem);
+        bool wait_start();
+
+        bool recv_file(FILE *f, const char *name, const uint64_t size, bool& eot);
+        int  recv_header(std::string& name, uint64_t& size);
+
+    private:
+        XferIo&       io;
+        bool          k1;        // 1K blocks
+        bool          crc;       // CRC16 instead of checksum
+        bool          stream;    // YMODEM-g, no acknowledges
+        unsigned char blk[3 + 1024 + 2];
+
+        bool send_block(const unsigned char n, const unsigned char *data, const size_t len,
+                        const size_t size, const unsigned char pad);
+        int  recv_block(unsigned char& n, size_t& len, const int timeout_ms);
+        bool wait_ack();
+    };
+};
+
+// Wait for the receiver to ask for data: 'C' - CRC, NAK - checksum, 'G' - streaming
+bool Xmodem::wait_start()
+{
+    int cans = 0;
+
+    for (int i=0; i<60; i++)
+    {
+        int c = io.getc(1000);
+        switch (c)
+        {
+        case 'C':
+            crc = true;
+            stream = false;
+            return true;
+        case 'G':
+            crc = true;
+            stream = true;
+            return true;
+        case NAK:
+            crc = false;
+            stream = false;
+            return true;
+        case CAN:
+            if (++cans >= 2)
+            {
+                msg(io, "cancelled by receiver");
+                return false;
+            }
+            break;
+        case XferIo::FAIL:
+            return false;
+        default:
+            cans = 0;
+            break;
+        }
+    }
+    msg(io, "receiver is not ready");
+    return false;
+}
+
+bool Xmodem::wait_ack()
+{
+    int cans = 0;
+
+    for (;;)
+    {
+        int c = io.getc(10000);
+        switch (c)
+        {
+        case ACK:
+            return true;
+        case NAK:
+        case XferIo::TIMEOUT:
+            return false;
+        case CAN:
+            if (++cans >= 2)
+                return false;
+            break;
+        case XferIo::FAIL:
+            return false;
+        default:
+            break;
+        }
+    }
+}
+
+bool Xmodem::send_block(const unsigned char n, const unsigned char *data, const size_t len,
+                        const size_t size, const unsigned char pad)
+{
+    size_t total = 3 + size;
+
+    blk[0] = size == 1024 ? STX : SOH;
+    blk[1] = n;
+    blk[2] = 255 - n;
+    memcpy(blk + 3, data, len);
+    memset(blk + 3 + len, pad, size - len);
+    if (crc)
+    {
+        uint16_t c = xfer::crc16(blk + 3, size);
+        blk[total++] = c >> 8;
+        blk[total++] = c;
+    }
+    else
+    {
+        unsigned char sum = 0;
+        for (size_t i=0; i<size; i++)
+            sum += blk[3 + i];
+        blk[total++] = sum;
+    }
+
+    for (int retry=0; retry<RETRIES; retry++)
+    {
+        if (!io.write(blk, total))
+            return false;
+        if (stream)
+            return true;
+        if (wait_ack())
+            return true;
+        if (io.getc(0) == XferIo::FAIL)
+            return false;
+    }
+    msg(io, "too many errors, block %u", n);
+    return false;
+}
+
+bool Xmodem::send_file(FILE *f, const char *name, const uint64_t size)
+{
+    unsigned char buf[1024];
+    unsigned char n = 1;
+    uint64_t      done = 0;
+
+    for (;;)
+    {
+        // 1K blocks need CRC, the tail goes in short blocks
+        size_t bsize = k1 && crc && size - done > 128 ? 1024 : 128;
+        size_t len = fread(buf, 1, bsize, f);
+        if (!len)
+            break;
+        if (!send_block(n++, buf, len, bsize, SUB))
+        {
+            cancel(io);
+            return false;
+        }
+        done += len;
+        io.progress(name, done, size);
+    }
+    if (ferror(f))
+    {
+        msg(io, "%s: read error: %s", name, strerror(errno));
+        cancel(io);
+        return false;
+    }
+    return true;
+}
+
+bool Xmodem::send_eot(const bool ymodem)
+{
+    for (int retry=0; retry<RETRIES; retry++)
+    {
+        if (!io.write(&EOT, 1))
+            return false;
+        int c = io.getc(10000);
+        if (c == ACK)
+            return true;
+        if (c == XferIo::FAIL)
+            return false;
+        // YMODEM receivers NAK the first EOT
+        if (c == NAK && ymodem)
+        {
+            if (!io.write(&EOT, 1))
+                return false;
+            return wait_ack();
+        }
+    }
+    return false;
+}
+
+// YMODEM block 0, empty name ends the batch
+bool Xmodem::send_header(const char *name, const uint64_t size, const time_t mtime, const unsigned mode)
+{
+    unsigned char hdr[1024];
+    size_t        len = 0;
+
+    memset(hdr, 0, sizeof(hdr));
+    if (name)
+    {
+        len = snprintf((char *)hdr, sizeof(hdr) - 64, "%s", name) + 1;
+        len += snprintf((char *)hdr + len, sizeof(hdr) - len, "%llu %lo %o",
+                        (unsigned long long)size, (unsigned long)mtime, mode);
+        len++;
+    }
+    if (!send_block(0, hdr, len, len > 128 ? 1024 : 128, 0))
+        return false;
+    return true;
+}
+
+/* Receive one block
+   \return SOH - block, EOT, CAN - cancelled, 0 - bad block, TIMEOUT, FAIL
+*/
+int Xmodem::recv_block(unsigned char& n, size_t& len, const int timeout_ms)
+{
+    int c = io.getc(timeout_ms);
+
+    switch (c)
+    {
+    case SOH:
+    case STX:
+        break;
+    case EOT:
+        return EOT;
+    case CAN:
+        return io.getc(1000) == CAN ? CAN : 0;
+    case XferIo::TIMEOUT:
+    case XferIo::FAIL:
+        return c;
+    default:
+        return 0;
+    }
+
+    len = c == STX ? 1024 : 128;
+    size_t total = 2 + len + (crc ? 2 : 1);
+    for (size_t i=0; i<total; i++)
+    {
+        int b = io.getc(1000);
+        if (b == XferIo::FAIL)
+            return b;
+        if (b < 0)
+            return 0;
+        blk[1 + i] = b;
+    }
+    if (blk[1] != (unsigned char)(255 - blk[2]))
+        return 0;
+    if (crc)
+    {
+        if (xfer::crc16(blk + 3, len + 2))
+            return 0;
+    }
+    else
+    {
+        unsigned char sum = 0;
+        for (size_t i=0; i<len; i++)
+            sum += blk[3 + i];
+        if (sum != blk[3 + len])
+            return 0;
+    }
+    n = blk[1];
+    return SOH;
+}
+
+/* Receive the data blocks of one file
+   \param size file size from YMODEM header, 0 - unknown
+*/
+bool Xmodem::recv_file(FILE *f, const char *name, const uint64_t size, bool& eot)
+{
+    unsigned char expect = 1;
+    uint64_t      done = 0;
+    int           errors = 0;
+    bool          started = false;
+    unsigned char start = crc ? 'C' : NAK;
+
+    eot = false;
+    if (!io.write(&start, 1))
+        return false;
+    for (;;)
+    {
+        unsigned char n;
+        size_t        len;
+        int           rc = recv_block(n, len, started ? 10000 : 3000);
+
+        if (rc == SOH)
+        {
+            errors = 0;
+            started = true;
+            if (n == expect)
+            {
+                size_t w = len;
+                if (size && done + w > size)
+                    w = size - done;
+                if (fwrite(blk + 3, 1, w, f) != w)
+                {
+                    msg(io, "%s: write error: %s", name, strerror(errno));
+                    cancel(io);
+                    return false;
+                }
+                done += w;
+                expect++;
+                io.progress(name, done, size);
+            }
+            else if (n != (unsigned char)(expect - 1))
+            {
+                msg(io, "lost block synchronization");
+                cancel(io);
+                return false;
+            }
+            if (!io.write(&ACK, 1))
+                return false;
+            continue;
+        }
+        if (rc == EOT)
+        {
+            eot = true;
+            return io.write(&ACK, 1);
+        }
+        if (rc == CAN)
+        {
+            msg(io, "cancelled by sender");
+            return false;
+        }
+        if (rc == XferIo::FAIL)
+        {
+            cancel(io);
+            return false;
+        }
+        if (++errors >= RETRIES)
+        {
+            msg(io, "too many errors");
+            cancel(io);
+            return false;
+        }
+        io.purge();
+        unsigned char r = started ? NAK : start;
+        if (!io.write(&r, 1))
+            return false;
+    }
+}
+
+/* Receive YMODEM block 0
+   \return 1 - file, 0 - end of batch, -1 - failure
+*/
+int Xmodem::recv_header(std::string& name, uint64_t& size)
+{
+    for (int retry=0; retry<RETRIES; retry++)
+    {
+        if (!io.write("C", 1))
+            return -1;
+
+        unsigned char n;
+        size_t        len;
+        int           rc = recv_block(n, len, 3000);
+
+        if (rc == SOH && n == 0)
+        {
+            if (!io.write(&ACK, 1))
+                return -1;
+            if (!blk[3])
+                return 0;
+            blk[3 + len - 1] = 0;
+            name = (const char *)blk + 3;
+            const char *info = (const char *)blk + 3 + name.size() + 1;
+            size = strtoull(info, 0, 10);
+            return 1;
+        }
+        if (rc == CAN || rc == XferIo::FAIL)
+            return -1;
+        if (rc == 0)
+            io.purge();
+    }
+    msg(io, "sender is not responding");
+    return -1;
+}
+
+static bool xy_send(XferIo& io, const xfer::Proto p, const std::vector<std::string>& files)
+{
+    Xmodem x(io, p != xfer::XMODEM);
+    bool   ymodem = p == xfer::YMODEM;
+
+    for (size_t i=0; i<files.size(); i++)
+    {
+        uint64_t size;
+        time_t   mtime;
+        unsigned mode;
+        FILE     *f = open_send(files[i], size, mtime, mode);
+
+        if (!f)
+        {
+            msg(io, "%s: %s", files[i].c_str(), strerror(errno));
+            cancel(io);
+            return false;
+        }
+        const char *name = base_name(files[i]);
+        bool ok = x.wait_start();
+        if (ok && ymodem)
+            ok = x.send_header(name, size, mtime, mode) && x.wait_start();
+        ok = ok && x.send_file(f, name, size) && x.send_eot(ymodem);
+        fclose(f);
+        if (!ok)
+            return false;
+        if (!ymodem)
+        {
+            if (files.size() > 1)
+                msg(io, "xmodem sends one file only");
+            return true;
+        }
+    }
+    return x.wait_start() && x.send_header(0, 0, 0, 0);
+}
+
+static bool xy_receive(XferIo& io, const xfer::Proto p, const char *path)
+{
+    Xmodem      x(io, p != xfer::XMODEM);
+    std::string name;
+    bool        eot;
+
+    if (p != xfer::YMODEM)
+    {
+        if (!path || !*path)
+        {
+            msg(io, "xmodem needs a file name");
+            return false;
+        }
+        FILE *f = fopen(path, "wb");
+        if (!f)
+        {
+            msg(io, "%s: %s", path, strerror(errno));
+            return false;
+        }
+        setvbuf(f, 0, _IOFBF, FILE_BUF);
+        bool ok = x.recv_file(f, path, 0, eot);
+        if (fclose(f))
+            ok = false;
+        return ok;
+    }
+
+    for (;;)
+    {
+        std::string sent;
+        uint64_t    size = 0;
+        int         rc = x.recv_header(sent, size);
+
+        if (rc <= 0)
+            return rc == 0;
+        FILE *f = open_recv(path, sent.c_str(), name);
+        if (!f)
+        {
+            msg(io, "%s: %s", name.c_str(), strerror(errno));
+            cancel(io);
+            return false;
+        }
+        bool ok = x.recv_file(f, name.c_str(), size, eot);
+        if (fclose(f))
+            ok = false;
+        if (!ok)
+            return false;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// ZMODEM
+////////////////////////////////////////////////////////////////////////
+namespace
+{
+    // Frame types
+    enum
+    {
+        ZRQINIT, ZRINIT, ZSINIT, ZACK, ZFILE, ZSKIP, ZNAK, ZABORT, ZFIN,
+        ZRPOS, ZDATA, ZEOF, ZFERR, ZCRC, ZCHALLENGE, ZCOMPL, ZCAN, ZFREECNT,
+        ZCOMMAND, ZSTDERR
+    };
+
+    const unsigned char ZPAD = '*';
+    const unsigned char ZDLE = 0x18;
+    const unsigned char ZBIN = 'A';
+    const unsigned char ZHEX = 'B';
+    const unsigned char ZBIN32 = 'C';
+
+    // Data subpacket ends
+    const unsigned char ZCRCE = 'h';    // end of frame, header follows
+    const unsigned char ZCRCG = 'i';    // frame continues
+    const unsigned char ZCRCQ = 'j';    // frame continues, ZACK expected
+    const unsigned char ZCRCW = 'k';    // end of frame, ZACK expected
+    const unsigned char ZRUB0 = 'l';
+    const unsigned char ZRUB1 = 'm';
+
+    // ZRINIT flags
+    const unsigned char CANFDX = 0x01;
+    const unsigned char CANOVIO = 0x02;
+    const unsigned char CANFC32 = 0x20;
+
+    // Header byte positions
+    const int ZF0 = 3;
+    const int ZP0 = 0;
+    const int ZP1 = 1;
+
+    // zdlread() results besides the data bytes
+    const int GOTFRAME = 0x100;         // | frame end
+    const int ZERROR = -3;
+    const int ZCANCEL = -4;
+
+    const size_t SUBPACKET = 1024;
+    const size_t MAXSUBPACKET = 8192;
+    const uint64_t ACK_EVERY = 16 * 1024;   // ZCRCQ spacing
+    const uint64_t WINDOW = 128 * 1024;     // unacknowledged data in flight
+
+    class Zmodem
+    {
+    public:
+        Zmodem(XferIo& io) : io(io), use32(false), rx32(false), last(0)
+        {
+            crc_init();
+            memset(esc, 0, sizeof(esc));
+            static const unsigned char e[] = { ZDLE, 0x10, 0x11, 0x13, 0x90, 0x91, 0x93, 0x98 };
+            for (size_t i=0; i<sizeof(e); i++)
+                esc[e[i]] = true;
+        }
+
+        bool send(const std::vector<std::string>& files);
+        bool receive(const char *dir);
+
+    private:
+        XferIo&       io;
+        bool          use32;            // send binary headers and data with CRC32
+        bool          rx32;             // the last received header was ZBIN32
+        unsigned char last;             // last byte sent, for "@\r" escaping
+        bool          esc[256];
+        std::string   out;
+        unsigned char hdr[4];
+        unsigned char data[MAXSUBPACKET];
+
+        static void     set_pos(unsigned char *h, const uint64_t pos);
+        static uint32_t get_pos(const unsigned char *h);
+
+        void put(const unsigned char c);
+        void hex_header(const int type, const unsigned char *h);
+        void bin_header(const int type, const unsigned char *h);
+        void subpacket(const unsigned char *p, const size_t n, const unsigned char end);
+        bool flush();
+        bool send_hex(const int type, const uint64_t pos = 0);
+
+        int  zgetc(const int timeout_ms);
+        int  zdlread(const int timeout_ms);
+        int  hexbyte(const int timeout_ms);
+        int  recv_header(const int timeout_ms);
+        int  recv_data(size_t& len, const int timeout_ms);
+
+        bool send_file(FILE *f, const char *name, const uint64_t size, const time_t mtime,
+                       const unsigned mode, const size_t left, const uint64_t bytes_left);
+        bool send_data(FILE *f, const char *name, const uint64_t size, uint64_t pos, unsigned bufsize);
+    };
+};
+
+void Zmodem::set_pos(unsigned char *h, const uint64_t pos)
+{
+    h[0] = pos;
+    h[1] = pos >> 8;
+    h[2] = pos >> 16;
+    h[3] = pos >> 24;
+}
+
+uint32_t Zmodem::get_pos(const unsigned char *h)
+{
+    return h[0] | (h[1] << 8) | (h[2] << 16) | ((uint32_t)h[3] << 24);
+}
+
+// Append ZDLE escaped byte
+inline void Zmodem::put(const unsigned char c)
+{
+    if (esc[c] || ((c & 0x7f) == '\r' && (last & 0x7f) == '@'))
+    {
+        out += (char)ZDLE;
+        out += (char)(c ^ 0x40);
+    }
+    else
+        out += (char)c;
+    last = c;
+}
+
+void Zmodem::hex_header(const int type, const unsigned char *h)
+{
+    static const char digits[] = "0123456789abcdef";
+    unsigned char     b[7];
+
+    b[0] = type;
+    memcpy(b + 1, h, 4);
+    uint16_t crc = xfer::crc16(b, 5);
+    b[5] = crc >> 8;
+    b[6] = crc;
+
+    out += (char)ZPAD;
+    out += (char)ZPAD;
+    out += (char)ZDLE;
+    out += (char)ZHEX;
+    for (int i=0; i<7; i++)
+    {
+        out += digits[b[i] >> 4];
+        out += digits[b[i] & 15];
+    }
+    out += '\r';
+    out += (char)0x8a;
+    if (type != ZFIN && type != ZACK)
+        out += (char)XON;
+    last = 0;
+}
+
+void Zmodem::bin_header(const int type, const unsigned char *h)
+{
+    unsigned char b[5];
+
+    b[0] = type;
+    memcpy(b + 1, h, 4);
+    out += (char)ZPAD;
+    out += (char)ZDLE;
+    if (use32)
+    {
+        out += (char)ZBIN32;
+        uint32_t crc = ~xfer::crc32(b, 5);
+        for (int i=0; i<5; i++)
+            put(b[i]);
+        for (int i=0; i<4; i++)
+            put(crc >> (8 * i));
+    }
+    else
+    {
+        out += (char)ZBIN;
+        uint16_t crc = xfer::crc16(b, 5);
+        for (int i=0; i<5; i++)
+            put(b[i]);
+        put(crc >> 8);
+        put(crc);
+    }
+}
+
+void Zmodem::subpacket(const unsigned char *p, const size_t n, const unsigned char end)
+{
+    if (use32)
+    {
+        uint32_t crc = 0xffffffff;
+        for (size_t i=0; i<n; i++)
+        {
+            put(p[i]);
+            crc = crc32_upd(crc, p[i]);
+        }
+        crc = ~crc32_upd(crc, end);
+        out += (char)ZDLE;
+        out += (char)end;
+        for (int i=0; i<4; i++)
+            put(crc >> (8 * i));
+    }
+    else
+    {
+        uint16_t crc = 0;
+        for (size_t i=0; i<n; i++)
+        {
+            put(p[i]);
+            crc = crc16_upd(crc, p[i]);
+        }
+        crc = crc16_upd(crc, end);
+        out += (char)ZDLE;
+        out += (char)end;
+        put(crc >> 8);
+        put(crc);
+    }
+    if (end == ZCRCW)
+        out += (char)XON;
+}
+
+bool Zmodem::flush()
+{
+    bool ok = io.write(out);
+    out.clear();
+    return ok;
+}
+
+bool Zmodem::send_hex(const int type, const uint64_t pos)
+{
+    unsigned char h[4];
+
+    set_pos(h, pos);
+    hex_header(type, h);
+    return flush();
+}
+
+// Raw byte, flow control characters are dropped
+int Zmodem::zgetc(const int timeout_ms)
+{
+    for (;;)
+    {
+        int c = io.getc(timeout_ms);
+        if (c != 0x11 && c != 0x13 && c != 0x91 && c != 0x93)
+            return c;
+    }
+}
+
+// Byte with ZDLE escapes decoded, or GOTFRAME | frame end
+int Zmodem::zdlread(const int timeout_ms)
+{
+    int c = zgetc(timeout_ms);
+
+    if (c != ZDLE)
+        return c;
+    for (int cans = 1;;)
+    {
+        c = zgetc(timeout_ms);
+        if (c < 0)
+            return c;
+        switch (c)
+        {
+        case ZDLE:
+            if (++cans >= 5)
+                return ZCANCEL;
+            break;
+        case ZCRCE:
+        case ZCRCG:
+        case ZCRCQ:
+        case ZCRCW:
+            return GOTFRAME | c;
+        case ZRUB0:
+            return 0x7f;
+        case ZRUB1:
+            return 0xff;
+        default:
+            if ((c & 0x60) == 0x40)
+                return c ^ 0x40;
+            return ZERROR;
+        }
+    }
+}
+
+int Zmodem::hexbyte(const int timeout_ms)
+{
+    int v = 0;
+
+    for (int i=0; i<2; i++)
+    {
+        int c = zgetc(timeout_ms);
+        if (c < 0)
+            return c;
+        c &= 0x7f;
+        if (c >= '0' && c <= '9')
+            v = (v << 4) | (c - '0');
+        else if (c >= 'a' && c <= 'f')
+            v = (v << 4) | (c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F')
+            v = (v << 4) | (c - 'A' + 10);
+        else
+            return ZERROR;
+    }
+    return v;
+}
+
+/* Receive a header into hdr
+   \return frame type, XferIo::TIMEOUT, XferIo::FAIL, ZERROR or ZCANCEL
+*/
+int Zmodem::recv_header(const int timeout_ms)
+{
+    int           garbage = 0;
+    int           cans = 0;
+    unsigned char b[9];
+    int           c;
+
+    for (;;)
+    {
+        c = zgetc(timeout_ms);
+        if (c < 0)
+            return c;
+        if (c == CAN)
+        {
+            if (++cans >= 5)
+                return ZCANCEL;
+            continue;
+        }
+        cans = 0;
+        if (c != ZPAD)
+        {
+            if (++garbage > 8192)
+                return ZERROR;
+            continue;
+        }
+        do
+            c = zgetc(timeout_ms);
+        while (c == ZPAD);
+        if (c < 0)
+            return c;
+        if (c != ZDLE)
+            continue;
+        c = zgetc(timeout_ms);
+        if (c == ZBIN || c == ZHEX || c == ZBIN32)
+            break;
+        if (c < 0)
+            return c;
+    }
+
+    int kind = c;
+    int n = kind == ZBIN32 ? 9 : 7;
+    for (int i=0; i<n; i++)
+    {
+        c = kind == ZHEX ? hexbyte(timeout_ms) : zdlread(timeout_ms);
+        if (c < 0)
+            return c;
+        if (c & GOTFRAME)
+            return ZERROR;
+        b[i] = c;
+    }
+
+    if (kind == ZBIN32)
+    {
+        uint32_t crc = ~xfer::crc32(b, 5);
+        if (crc != (b[5] | (b[6] << 8) | (b[7] << 16) | ((uint32_t)b[8] << 24)))
+            return ZERROR;
+    }
+    else if (xfer::crc16(b, 7))
+        return ZERROR;
+
+    if (kind == ZHEX)
+    {
+        // CR LF and possibly XON
+        c = io.getc(100);
+        if (c >= 0 && (c & 0x7f) == '\r')
+            io.getc(100);
+    }
+    else
+        rx32 = kind == ZBIN32;
+
+    memcpy(hdr, b + 1, 4);
+    return b[0];
+}
+
+/* Receive a data subpacket into data
+   \return frame end, XferIo::TIMEOUT, XferIo::FAIL, ZERROR or ZCANCEL
+*/
+int Zmodem::recv_data(size_t& len, const int timeout_ms)
+{
+    uint32_t crc32 = 0xffffffff;
+    uint16_t crc16 = 0;
+    int      c;
+
+    len = 0;
+    for (;;)
+    {
+        c = zdlread(timeout_ms);
+        if (c < 0)
+            return c;
+        if (c & GOTFRAME)
+            break;
+        if (len >= sizeof(data))
+            return ZERROR;
+        data[len++] = c;
+        if (rx32)
+            crc32 = crc32_upd(crc32, c);
+        else
+            crc16 = crc16_upd(crc16, c);
+    }
+
+    int end = c & 0xff;
+    int n = rx32 ? 4 : 2;
+    unsigned char b[4];
+    for (int i=0; i<n; i++)
+    {
+        c = zdlread(timeout_ms);
+        if (c < 0)
+            return c;
+        if (c & GOTFRAME)
+            return ZERROR;
+        b[i] = c;
+    }
+    if (rx32)
+    {
+        crc32 = ~crc32_upd(crc32, end);
+        if (crc32 != (b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24)))
+            return ZERROR;
+    }
+    else
+    {
+        crc16 = crc16_upd(crc16, end);
+        if (crc16 != ((b[0] << 8) | b[1]))
+            return ZERROR;
+    }
+    return end;
+}
+
+/* Stream the file data starting at pos. The frame is a ZDATA header
+   followed by ZCRCG subpackets, a ZCRCQ every ACK_EVERY bytes asks for
+   ZACK and no more than WINDOW bytes are sent ahead of the last ZACK.
+   Receivers with a limited buffer get ZCRCW after every bufsize bytes.
+   ZRPOS from the receiver restarts the stream at the given position
+*/
+bool Zmodem::send_data(FILE *f, const char *name, const uint64_t size, uint64_t pos, unsigned bufsize)
+{
+    unsigned char buf[SUBPACKET];
+    uint64_t      acked = pos;
+    int           errors = 0;
+
+    for (;;)
+    {
+    restart:
+        if (errors > RETRIES)
+        {
+            msg(io, "too many errors");
+            return false;
+        }
+        if (fseeko(f, pos, SEEK_SET))
+            return false;
+        unsigned char h[4];
+        set_pos(h, pos);
+        bin_header(ZDATA, h);
+
+        uint64_t since_wait = 0;
+        uint64_t since_ack = 0;
+        for (;;)
+        {
+            size_t n = fread(buf, 1, sizeof(buf), f);
+            if (!n && ferror(f))
+            {
+                msg(io, "%s: read error: %s", name, strerror(errno));
+                return false;
+            }
+
+            unsigned char end = ZCRCG;
+            bool          wait = false;
+            since_wait += n;
+            since_ack += n;
+            if (pos + n >= size)
+                end = ZCRCE;
+            else if (bufsize && since_wait + sizeof(buf) > bufsize)
+            {
+                end = ZCRCW;
+                wait = true;
+            }
+            else if (since_ack >= ACK_EVERY)
+            {
+                end = ZCRCQ;
+                since_ack = 0;
+            }
+            subpacket(buf, n, end);
+            pos += n;
+            if (out.size() >= 16 * 1024 || end != ZCRCG)
+                if (!flush())
+                    return false;
+
+            // Whatever the receiver has to say
+            for (;;)
+            {
+                bool block = wait || pos - acked > WINDOW;
+                int  c = io.getc(block ? 10000 : 0);
+                if (c == XferIo::TIMEOUT && !block)
+                    break;
+                if (c == XferIo::FAIL)
+                    return false;
+                if (c == XferIo::TIMEOUT)
+                {
+                    // Lost ZACK, ask for the position
+                    errors++;
+                    pos = acked;
+                    goto restart;
+                }
+                if (c != ZPAD)
+                    continue;
+                int t = recv_header(1000);
+                switch (t)
+                {
+                case ZACK:
+                    acked = get_pos(hdr);
+                    if (wait && acked == pos)
+                    {
+                        wait = false;
+                        since_wait = 0;
+                        goto restart;
+                    }
+                    break;
+                case ZRPOS:
+                    // Errors count while there is no progress
+                    if (get_pos(hdr) > acked)
+                        errors = 0;
+                    errors++;
+                    pos = acked = get_pos(hdr);
+                    subpacket(buf, 0, ZCRCE);
+                    if (!flush())
+                        return false;
+                    io.purge(50);
+                    goto restart;
+                case ZSKIP:
+                case ZRINIT:
+                    return true;
+                case ZCANCEL:
+                case ZABORT:
+                case ZFERR:
+                case XferIo::FAIL:
+                    msg(io, "cancelled by receiver");
+                    return false;
+                default:
+                    break;
+                }
+            }
+            io.progress(name, pos, size);
+            if (end == ZCRCE)
+                return true;
+        }
+    }
+}
+
+bool Zmodem::send_file(FILE *f, const char *name, const uint64_t size, const time_t mtime,
+                       const unsigned mode, const size_t left, const uint64_t bytes_left)
+{
+    unsigned char info[1024];
+    int           len;
+    unsigned      bufsize = 0;
+
+    len = snprintf((char *)info, sizeof(info) - 80, "%s", name) + 1;
+    len += snprintf((char *)info + len, sizeof(info) - len, "%llu %lo %o 0 %u %llu",
+                    (unsigned long long)size, (unsigned long)mtime, mode, (unsigned)left,
+                    (unsigned long long)bytes_left) + 1;
+
+    for (int retry=0; retry<RETRIES; retry++)
+    {
+        unsigned char h[4] = { 0, 0, 0, 0 };
+        bin_header(ZFILE, h);
+        subpacket(info, len, ZCRCW);
+        if (!flush())
+            return false;
+
+        for (;;)
+        {
+            int t = recv_header(10000);
+            switch (t)
+            {
+            case ZRINIT:
+                bufsize = hdr[ZP0] | (hdr[ZP1] << 8);
+                continue;
+            case ZRPOS:
+            {
+                // Send until the end of file is acknowledged
+                uint64_t pos = get_pos(hdr);
+                for (int eofs=0; eofs<RETRIES; eofs++)
+                {
+                    if (!send_data(f, name, size, pos, bufsize))
+                        return false;
+                    if (!send_hex(ZEOF, size))
+                        return false;
+                    for (;;)
+                    {
+                        t = recv_header(10000);
+                        if (t == ZACK)
+                            continue;
+                        break;
+                    }
+                    if (t == ZRINIT)
+                        return true;
+                    if (t == ZSKIP)
+                        return true;
+                    if (t == ZRPOS)
+                    {
+                        pos = get_pos(hdr);
+                        continue;
+                    }
+                    if (t == ZCANCEL || t == ZABORT || t == XferIo::FAIL)
+                        return false;
+                    pos = size;
+                }
+                return false;
+            }
+            case ZSKIP:
+                msg(io, "%s: skipped by receiver", name);
+                return true;
+            case ZCRC:
+            {
+                // File CRC for crash recovery
+                uint32_t crc = 0xffffffff;
+                size_t   n;
+                unsigned char buf[4096];
+                rewind(f);
+                while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+                    crc = xfer::crc32(buf, n, crc);
+                if (!send_hex(ZCRC, ~crc))
+                    return false;
+                continue;
+            }
+            case ZCANCEL:
+            case ZABORT:
+            case ZFERR:
+            case XferIo::FAIL:
+                msg(io, "cancelled by receiver");
+                return false;
+            default:
+                break;
+            }
+            break;
+        }
+    }
+    msg(io, "%s: receiver doesn't accept the file", name);
+    return false;
+}
+
+bool Zmodem::send(const std::vector<std::string>& files)
+{
+    int t = XferIo::TIMEOUT;
+
+    // "rz\r" starts the receiver on the other side
+    out = "rz\r";
+    for (int retry=0; retry<RETRIES; retry++)
+    {
+        if (!send_hex(ZRQINIT))
+            return false;
+        t = recv_header(5000);
+        if (t == ZRINIT)
+            break;
+        if (t == ZCHALLENGE)
+        {
+            send_hex(ZACK, get_pos(hdr));
+            retry--;
+        }
+        if (t == ZCANCEL || t == XferIo::FAIL)
+            return false;
+    }
+    if (t != ZRINIT)
+    {
+        msg(io, "receiver is not ready");
+        return false;
+    }
+    use32 = hdr[ZF0] & CANFC32;
+
+    uint64_t bytes_left = 0;
+    for (size_t i=0; i<files.size(); i++)
+    {
+        struct stat st;
+        if (!stat(files[i].c_str(), &st))
+            bytes_left += st.st_size;
+    }
+
+    for (size_t i=0; i<files.size(); i++)
+    {
+        uint64_t size;
+        time_t   mtime;
+        unsigned mode;
+        FILE     *f = open_send(files[i], size, mtime, mode);
+
+        if (!f)
+        {
+            msg(io, "%s: %s", files[i].c_str(), strerror(errno));
+            continue;
+        }
+        bool ok = send_file(f, base_name(files[i]), size, mtime, mode, files.size() - i, bytes_left);
+        fclose(f);
+        if (!ok)
+        {
+            cancel(io);
+            return false;
+        }
+        bytes_left -= size;
+    }
+
+    for (int retry=0; retry<3; retry++)
+    {
+        if (!send_hex(ZFIN))
+            return false;
+        t = recv_header(5000);
+        if (t == ZFIN)
+            break;
+    }
+    return io.write("OO", 2);
+}
+
+bool Zmodem::receive(const char *dir)
+{
+    FILE        *f = 0;
+    std::string name;
+    uint64_t    size = 0;
+    uint64_t    pos = 0;
+    int         errors = 0;
+    bool        ok = false;
+    unsigned char flags[4] = { 0, 0, 0, CANFDX | CANOVIO | CANFC32 };
+
+    hex_header(ZRINIT, flags);
+    if (!flush())
+        return false;
+
+    for (;;)
+    {
+        int t = recv_header(10000);
+        switch (t)
+        {
+        case ZRQINIT:
+            hex_header(ZRINIT, flags);
+            if (!flush())
+                goto out;
+            continue;
+
+        case ZSINIT:
+        {
+            size_t len;
+            if (recv_data(len, 10000) < 0)
+                break;
+            if (!send_hex(ZACK))
+                goto out;
+            continue;
+        }
+
+        case ZFILE:
+        {
+            size_t len;
+            int    end = recv_data(len, 10000);
+            if (end < 0)
+                break;
+            if (f)
+                fclose(f);
+            data[len < sizeof(data) ? len : sizeof(data) - 1] = 0;
+            const char *sent = (const char *)data;
+            const char *info = sent + strlen(sent) + 1;
+            size = (size_t)(info - sent) < len ? strtoull(info, 0, 10) : 0;
+            f = open_recv(dir, sent, name);
+            if (!f)
+            {
+                msg(io, "%s: %s", name.c_str(), strerror(errno));
+                if (!send_hex(ZSKIP))
+                    goto out;
+                continue;
+            }
+            pos = 0;
+            errors = 0;
+            if (!send_hex(ZRPOS, pos))
+                goto out;
+            continue;
+        }
+
+        case ZDATA:
+        {
+            if (!f)
+            {
+                if (!send_hex(ZSKIP))
+                    goto out;
+                continue;
+            }
+            if (get_pos(hdr) != (uint32_t)pos)
+            {
+                io.purge(50);
+                if (!send_hex(ZRPOS, pos))
+                    goto out;
+                continue;
+            }
+            for (;;)
+            {
+                size_t len;
+                int    end = recv_data(len, 10000);
+                if (end < 0)
+                {
+                    if (end == ZCANCEL || end == XferIo::FAIL)
+                        goto out;
+                    if (++errors > RETRIES)
+                    {
+                        msg(io, "too many errors");
+                        goto out;
+                    }
+                    io.purge(50);
+                    if (!send_hex(ZRPOS, pos))
+                        goto out;
+                    break;
+                }
+                if (fwrite(data, 1, len, f) != len)
+                {
+                    msg(io, "%s: write error: %s", name.c_str(), strerror(errno));
+                    send_hex(ZFERR);
+                    goto out;
+                }
+                pos += len;
+                errors = 0;
+                io.progress(name.c_str(), pos, size);
+                if (end == ZCRCW || end == ZCRCQ)
+                    if (!send_hex(ZACK, pos))
+                        goto out;
+                if (end == ZCRCW || end == ZCRCE)
+                    break;
+            }
+            continue;
+        }
+
+        case ZEOF:
+            // ZEOF with other position comes before the data we asked for
+            if (!f || get_pos(hdr) != (uint32_t)pos)
+                continue;
+            if (fclose(f))
+            {
+                f = 0;
+                msg(io, "%s: write error: %s", name.c_str(), strerror(errno));
+                goto out;
+            }
+            f = 0;
+            hex_header(ZRINIT, flags);
+            if (!flush())
+                goto out;
+            continue;
+
+        case ZFIN:
+            send_hex(ZFIN);
+            // "OO" from the sender
+            for (int i=0; i<2; i++)
+                if (io.getc(1000) < 0)
+                    break;
+            ok = true;
+            goto out;
+
+        case ZCANCEL:
+        case ZABORT:
+        case XferIo::FAIL:
+            msg(io, "cancelled");
+            goto out;
+
+        default:
+            break;
+        }
+
+        // Timeout or garbage
+        if (++errors > RETRIES)
+        {
+            msg(io, "sender is not responding");
+            goto out;
+        }
+        if (f)
+            send_hex(ZRPOS, pos);
+        else
+        {
+            hex_header(ZRINIT, flags);
+            flush();
+        }
+    }
+
+out:
+    if (f)
+    {
+        fclose(f);
+        cancel(io);
+    }
+    else if (!ok)
+        cancel(io);
+    return ok;
+}
+
+////////////////////////////////////////////////////////////////////////
+bool xfer::send(XferIo& io, const Proto p, const std::vector<std::string>& files)
+{
+    crc_init();
+    if (files.empty())
+    {
+        msg(io, "no files to send");
+        return false;
+    }
+    if (p == ZMODEM)
+    {
+        Zmodem z(io);
+        return z.send(files);
+    }
+    return xy_send(io, p, files);
+}
+
+bool xfer::receive(XferIo& io, const Proto p, const char *path)
+{
+    crc_init();
+    if (p == ZMODEM)
+    {
+        Zmodem z(io);
+        return z.receive(path);
+    }
+    return xy_receive(io, p, path);
+}
@@ -0,0 +1,106 @@
+/*********************
+ * File transfer
+ *********************
+ *
+ */
+#ifndef XFER_H
+#define XFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+/*!
+  \class XferIo
+  \brief Byte channel used by the file transfer engines
+
+  The derived class supplies raw reads and writes of the already open
+  connection, so the transfer works on whatever the session uses
+  (tty, socket, receive ring) without reopening or resetting it.
+*/
+class XferIo
+{
+public:
+    //! getc() results
+    enum { TIMEOUT = -1, FAIL = -2 };
+
+    XferIo();
+    virtual ~XferIo();
+
+    /*! Get one byte
+      \return byte value, TIMEOUT or FAIL (error or aborted by user)
+     */
+    int  getc(const int timeout_ms);
+
+    //! Write all the data, false on failure
+    bool write(const void *buf, const int cnt);
+    bool write(const std::string& s) { return write(s.data(), s.size()); }
+
+    /*! Read up to \e max bytes, buffered data first
+      \return number of bytes, 0 on timeout, < 0 on failure or abort
+     */
+    int  read(unsigned char *buf, const int max, const int timeout_ms);
+
+    //! Drop the input until the line is quiet for \e quiet_ms
+    void purge(const int quiet_ms = 100);
+
+    //! Wait until the written data is physically sent
+    virtual bool drain();
+
+    //! Show data received while sending text (echo, prompts)
+    virtual void pass(const unsigned char *p, const int n);
+
+    //! Progress report, called on every block
+    virtual void progress(const char *name, const uint64_t done, const uint64_t total);
+
+    //! Status message
+    virtual void message(const char *msg);
+
+protected:
+    /*! Read up to \e max bytes
+      \return number of bytes, 0 on timeout, < 0 on failure or abort
+     */
+    virtual int raw_read(unsigned char *buf, const int max, const int timeout_ms) = 0;
+
+    /*! Write data
+      \return number of bytes written, < 0 on failure
+     */
+    virtual int raw_write(const unsigned char *buf, const int cnt) = 0;
+
+private:
+    unsigned char rbuf[4096];
+    int           rpos;
+    int           rlen;
+};
+
+namespace xfer
+{
+    enum Proto { XMODEM, XMODEM1K, YMODEM, ZMODEM };
+
+    /*! Parse protocol name: "x"/"xmodem", "1k"/"xmodem1k",
+      "y"/"ymodem" or "z"/"zmodem"
+     */
+    bool parse_proto(const char *s, Proto& p);
+    const char *proto_name(const Proto p);
+
+    /*! Send files
+      XMODEM variants send the first file only
+     */
+    bool send(XferIo& io, const Proto p, const std::vector<std::string>& files);
+
+    /*! Receive files
+      \param path file name for XMODEM, directory for YMODEM and ZMODEM
+      (0 - current directory)
+     */
+    bool receive(XferIo& io, const Proto p, const char *path);
+
+    //! CRC16 (XMODEM, polynomial 0x1021)
+    uint16_t crc16(const unsigned char *p, size_t n, uint16_t crc = 0);
+
+    //! CRC32 (IEEE 802.3), without final inversion
+    uint32_t crc32(const unsigned char *p, size_t n, uint32_t crc = 0xffffffff);
+};
+
+#endif